@@ -0,0 +1,408 @@
+#! /usr/bin/env perl
+# bench.pl - performance benchmarks for daemonproxy (make bench)
+# Copyright (C) 2014  Michael Conrad
+# Distributed under GPLv2, see LICENSE
+
+=head1 USAGE
+
+  bench.pl [--scale N] [--repeat N] [BENCHMARK ...] [-- DAEMONPROXY_OPTION ...]
+
+Runs each benchmark (or all of them) against a fresh instance of the built
+daemonproxy, driving it as a controller through a control socket.  Options
+after C<--> are passed to daemonproxy, for comparing things like
+C<--event-backend select>.  C<--scale> multiplies the amount of work in each
+benchmark, and C<--repeat> runs each one several times.
+
+Like the tests, the binary is found in $ENV{builddir} (default "build"),
+and the socket is created in $ENV{tempdir} (default "build").
+
+=head1 OUTPUT
+
+Results are printed to stdout as tab-separated lines, so they can be
+collected and compared between releases:
+
+  version  VERSION_STRING
+  option   DAEMONPROXY_OPTION ...
+  result   BENCHMARK  METRIC  VALUE  UNIT
+
+Progress and errors go to stderr.
+
+=head1 BENCHMARKS
+
+=over
+
+=item spawn
+
+Start 500 services (of C</bin/true>) at once, and measure how many per
+second reach the "up" state, and daemonproxy's own service.spawn latency.
+
+=item restart
+
+Run 50 services with "auto_up 1 always" that each exit after just over a
+second, and report the reap-to-restart latency from daemonproxy's
+service.restart histogram.
+
+=item command
+
+Send 100000 "echo" commands as fast as they are accepted, both one by one
+and inside batch.begin/batch.end, and measure commands per second.
+
+=item signal
+
+Send daemonproxy 200 SIGUSR1s one at a time, and measure the time until
+the controller receives each "signal" event.
+
+=item statedump
+
+Define 1000 and then 10000 services, and time a statedump of each.
+
+=back
+
+=cut
+
+use strict;
+use warnings;
+use Getopt::Long;
+use Socket;
+use IO::Handle;
+use IO::Select;
+use POSIX ();
+use Time::HiRes qw( time sleep );
+
+my %benchmarks= (
+	spawn     => \&bench_spawn,
+	restart   => \&bench_restart,
+	command   => \&bench_command,
+	signal    => \&bench_signal,
+	statedump => \&bench_statedump,
+);
+my @bench_order= qw( spawn restart command signal statedump );
+
+my $scale= 1;
+my $repeat= 1;
+GetOptions(
+	'scale=f'  => \$scale,
+	'repeat=i' => \$repeat,
+	'help'     => sub { exec('perldoc', '-t', $0) },
+) or die "Invalid options (see --help)\n";
+
+# GetOptions stops at "--", and leaves it in @ARGV
+my @dp_opts;
+my ($dash)= grep { $ARGV[$_] eq '--' } 0..$#ARGV;
+if (defined $dash) {
+	@dp_opts= @ARGV[$dash+1 .. $#ARGV];
+	splice(@ARGV, $dash);
+}
+my @run= @ARGV? @ARGV : @bench_order;
+$benchmarks{$_} or die "No benchmark named \"$_\"\n" for @run;
+
+my $binary= ($ENV{builddir} || 'build').'/daemonproxy';
+-x $binary or die "Cannot execute \"$binary\".  Set env 'builddir' to correct directory\n";
+my $tempdir= $ENV{tempdir} || 'build';
+-d $tempdir or die "Cannot write tempdir \"$tempdir\".  Set env 'tempdir' to correct directory\n";
+
+$| = 1;
+$SIG{PIPE}= 'IGNORE';
+my ($version)= `$binary --version` =~ /^daemonproxy version (\S+)/;
+print join("\t", 'version', $version || 'unknown')."\n";
+print join("\t", 'option', @dp_opts)."\n" if @dp_opts;
+
+for my $name (@run) {
+	for (1..$repeat) {
+		print STDERR "# $name\n";
+		$benchmarks{$name}->(BenchController->new($binary, "$tempdir/bench-socket", @dp_opts));
+	}
+}
+
+sub result {
+	my ($bench, $metric, $value, $unit)= @_;
+	print join("\t", 'result', $bench, $metric, $value, $unit)."\n";
+}
+
+sub n { int($_[0] * $scale) || 1 }
+
+sub percentile {
+	my ($pct, @sorted)= @_;
+	return $sorted[ int($#sorted * $pct / 100 + .5) ];
+}
+
+# Define services with one batch, discarding the events
+sub define_services {
+	my ($dp, $prefix, $count, @args)= @_;
+	$dp->send('batch.begin', 'define');
+	for (1..$count) {
+		$dp->send('service.args', "$prefix$_", @args);
+		$dp->send('service.fds', "$prefix$_", 'null', 'null', 'null');
+	}
+	$dp->send('batch.end');
+	$dp->recv_until(qr/^batch.end\tdefine\t(\w+)/m, 60) eq 'ok'
+		or die "defining services failed: ".$dp->last_line."\n";
+}
+
+sub bench_spawn {
+	my $dp= shift;
+	my $count= n(500);
+	$dp->send('conn.subscribe', 'event:service.state');
+	define_services($dp, 'spawn', $count, 'true');
+	my $t0= time;
+	$dp->send('batch.begin', 'start');
+	$dp->send('service.start', "spawn$_") for 1..$count;
+	$dp->send('batch.end');
+	# fast services can exit before the last one starts
+	my ($up, $down, $elapsed)= (0, 0);
+	$dp->recv_lines(60, sub {
+		if ($_[0] =~ /^service.state\tspawn\d+\tup\t/) {
+			$elapsed= time - $t0 if ++$up == $count;
+		}
+		elsif ($_[0] =~ /^service.state\tspawn\d+\tdown\t\d+/) {
+			++$down;
+		}
+		return $up == $count && $down == $count;
+	});
+	my %stats= $dp->stats;
+	my ($n, $sum, $max)= split /\t/, $stats{'service.spawn'};
+	result('spawn', 'services', $count, 'count');
+	result('spawn', 'rate', sprintf("%.1f", $count / $elapsed), 'per_sec');
+	result('spawn', 'latency_mean', int($sum / ($n||1)), 'usec');
+	result('spawn', 'latency_max', $max, 'usec');
+	$dp->terminate;
+}
+
+sub bench_restart {
+	my $dp= shift;
+	my $count= n(50);
+	$dp->send('conn.subscribe', 'event:service.state');
+	define_services($dp, 'restart', $count, 'sleep', '1.05');
+	$dp->send('batch.begin', 'auto_up');
+	$dp->send('service.auto_up', "restart$_", 1, 'always') for 1..$count;
+	$dp->send('batch.end');
+	$dp->recv_until(qr/^batch.end\tauto_up\t/m, 60);
+	# Each service restarts about once a second
+	$dp->recv_count(qr/^service.state\trestart\d+\tup\t/m, $count * 4, 60);
+	my %stats= $dp->stats;
+	my ($n, $sum, $max)= split /\t/, $stats{'service.restart'};
+	$dp->send('batch.begin', 'auto_up');
+	$dp->send('service.auto_up', "restart$_", 1) for 1..$count;
+	$dp->send('batch.end');
+	$dp->recv_until(qr/^batch.end\tauto_up\t/m, 60);
+	result('restart', 'restarts', $n, 'count');
+	result('restart', 'latency_mean', int($sum / ($n||1)), 'usec');
+	result('restart', 'latency_max', $max, 'usec');
+	$dp->terminate;
+}
+
+sub bench_command {
+	my $dp= shift;
+	my $count= n(100000);
+	my $t0= time;
+	$dp->send_bulk(join('', ("echo\tx\n") x $count)."echo\tend\n", qr/^end$/m, 120);
+	result('command', 'echo_rate', sprintf("%.0f", $count / (time - $t0)), 'per_sec');
+
+	$t0= time;
+	$dp->send_bulk("batch.begin\tb\n".join('', ("echo\tx\n") x $count)."batch.end\n", qr/^batch.end\tb\t/m, 120);
+	result('command', 'batch_echo_rate', sprintf("%.0f", $count / (time - $t0)), 'per_sec');
+	$dp->terminate;
+}
+
+sub bench_signal {
+	my $dp= shift;
+	my $count= n(200);
+	my @lat;
+	$dp->send('conn.subscribe', 'event:signal');
+	$dp->sync;
+	for (1..$count) {
+		my $t0= time;
+		kill USR1 => $dp->pid;
+		$dp->recv_until(qr/^signal\tSIGUSR1\t/m, 10);
+		push @lat, (time - $t0) * 1000000;
+	}
+	@lat= sort { $a <=> $b } @lat;
+	result('signal', 'latency_median', int(percentile(50, @lat)), 'usec');
+	result('signal', 'latency_p99', int(percentile(99, @lat)), 'usec');
+	result('signal', 'latency_max', int($lat[-1]), 'usec');
+	$dp->terminate;
+}
+
+sub bench_statedump {
+	my $dp= shift;
+	my $defined= 0;
+	$dp->send('conn.subscribe', 'event:service.state');
+	$dp->sync;
+	for my $count (n(1000), n(10000)) {
+		define_services($dp, 'dump', $count, 'true') if $count > $defined;
+		$defined= $count;
+		$dp->send('conn.subscribe');
+		my $t0= time;
+		$dp->send('statedump');
+		$dp->send('echo', 'end');
+		$dp->recv_until(qr/^end$/m, 120);
+		result('statedump', "services_$count", sprintf("%.1f", (time - $t0) * 1000), 'msec');
+		$dp->send('conn.subscribe', 'event:service.state');
+		$dp->sync;
+	}
+	$dp->terminate;
+}
+
+package BenchController;
+use strict;
+use warnings;
+use Socket;
+use IO::Select;
+use Time::HiRes qw( time sleep );
+
+# Run daemonproxy with a control socket, and connect to it
+sub new {
+	my ($class, $binary, $sock_path, @dp_opts)= @_;
+	unlink $sock_path;
+	defined (my $pid= fork()) or die "fork: $!";
+	if (!$pid) {
+		open(STDIN, '<', '/dev/null');
+		open(STDOUT, '>', '/dev/null');
+		open(STDERR, '>', '/dev/null') unless $ENV{BENCH_DEBUG};
+		exec($binary, '-S', $sock_path, @dp_opts) or warn "exec($binary): $!";
+		POSIX::_exit(2);
+	}
+	# The socket might not be listening yet, even after the file exists
+	my $t0= time;
+	socket(my $s, PF_UNIX, SOCK_STREAM, 0) or die "socket: $!";
+	until (connect($s, sockaddr_un($sock_path))) {
+		die "connect($sock_path): $!" if time - $t0 > 5;
+		sleep .01;
+	}
+	$s->blocking(0);
+	my $self= bless { pid => $pid, sock => $s, buffer => '', sock_path => $sock_path }, $class;
+	# Allow long bursts of events without overflowing
+	$self->send('conn.buffer', '64K', '16M');
+	$self->sync;
+	return $self;
+}
+
+sub pid       { $_[0]{pid} }
+sub last_line { $_[0]{last_line} }
+
+# Die if daemonproxy reported an error, since the benchmark's setup is wrong
+sub _check_errors {
+	my ($self, $text)= @_;
+	die "daemonproxy: $1\n" if $text =~ /^error\t(.*)/m;
+}
+
+# Send a command, failing on any error received so far
+sub send {
+	my $self= shift;
+	$self->send_bulk(join("\t", @_)."\n");
+	$self->_check_errors($self->{buffer});
+}
+
+# Write the data while reading responses (so neither side blocks), and then
+# optionally wait for a pattern.
+sub send_bulk {
+	my ($self, $data, $pattern, $timeout)= @_;
+	my $sel= IO::Select->new($self->{sock});
+	my $ofs= 0;
+	while ($ofs < length $data) {
+		my (undef, $w)= IO::Select->select($sel, $sel, undef, 10);
+		$self->_read_more(0) if $self->{sock}->opened;
+		if ($w && @$w) {
+			my $n= syswrite($self->{sock}, $data, 65536, $ofs);
+			die "write to daemonproxy failed: $!\n" unless defined $n || $!{EAGAIN};
+			$ofs += $n || 0;
+		}
+	}
+	$self->recv_until($pattern, $timeout) if $pattern;
+}
+
+sub _read_more {
+	my ($self, $timeout)= @_;
+	if ($timeout) {
+		IO::Select->new($self->{sock})->can_read($timeout) or return 0;
+	}
+	my $n= sysread($self->{sock}, $self->{buffer}, 1024*1024, length $self->{buffer});
+	die "daemonproxy closed the connection\n" if defined $n && $n == 0;
+	return $n;
+}
+
+# Discard input until a line matches the pattern, returning the first capture.
+# Dies if an error is among the lines discarded.
+sub recv_until {
+	my ($self, $pattern, $timeout)= @_;
+	my $deadline= time + ($timeout || 10);
+	while (1) {
+		if ($self->{buffer} =~ $pattern) {
+			my @captures= ($1);
+			my ($start, $eol)= ($-[0], index($self->{buffer}, "\n", $-[0]));
+			$self->_check_errors(substr($self->{buffer}, 0, $start));
+			$self->{last_line}= substr($self->{buffer}, $start, $eol - $start);
+			substr($self->{buffer}, 0, $eol + 1)= '';
+			return $captures[0];
+		}
+		# Keep only the partial last line
+		my $eol= rindex($self->{buffer}, "\n");
+		$self->_check_errors(substr($self->{buffer}, 0, $eol + 1, '')) if $eol >= 0;
+		my $remain= $deadline - time;
+		die "timeout waiting for $pattern\n" if $remain <= 0;
+		$self->_read_more($remain);
+	}
+}
+
+# Pass each line of input to the callback until it returns true
+sub recv_lines {
+	my ($self, $timeout, $callback)= @_;
+	my $deadline= time + ($timeout || 10);
+	my $eol;
+	while (1) {
+		while (($eol= index($self->{buffer}, "\n")) >= 0) {
+			my $line= substr($self->{buffer}, 0, $eol + 1, '');
+			$self->_check_errors($line);
+			return if $callback->($line);
+		}
+		my $remain= $deadline - time;
+		die "timeout waiting for events\n" if $remain <= 0;
+		$self->_read_more($remain);
+	}
+}
+
+# Discard input until the pattern has matched 'count' lines
+sub recv_count {
+	my ($self, $pattern, $count, $timeout)= @_;
+	$self->recv_lines($timeout, sub { $_[0] =~ $pattern && --$count <= 0 });
+}
+
+sub sync {
+	my $self= shift;
+	my $marker= 'sync-'.++$self->{sync_count};
+	$self->send('echo', $marker);
+	$self->recv_until(qr/^\Q$marker\E$/m);
+}
+
+# Return daemonproxy's stats as a hash of name => tab-separated values
+sub stats {
+	my $self= shift;
+	my $marker= 'stats-'.++$self->{sync_count};
+	$self->send('stats');
+	$self->send('echo', $marker);
+	my $end;
+	until (($end= index($self->{buffer}, "\n$marker\n")) >= 0) {
+		$self->_read_more(10) or die "timeout waiting for stats\n";
+	}
+	my $text= substr($self->{buffer}, 0, $end + length($marker) + 2, '');
+	$self->_check_errors($text);
+	return map { /^stats\t(\S+)\t(.*)$/? ($1 => $2) : () } split /\n/, $text;
+}
+
+sub terminate {
+	my $self= shift;
+	$self->send('terminate', 0);
+	my $t0= time;
+	sleep .01 until waitpid($self->{pid}, POSIX::WNOHANG()) || time - $t0 > 10;
+	unlink $self->{sock_path};
+	delete $self->{pid};
+}
+
+# If a benchmark died, don't leave daemonproxy running
+sub DESTROY {
+	my $self= shift;
+	if ($self->{pid}) {
+		kill KILL => $self->{pid};
+		waitpid($self->{pid}, 0);
+	}
+}
@@ -0,0 +1 @@
+../scripts/../src/Contained_RBTree.c
\ No newline at end of file
@@ -0,0 +1,163 @@
+/* config.h.  Generated from config.h.in by configure.  */
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <sched.h>
+#include <assert.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#define HAVE_SYS_SYSCALL_H 1
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
+#define HAVE_SYS_EPOLL_H 1
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#define HAVE_SYS_PRCTL_H 1
+#ifdef HAVE_SYS_PRCTL_H
+#include <sys/prctl.h>
+#endif
+
+#define HAVE_SYS_SIGNALFD_H 1
+#ifdef HAVE_SYS_SIGNALFD_H
+#include <sys/signalfd.h>
+#endif
+
+// from AC_FUNC_FORK; services are started with vfork() when it works
+#define HAVE_WORKING_VFORK 1
+
+// Maximum length for service or fd names (plus NUL)
+#define NAME_BUF_SIZE                32
+
+// Sensible min/max for allocating a service pool
+#define SERVICE_POOL_SIZE_MIN         1
+#define SERVICE_POOL_SIZE_MAX     65535
+#define SERVICE_DATA_SIZE_MIN        64
+#define SERVICE_DATA_SIZE_DEFAULT   512
+
+// Number of recent runs each service remembers for service.history, and the
+// default service.flap_limit: this many failures within this long
+#define SERVICE_HISTORY_SIZE          8
+#define SERVICE_FLAP_COUNT_DEFAULT    5
+#define SERVICE_FLAP_WINDOW_DEFAULT  (60LL << 32)
+
+// Limit for --spawn-rate (forks per second)
+#define SPAWN_RATE_MAX           100000
+
+// Sensible min/max for allocating fd pool
+#define FD_POOL_SIZE_MIN              8
+#define FD_POOL_SIZE_MAX     FD_SETSIZE
+#define FD_DATA_SIZE_MIN             32
+#define FD_DATA_SIZE_MAX       PATH_MAX
+#define FD_DATA_SIZE_DEFAULT         96
+
+#define SERVICE_RESTART_INTERVAL  (   5LL << 32)
+#define FORK_RETRY_DELAY          (   3LL << 32)
+#define SERVICE_STOP_TIMEOUT      (  10LL << 32)
+#define CONTROLLER_WRITE_TIMEOUT  (  30LL << 32)
+#define LOG_RETRY_DELAY           (   1LL << 31)
+#define LOG_WRITE_TIMEOUT         (   1LL << 28)
+
+// RECV buf should be as large as the longest sensible command.
+// This is the initial size; it grows as needed for longer commands.
+#define CONTROLLER_RECV_BUF_SIZE   1024
+
+// LARGEST_WRITE should be the largest amount of data that could
+// be generated by a single controller state.
+// Otherwise, that state will trigger an overflow condition
+// and the controller script will have to re-sync its state.
+#define CONTROLLER_LARGEST_WRITE   1024
+
+// SEND buf should be LARGEST_WRITE plus some extra for async
+// events and to provide some buffering.  Setting it equal to
+// LARGEST_WRITE will cause a flush after each line written.
+// This is the initial size; it grows while the controller isn't reading.
+#define CONTROLLER_SEND_BUF_SIZE   2048
+
+// Default limits for growing each controller's buffers
+// (--controller-recv-max, --controller-send-max, conn.buffer),
+// and the largest limit that can be set.
+#define CONTROLLER_RECV_BUF_MAX_DEFAULT  ( 4*1024)
+#define CONTROLLER_SEND_BUF_MAX_DEFAULT  (16*1024)
+#define CONTROLLER_BUF_MAX_LIMIT         (16*1024*1024)
+
+// Sensible min/max for allocating a controller pool (--controller-pool).
+// Minimum of 2 allows a config file and controller script to
+// be processed simultaneously, and later a controller script
+// and signal handler script to run simultaneously.
+// Without a pool, controllers are allocated as needed.
+#define CONTROLLER_POOL_SIZE_MIN      2
+#define CONTROLLER_POOL_SIZE_MAX  65535
+
+// The journal keeps recent broadcast events so that a controller which
+// overflowed can resume from where it left off (conn.resume) instead of
+// doing a statedump.  Whichever limit is reached first evicts old events.
+// BUF_SIZE must be larger than CONTROLLER_LARGEST_WRITE.
+#define JOURNAL_BUF_SIZE        (64*1024)
+#define JOURNAL_MAX_EVENTS         1024
+
+// Controllers write events straight out of the journal while they have
+// nothing else buffered.  A controller that falls behind may hold this many
+// bytes of events in the journal before they are copied to its send buf.
+#define CONTROLLER_SEND_RING_MAX  (16*1024)
+
+// Max number of iovecs in one writev() to a controller (<= IOV_MAX)
+#define CONTROLLER_WRITEV_MAX        64
+
+// Space for a controller's event filters (conn.subscribe)
+#define CONTROLLER_SUBSCRIBE_BUF_SIZE 256
+
+// Max state machine iterations per controller in one pass of the main loop
+// (--controller-iterations), and inside a batch.begin/batch.end block.
+// Each command takes about 3 iterations.
+#define CONTROLLER_ITERATIONS_DEFAULT    10
+#define CONTROLLER_ITERATIONS_MAX     65535
+#define CONTROLLER_BATCH_ITERATIONS (64*1024)
+
+// Number of power-of-2 microsecond buckets in each latency histogram (stats).
+// The last bucket counts everything longer.
+#define STATS_HIST_BUCKETS           32
+
+// Number of signalfd records read per read() call
+#define SIGNALFD_READ_BATCH          16
+
+// Initial number of slots in a name hash table (grows as needed)
+#define NAME_HASH_LIMIT_INITIAL      64
+
+// Initial size of the per-fd wake arrays (grows as needed)
+#define WAKE_FD_LIMIT_INITIAL        64
+
+// Max number of events collected from one call to epoll_wait.
+// Any remaining events get reported on the next iteration.
+#define WAKE_EPOLL_MAX_EVENTS        64
+
+// Timers needed besides one per service and controller (log, control socket,
+// spawn rate limit)
+#define WAKE_TIMER_RESERVE_EXTRA      3
+
+#define CONFIG_FILE_DEFAULT_PATH "/etc/daemonproxy.conf"
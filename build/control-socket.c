@@ -0,0 +1 @@
+../scripts/../src/control-socket.c
\ No newline at end of file
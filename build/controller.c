@@ -0,0 +1 @@
+../scripts/../src/controller.c
\ No newline at end of file
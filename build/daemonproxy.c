@@ -0,0 +1 @@
+../scripts/../src/daemonproxy.c
\ No newline at end of file
@@ -0,0 +1 @@
+../scripts/../src/fd.c
\ No newline at end of file
@@ -0,0 +1 @@
+../scripts/../src/journal.c
\ No newline at end of file
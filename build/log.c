@@ -0,0 +1 @@
+../scripts/../src/log.c
\ No newline at end of file
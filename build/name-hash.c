@@ -0,0 +1 @@
+../scripts/../src/name-hash.c
\ No newline at end of file
@@ -0,0 +1 @@
+../scripts/../src/options.c
\ No newline at end of file
@@ -0,0 +1 @@
+../scripts/../src/service.c
\ No newline at end of file
@@ -0,0 +1 @@
+../scripts/../src/signal.c
\ No newline at end of file
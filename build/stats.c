@@ -0,0 +1 @@
+../scripts/../src/stats.c
\ No newline at end of file
@@ -0,0 +1 @@
+../scripts/../src/strseg.c
\ No newline at end of file
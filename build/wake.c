@@ -0,0 +1 @@
+../scripts/../src/wake.c
\ No newline at end of file
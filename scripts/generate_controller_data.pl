@@ -2,8 +2,8 @@
 
 =head1 DESCRIPTION
 
-Generates tables of commands and states for controller module, by
-parsing C source.
+Generates tables of commands, states, and binary protocol opcodes for
+controller module, by parsing C source.
 
 =head1 COPYRIGHT
 
@@ -18,6 +18,8 @@ use warnings;
 
 my @states;
 my %commands;
+my @opcodes;
+my $in_opcodes;
 
 while (<STDIN>) {
 	# Look for STATE macros
@@ -26,7 +28,19 @@ while (<STDIN>) {
 	# Look for COMMAND(fn, "name")
 	$commands{$2}= $1
 		if ($_ =~ m|^\s*COMMAND\s*\(\s*(\S+)\s*,\s*"(\S+)"\s*\)|);
+	# Collect "NUMBER name" pairs from the opcode list in the documentation
+	$in_opcodes= 1 if /^Opcodes are:/;
+	$in_opcodes= 0 if /^=cut/;
+	if ($in_opcodes) {
+		while (/\b(\d+) (\S+)/g) {
+			die "Opcode $1 ($2) is listed twice\n" if defined $opcodes[$1];
+			$opcodes[$1]= $2;
+		}
+	}
 }
+die "Missing opcode list\n" unless @opcodes;
+defined $opcodes[$_] or die "Opcode $_ is missing from the list\n"
+	for 1..$#opcodes;
 
 # table size is 1.5 x number of entries rounded up to power of 2.
 my $mask= int(1.75 * keys %commands);
@@ -62,12 +76,15 @@ sub build_table {
 }
 
 sub find_collisionless_hash_params {
-	# pick factors for the hash function until each command has a unique bucket
-	for (my $mul= 1; $mul < $table_size*$table_size; $mul++) {
-		for (my $shift= 0; $shift < 11; $shift++) {
-			my $table= build_table($mul, $shift);
-			return ( $table, $mul, $shift )
-				if $table;
+	# pick factors for the hash function until each command has a unique bucket.
+	# If no factors work for this table size, try again with a larger table.
+	for (; $table_size <= 4096; $table_size <<= 1, $mask= $table_size-1) {
+		for (my $mul= 1; $mul < $table_size*$table_size; $mul++) {
+			for (my $shift= 0; $shift < 11; $shift++) {
+				my $table= build_table($mul, $shift);
+				return ( $table, $mul, $shift )
+					if $table;
+			}
 		}
 	}
 	die "No value of \$shift / \$mul results in unique codes for each command\n";
@@ -79,6 +96,10 @@ my $state_cases= join("\n", map {
 	qq|	if (fn == $_) return "$_";|
 	} @states );
 my $n_cmd= keys %commands;
+my $n_opcodes= $#opcodes;
+my $opcode_items= join("\n", map {
+	qq|	{ "$opcodes[$_]", |.length($opcodes[$_]).qq| },|
+	} 1..$#opcodes );
 my $table_items= join("\n", map {
 	defined $_? qq|	{ { "$_", |.length($_).qq|}, $commands{$_} },| : qq|	{ { NULL, 0 }, NULL },|
 	} @$table );
@@ -107,4 +128,11 @@ const ctl_command_table_entry_t ctl_command_table[]= {
 $table_items
 	{ {NULL, 0}, NULL}
 };
+
+// $n_opcodes opcodes, from the list in BINARY PROTOCOL
+
+const strseg_t ctl_opcode_names[]= {
+	{ NULL, 0 },
+$opcode_items
+};
 END
@@ -8,8 +8,10 @@
 
 int control_socket= -1;
 struct sockaddr_un control_socket_addr;
+wake_timer_t control_socket_retry_timer;
 
 void control_socket_init() {
+	wake_timer_init(&control_socket_retry_timer, NULL, NULL);
 	memset(&control_socket_addr, 0, sizeof(control_socket_addr));
 	control_socket_addr.sun_family= AF_UNIX;
 }
@@ -21,11 +23,12 @@ void control_socket_run() {
 	if (control_socket >= 0) {
 		if (woke_on_readable(control_socket)) {
 			log_debug("control_socket is ready for accept()");
+			// Without --controller-pool, this only fails if out of memory
 			ctl= ctl_alloc();
 			if (!ctl) {
-				log_warn("No free controllers to accpet socket connection");
-				if (wake->now + (5LL << 32) < wake->next)
-					wake->next= wake->now + (5LL << 32);
+				log_warn("No free controllers to accept socket connection");
+				if (!wake_timer_pending(&control_socket_retry_timer))
+					wake_timer_set(&control_socket_retry_timer, wake->now + (5LL << 32));
 				return;
 			}
 			client= accept(control_socket, NULL, NULL);
@@ -33,13 +36,15 @@ void control_socket_run() {
 				log_debug("accept: %s", strerror(errno));
 				ctl_free(ctl);
 			}
-			if (!ctl_ctor(ctl, client, client)) {
+			else if (!ctl_ctor(ctl, client, client)) {
 				ctl_dtor(ctl);
 				ctl_free(ctl);
 				close(client);
 			}
 		}
-		wake_on_readable(control_socket);
+		// If out of controllers, leave the connection pending until the retry timer
+		if (!wake_timer_pending(&control_socket_retry_timer))
+			wake_on_readable(control_socket);
 	}
 }
 
@@ -13,6 +13,9 @@ typedef bool ctl_state_fn_t(struct controller_s *);
 // following message while we look for the end of the first message.
 #define CONTROLLER_RECV_MAX_ANCILLARY_FD 2
 
+// Length, opcode, and field count of a binary record (conn.protocol)
+#define CONTROLLER_RECORD_HEADER_SIZE 8
+
 struct controller_s {
 	ctl_state_fn_t *state_fn;
 	int id;
@@ -20,19 +23,35 @@ struct controller_s {
 	int  recv_fd;
 	bool recv_is_socket;
 	bool append_final_newline;
-	char recv_buf[CONTROLLER_RECV_BUF_SIZE];
+	char *recv_buf;
+	int  recv_buf_size;        // allocated size of recv_buf
+	int  recv_buf_max;         // limit for growing recv_buf
 	int  recv_buf_pos;
 	bool recv_overflow;
 	int  recv_ancillary_fd[CONTROLLER_RECV_MAX_ANCILLARY_FD];
 	int  recv_ancillary_fd_count;
+	int  recv_skip;            // bytes of an oversized binary record still to discard
+	bool protocol_binary;      // commands and events are binary records (conn.protocol)
 	
 	int  send_fd;
-	char send_buf[CONTROLLER_SEND_BUF_SIZE];
+	char *send_buf;
+	int  send_buf_size;        // allocated size of send_buf
+	int  send_buf_max;         // limit for growing send_buf
+	int  send_buf_start;       // unwritten data in send_buf is [start, pos)
 	int  send_buf_pos;
 	bool send_overflow;
+	int64_t send_seq;          // sequence number of last journal event queued to send_buf
+	bool send_replaying;       // catching up from the journal; skip live broadcasts
+	bool send_overflow_seq;    // client uses conn.resume, so overflow reports send_seq
+	int64_t send_ring_next;    // journal events [next, end] are written before send_buf
+	int64_t send_ring_end;     //  (none, if next > end)
+	int  send_ring_ofs;        // bytes of send_ring_next already written
+	int  send_ring_bytes;      // bytes of journal events not yet written
+	char subscribe_buf[CONTROLLER_SUBSCRIBE_BUF_SIZE]; // NUL-separated event filters, or ""
 	int64_t write_timeout_reset;
 	int64_t write_timeout_close;
 	int64_t send_blocked_ts;
+	wake_timer_t write_timer;  // wakes main loop to check write timeouts
 	int64_t last_signal_ts;
 	
 	int      line_len;         // length of current command in recv_buf
@@ -44,9 +63,33 @@ struct controller_s {
 	int     command_substate;  // generic state machine variable for long-running commands
 	char    statedump_current[NAME_BUF_SIZE]; // state for the statedump command
 	int64_t statedump_ts;      // state for the statedump command
+
+	bool    batch_active;      // between batch.begin and batch.end
+	int     batch_errors;      // number of commands in the batch which failed
+	char    batch_id[64];      // ID given to batch.begin
+	char    batch_error[128];  // first error message in the batch
+
+	int64_t stat_commands;     // totals for this connection (stats command)
+	int64_t stat_bytes_in;
+	int64_t stat_bytes_out;
+	int64_t stat_events;
+	int64_t stat_overflows;
 };
 
-controller_t client[CONTROLLER_MAX_CLIENTS];
+// Controller list - every controller allocated so far, whether in use or not.
+// A free controller has a NULL state_fn, and gets re-used by ctl_alloc.
+controller_t
+	**ctl_list= NULL;
+int
+	ctl_list_count= 0,
+	ctl_list_limit= 0,
+	ctl_next_id= 0;
+
+// Controller pool is an optional feature where all controllers are allocated
+// from a single chunk of memory, and the list can't grow.
+controller_t *ctl_pool= NULL;
+
+static bool ctl_list_resize(int new_limit);
 
 // Each of the following functions returns true/false of whether to continue
 //  processing (true), or yield until later (false).
@@ -60,6 +103,9 @@ STATE(ctl_state_free);
 STATE(ctl_state_dump_fds);
 STATE(ctl_state_dump_services);
 STATE(ctl_state_dump_signals);
+STATE(ctl_state_dump_stats);
+STATE(ctl_state_dump_history);
+STATE(ctl_state_replay);
 
 // Each of the command functions returns true on success,
 // or sets ctl->command_error to an error message and returns false.
@@ -69,11 +115,22 @@ STATE(ctl_state_dump_signals);
 #define COMMAND(name, ...) static bool name(controller_t *ctl)
 COMMAND(ctl_cmd_echo,                "echo");
 COMMAND(ctl_cmd_statedump,           "statedump");
+COMMAND(ctl_cmd_stats,               "stats");
 COMMAND(ctl_cmd_svc_tags,            "service.tags");
 COMMAND(ctl_cmd_svc_args,            "service.args");
 COMMAND(ctl_cmd_svc_fds,             "service.fds");
 COMMAND(ctl_cmd_svc_auto_up,         "service.auto_up");
+COMMAND(ctl_cmd_svc_backoff,         "service.backoff");
+COMMAND(ctl_cmd_svc_priority,        "service.priority");
+COMMAND(ctl_cmd_svc_limits,          "service.limits");
+COMMAND(ctl_cmd_svc_flap_limit,      "service.flap_limit");
+COMMAND(ctl_cmd_svc_history,         "service.history");
+COMMAND(ctl_cmd_svc_requires,        "service.requires");
+COMMAND(ctl_cmd_svc_after,           "service.after");
+COMMAND(ctl_cmd_svc_ready_timeout,   "service.ready_timeout");
 COMMAND(ctl_cmd_svc_start,           "service.start");
+COMMAND(ctl_cmd_svc_stop,            "service.stop");
+COMMAND(ctl_cmd_svc_stop_all,        "service.stop_all");
 COMMAND(ctl_cmd_svc_signal,          "service.signal");
 COMMAND(ctl_cmd_svc_delete,          "service.delete");
 COMMAND(ctl_cmd_socket_create,       "socket.create");
@@ -88,15 +145,41 @@ COMMAND(ctl_cmd_exit,                "exit");
 COMMAND(ctl_cmd_log_filter,          "log.filter");
 COMMAND(ctl_cmd_log_dest,            "log.dest");
 COMMAND(ctl_cmd_event_pipe_timeout,  "conn.event_timeout");
+COMMAND(ctl_cmd_conn_resume,         "conn.resume");
+COMMAND(ctl_cmd_conn_subscribe,      "conn.subscribe");
+COMMAND(ctl_cmd_conn_buffer,         "conn.buffer");
+COMMAND(ctl_cmd_conn_protocol,       "conn.protocol");
+COMMAND(ctl_cmd_batch_begin,         "batch.begin");
+COMMAND(ctl_cmd_batch_end,           "batch.end");
 COMMAND(ctl_cmd_signal_clear,        "signal.clear");
 COMMAND(ctl_cmd_terminate_exec_args, "terminate.exec_args");
 COMMAND(ctl_cmd_terminate_guard,     "terminate.guard");
 COMMAND(ctl_cmd_terminate,           "terminate");
 
 static bool ctl_read_more(controller_t *ctl);
+static bool ctl_buf_grow(controller_t *ctl, char **buf, int *size, int max, int need);
+static bool ctl_recv_buf_grow(controller_t *ctl);
 static bool ctl_flush_outbuf(controller_t *ctl);
 static bool ctl_out_buf_ready(controller_t *ctl);
+static void ctl_send_ring_release(controller_t *ctl);
+static bool ctl_send_ring_copy(controller_t *ctl, int64_t last);
+static bool ctl_queue_event(controller_t *ctl, int64_t seq, strseg_t msg);
+
+// True if there is anything waiting to be written to send_fd
+static inline bool ctl_send_pending(controller_t *ctl) {
+	return ctl->send_ring_next <= ctl->send_ring_end || ctl->send_buf_pos > ctl->send_buf_start;
+}
 static void ctl_read_ancillary_fds(controller_t *ctl, struct msghdr *msg);
+static bool ctl_subscribed(controller_t *ctl, strseg_t event, strseg_t name);
+static void ctl_event_split(strseg_t msg, strseg_t *event_out, strseg_t *name_out);
+static bool ctl_batch_error(controller_t *ctl, const char *fmt, ...);
+static bool ctl_next_record(controller_t *ctl);
+static const char * ctl_record_decode(controller_t *ctl, strseg_t *line_out);
+static bool ctl_write_record(controller_t *ctl, strseg_t msg);
+
+// Report a failed command, or inside a batch, record it for the summary
+#define ctl_command_failed(ctl, msg, ...) ((ctl)->batch_active? \
+	ctl_batch_error(ctl, msg, ##__VA_ARGS__) : ctl_notify_error(ctl, msg, ##__VA_ARGS__))
 
 //
 // These "get_arg" functions are convenience for the command implementations,
@@ -124,6 +207,8 @@ static bool ctl_get_arg_ts(controller_t *ctl, int64_t *ts);
 static bool ctl_get_arg_service(controller_t *ctl, bool existing, strseg_t *name_out, service_t **svc_out);
 static bool ctl_get_arg_fd(controller_t *ctl, bool existing, bool assignable, strseg_t *name_out, fd_t **fd_out);
 static bool ctl_get_arg_signal(controller_t *ctl, int *sig_out);
+static bool ctl_set_svc_deps(controller_t *ctl, bool requires);
+static bool ctl_get_arg_stop_timeout(controller_t *ctl, int64_t *timeout_out);
 
 //
 // Here we define a static hash table of commands, and methods to access them.
@@ -141,6 +226,28 @@ const ctl_command_table_entry_t * ctl_find_command(strseg_t name) {
 	return result->fn && 0 == strseg_cmp(name, result->command)? result : NULL;
 }
 
+// ctl_opcode_names (above) holds the names of commands and events, indexed by
+// their opcode in binary records.  Opcode 0 means the name is the first field
+// of the record.  The table is generated from the list in the documentation
+// (BINARY PROTOCOL); those numbers are part of the protocol, so only ever add
+// to the end of it.
+#define CTL_OPCODE_COUNT (sizeof(ctl_opcode_names)/sizeof(*ctl_opcode_names))
+
+// Return the opcode for a command or event name, or 0 if it doesn't have one
+static int ctl_opcode_by_name(strseg_t name) {
+	int i;
+	for (i= 1; i < CTL_OPCODE_COUNT; i++)
+		if (name.len == ctl_opcode_names[i].len && 0 == memcmp(name.data, ctl_opcode_names[i].data, name.len))
+			return i;
+	return 0;
+}
+
+// Scratch buffers for converting between binary records and text, shared by
+// all controllers.  line_buf holds the current command while it runs, and
+// fmt_buf holds one event while it is encoded.
+static char *ctl_line_buf= NULL, *ctl_fmt_buf= NULL;
+static int ctl_line_buf_size= 0, ctl_fmt_buf_size= 0;
+
 
 // A controller can be set to be less strict, and not require a newline
 // right before EOF
@@ -150,16 +257,53 @@ void ctl_set_auto_final_newline(controller_t *ctl, bool enable) {
 
 /* Initialize controller subsystem
  *
- * We allocate controller clients out of a small static pool.  In most cases
- * there will only be one client.  (daemonproxy does not do much synchronization
- * between clients; this is the duty of the main controller script, which should
- * be the only client.)
+ * Controllers are allocated as clients connect, and kept for re-use after
+ * they disconnect.  (daemonproxy does not do much synchronization between
+ * clients; this is the duty of the main controller script.)
  */
 void ctl_init() {
+	ctl_list_count= 0;
+	ctl_next_id= 0;
+}
+
+/* Allocate a fixed pool of controllers, and never allocate more.
+ */
+bool ctl_preallocate(int count) {
 	int i;
-	assert(CONTROLLER_MAX_CLIENTS >= 2);
-	for (i= 0; i < CONTROLLER_MAX_CLIENTS; i++)
-		client[i].state_fn= NULL;
+	assert(ctl_list_count == 0);
+	assert(ctl_pool == NULL);
+	
+	if (!ctl_list_resize(count))
+		return false;
+	
+	if (!(ctl_pool= (controller_t*) malloc(count * sizeof(controller_t))))
+		return false;
+	// every controller might have a write timeout pending
+	if (!wake_timer_reserve(count))
+		return false;
+	// Buffers are allocated at their max size, and never grow
+	for (i= 0; i < count; i++) {
+		ctl_pool[i].state_fn= NULL;
+		ctl_pool[i].recv_buf_size= opt_ctl_recv_buf_max;
+		ctl_pool[i].send_buf_size= opt_ctl_send_buf_max;
+		if (!(ctl_pool[i].recv_buf= (char*) malloc(opt_ctl_recv_buf_max))
+			|| !(ctl_pool[i].send_buf= (char*) malloc(opt_ctl_send_buf_max)))
+			return false;
+		ctl_list[i]= &ctl_pool[i];
+	}
+	ctl_list_count= count;
+	return true;
+}
+
+bool ctl_list_resize(int new_limit) {
+	controller_t **new_list;
+	
+	new_list= realloc(ctl_list, new_limit * sizeof(controller_t*));
+	if (!new_list)
+		return false;
+	ctl_list= new_list;
+	ctl_list_limit= new_limit;
+	return true;
 }
 
 /* Allocate/construct next controller and bind it to an input and output handle.
@@ -175,29 +319,66 @@ controller_t *ctl_new(int recv_fd, int send_fd) {
 	return NULL;
 }
 
-/* Allocate the next unused controller from the static pool.
+/* Allocate the next unused controller, adding one to the list if needed.
  *
- * Returns false if there are no free objects in the pool.
+ * Returns NULL if out of memory, or if all objects in the pool are in use.
  */
 controller_t *ctl_alloc() {
-	int i;
+	controller_t *ctl= NULL;
+	char *recv_buf, *send_buf;
+	int i, recv_buf_size, send_buf_size;
 
-	for (i= 0; i < CONTROLLER_MAX_CLIENTS; i++)
-		if (!client[i].state_fn) {
-			// non-null state marks it as allocated
-			memset(&client[i], 0, sizeof(controller_t));
-			client[i].state_fn= &ctl_state_free;
-			client[i].id= i;
-			return &client[i];
+	for (i= 0; i < ctl_list_count; i++)
+		if (!ctl_list[i]->state_fn) {
+			ctl= ctl_list[i];
+			break;
 		}
-	return NULL;
+	// enlarge the list if needed (and not using a pool)
+	if (!ctl) {
+		if (ctl_pool)
+			return NULL;
+		if (ctl_list_count >= ctl_list_limit)
+			if (!ctl_list_resize(ctl_list_limit + 16))
+				return NULL;
+		if (!(ctl= (controller_t*) malloc(sizeof(controller_t))))
+			return NULL;
+		ctl->recv_buf_size= CONTROLLER_RECV_BUF_SIZE;
+		ctl->send_buf_size= CONTROLLER_SEND_BUF_SIZE;
+		if (!(ctl->recv_buf= (char*) malloc(ctl->recv_buf_size))
+			|| !(ctl->send_buf= (char*) malloc(ctl->send_buf_size))) {
+			free(ctl->recv_buf);
+			free(ctl);
+			return NULL;
+		}
+		ctl_list[ctl_list_count++]= ctl;
+	}
+	// Buffers are kept when the controller is re-used
+	recv_buf= ctl->recv_buf;
+	recv_buf_size= ctl->recv_buf_size;
+	send_buf= ctl->send_buf;
+	send_buf_size= ctl->send_buf_size;
+	// non-null state marks it as allocated
+	memset(ctl, 0, sizeof(controller_t));
+	ctl->recv_buf= recv_buf;
+	ctl->recv_buf_size= recv_buf_size;
+	ctl->recv_buf_max= ctl_pool? recv_buf_size : opt_ctl_recv_buf_max;
+	ctl->send_buf= send_buf;
+	ctl->send_buf_size= send_buf_size;
+	ctl->send_buf_max= ctl_pool? send_buf_size : opt_ctl_send_buf_max;
+	ctl->state_fn= &ctl_state_free;
+	ctl->id= ctl_next_id++;
+	ctl->recv_fd= -1;
+	ctl->send_fd= -1;
+	ctl->send_ring_next= 1; // empty
+	wake_timer_init(&ctl->write_timer, NULL, ctl);
+	return ctl;
 }
 
 /* Constructor (not including alloc)
  *
  * Initialize and bind a controller object to a pair of in/out handles.
- * The object should be freshly wiped by ctl_alloc, with only the id and
- * state_fn assigned.
+ * The object should be freshly wiped by ctl_alloc, with only the id,
+ * state_fn, write_timer, buffers, and (invalid) handles assigned.
  */
 bool ctl_ctor(controller_t *ctl, int recv_fd, int send_fd) {
 	bool is_socket= false;
@@ -222,6 +403,7 @@ bool ctl_ctor(controller_t *ctl, int recv_fd, int send_fd) {
 	ctl->recv_fd= recv_fd;
 	ctl->recv_is_socket= is_socket;
 	ctl->send_fd= send_fd;
+	ctl->send_seq= journal_get_next_seq() - 1; // new controllers start out current
 	ctl->write_timeout_reset= CONTROLLER_WRITE_TIMEOUT>>1;
 	ctl->write_timeout_close= CONTROLLER_WRITE_TIMEOUT;
 	return true;
@@ -233,19 +415,39 @@ bool ctl_ctor(controller_t *ctl, int recv_fd, int send_fd) {
  */
 void ctl_dtor(controller_t *ctl) {
 	log_debug("destroying client %d", ctl->id);
-	if (ctl->recv_fd >= 0)
+	wake_timer_cancel(&ctl->write_timer);
+	if (ctl->recv_fd >= 0) {
+		wake_cancel_fd(ctl->recv_fd);
 		close(ctl->recv_fd);
-	if (ctl->send_fd >= 0 && ctl->send_fd != ctl->recv_fd)
+	}
+	if (ctl->send_fd >= 0 && ctl->send_fd != ctl->recv_fd) {
+		wake_cancel_fd(ctl->send_fd);
 		close(ctl->send_fd);
+	}
+	ctl_send_ring_release(ctl);
+	if (ctl->batch_active)
+		log_warn("controller[%d] closed without ending batch %s", ctl->id, ctl->batch_id);
 	int i;
 	for (i= 0; i < ctl->recv_ancillary_fd_count; i++) {
 		log_warn("closing leftover ancillary file descriptor %d", ctl->recv_ancillary_fd[i]);
 		close(ctl->recv_ancillary_fd[i]);
 	}
+	// Give back any memory from growing the buffers, so that the next user
+	// of this controller starts small.  (shrinking realloc can't fail)
+	if (!ctl_pool) {
+		if (ctl->recv_buf_size > CONTROLLER_RECV_BUF_SIZE) {
+			ctl->recv_buf= (char*) realloc(ctl->recv_buf, CONTROLLER_RECV_BUF_SIZE);
+			ctl->recv_buf_size= CONTROLLER_RECV_BUF_SIZE;
+		}
+		if (ctl->send_buf_size > CONTROLLER_SEND_BUF_SIZE) {
+			ctl->send_buf= (char*) realloc(ctl->send_buf, CONTROLLER_SEND_BUF_SIZE);
+			ctl->send_buf_size= CONTROLLER_SEND_BUF_SIZE;
+		}
+	}
 	ctl->state_fn= ctl_state_free;
 }
 
-/* Free a controller object, by returning it to the pool.
+/* Free a controller object, leaving it in the list for re-use.
  */
 void ctl_free(controller_t *ctl) {
 	ctl->state_fn= NULL;
@@ -262,8 +464,10 @@ void ctl_run() {
 	ctl_state_fn_t *prev_state;
 	int64_t lateness, next_check_ts;
 	
-	// list is very small, so just iterate all, allocated or not.
-	for (i= 0, ctl= client; i < CONTROLLER_MAX_CLIENTS; ctl= &client[++i]) {
+	// Iterate all, allocated or not.  Index the list each time, because a
+	// state might allocate a controller and grow it.
+	for (i= 0; i < ctl_list_count; i++) {
+		ctl= ctl_list[i];
 		// non-null state means client is allocated
 		if (!ctl->state_fn)
 			continue;
@@ -276,11 +480,18 @@ void ctl_run() {
 		if (ctl->send_fd >= 0 && woke_on_writeable(ctl->send_fd))
 			ctl_flush_outbuf(ctl);
 
-		// Run (max 10) iterations of state machine while state returns true.
-		// The arbitrary limit of 10 helps keep our timestamps and signal
+		// Run (max --controller-iterations) iterations of state machine while
+		// state returns true.  The limit helps keep our timestamps and signal
 		// delivery and reaped procs current.  (also mitigates infinite loops)
+		// A batch runs until it ends or blocks, within a much larger limit.
 		prev_state= NULL;
-		for (j= 10; --j;) {
+		for (j= 0; ; j++) {
+			// If still running at the limit, set wake to 'now', causing another
+			// iteration in the main loop.
+			if (j >= (ctl->batch_active? CONTROLLER_BATCH_ITERATIONS : opt_ctl_iterations)) {
+				wake->next= wake->now;
+				break;
+			}
 			if (ctl->state_fn != prev_state) {
 				log_trace("ctl state = %s", ctl_get_state_name(ctl->state_fn));
 				prev_state= ctl->state_fn;
@@ -289,30 +500,27 @@ void ctl_run() {
 				break;
 		}
 		// Note: it is possible for ctl to have been destroyed (null state_fn), here.
-		
-		// If final iteration is still true, set wake to 'now', causing another
-		// iteration in the main loop.
-		if (!j) wake->next= wake->now;
 	}
 	
 	// Now that all processing is complete for this iteration, flush all output
 	// buffers.  This is a separate loop because sometimes controllers generate
 	// output to another controller.
-	for (i= 0, ctl= client; i < CONTROLLER_MAX_CLIENTS; ctl= &client[++i]) {
+	for (i= 0; i < ctl_list_count; i++) {
+		ctl= ctl_list[i];
 		// non-null state means client is allocated
 		if (!ctl->state_fn)
 			continue;
 		
 		// If anything was left un-written, wake on writable pipe
 		// Also, set/check timeout for writes
-		if (ctl->send_fd >= 0 && ctl->send_buf_pos > 0) {
+		if (ctl->send_fd >= 0 && ctl_send_pending(ctl)) {
 			if (!ctl_flush_outbuf(ctl) && ctl->send_fd >= 0) {
 				lateness= wake->now - ctl->send_blocked_ts;
 				
 				// If the controller script doesn't read its events before timeout,
 				// close the connection.
 				if (lateness >= ctl->write_timeout_close) {
-					log_error("controller %d blocked pipe for %d seconds, closing connection", i, (int)(lateness>>32));
+					log_error("controller %d blocked pipe for %d seconds, closing connection", ctl->id, (int)(lateness>>32));
 					ctl_dtor(ctl); // destroy client
 					ctl_free(ctl);
 					continue;      // next client
@@ -324,8 +532,8 @@ void ctl_run() {
 				// input buffer.  The controller script will have to re-sync state if it
 				// finally wakes up.
 				if (lateness >= ctl->write_timeout_reset) {
-					log_warn("controller %d blocked pipe for %d seconds", i, (int)(lateness>>32));
-					if (ctl->recv_buf_pos >= CONTROLLER_RECV_BUF_SIZE) {
+					log_warn("controller %d blocked pipe for %d seconds", ctl->id, (int)(lateness>>32));
+					if (ctl->recv_buf_pos >= ctl->recv_buf_size) {
 						ctl->send_overflow= true;
 						wake->next= wake->now;
 					}
@@ -335,9 +543,9 @@ void ctl_run() {
 					next_check_ts= ctl->send_blocked_ts + ctl->write_timeout_reset;
 				}
 				
-				if (wake->next - next_check_ts > 0) {
+				if (!wake_timer_pending(&ctl->write_timer) || ctl->write_timer.when != next_check_ts) {
 					log_trace("wake in %d ms to check timeout", (next_check_ts - wake->now) * 1000 >> 32 );
-					wake->next= next_check_ts;
+					wake_timer_set(&ctl->write_timer, next_check_ts);
 				}
 				log_trace("wake on controller[%d] send_fd", i);
 				wake_on_writeable(ctl->send_fd);
@@ -349,7 +557,7 @@ void ctl_run() {
 		}
 		// If incoming fd, wake on data available, unless input buffer full
 		// (this could also be the config file, initially)
-		if (ctl->recv_fd >= 0 && ctl->recv_buf_pos < CONTROLLER_RECV_BUF_SIZE) {
+		if (ctl->recv_fd >= 0 && ctl->recv_buf_pos < ctl->recv_buf_size) {
 			log_trace("wake on controller[%d] recv_fd", i);
 			wake_on_readable(ctl->recv_fd);
 		}
@@ -370,7 +578,8 @@ bool ctl_deliver_signals(controller_t *ctl) {
 		if (!ctl_out_buf_ready(ctl))
 			return false;
 		// deliver next signal that this controller hasn't seen
-		ctl_notify_signal(ctl, signum, sig_ts, sig_count);
+		if (ctl_subscribed(ctl, STRSEG_LITERAL("signal"), STRSEG(sig_name_by_num(signum)? sig_name_by_num(signum) : "")))
+			ctl_notify_signal(ctl, signum, sig_ts, sig_count);
 		ctl->last_signal_ts= sig_ts;
 	}
 	return true;
@@ -387,17 +596,24 @@ bool ctl_state_next_command(controller_t *ctl) {
 	if (!ctl_deliver_signals(ctl))
 		return false; // false means the output buffer is blocked
 
+	if (ctl->protocol_binary)
+		return ctl_next_record(ctl);
+
 	// see if we have a full line in the input.  else read some more.
 	eol= (char*) memchr(ctl->recv_buf, '\n', ctl->recv_buf_pos);
 	if (!eol && ctl->recv_fd >= 0) {
-		// if buffer is full, then command is too big, and we ignore the rest of the line
-		if (ctl->recv_buf_pos >= CONTROLLER_RECV_BUF_SIZE) {
+		// if buffer is full, grow it.  If it can't grow, then command is too
+		// big, and we ignore the rest of the line
+		if (ctl->recv_buf_pos >= ctl->recv_buf_size && !ctl_recv_buf_grow(ctl)) {
 			// In case its a comment, preserve comment character (long comments are not an error)
 			ctl->recv_overflow= true;
 			ctl->recv_buf_pos= 1;
-			log_debug("controller[%d] command length exceeds %d bytes, discarding", ctl->id, CONTROLLER_RECV_BUF_SIZE);
+			log_debug("controller[%d] command length exceeds %d bytes, discarding", ctl->id, ctl->recv_buf_size);
 			return true;
 		}
+		// In a batch, read the rest of it now rather than on the next pass
+		if (ctl->batch_active && (ctl_read_more(ctl) || ctl->recv_fd < 0))
+			return true;
 		log_trace("no command ready");
 		// done for now, until more data available on pipe
 		return false;
@@ -434,6 +650,122 @@ bool ctl_state_next_command(controller_t *ctl) {
 	return true;
 }
 
+/** Find the next binary record in the input buffer, if any.
+ *
+ * This is ctl_state_next_command for conn.protocol binary.  The record is
+ * decoded later, by ctl_state_run_command.  Records too large for the buffer
+ * are discarded and flagged as an error, like long lines.
+ */
+static bool ctl_next_record(controller_t *ctl) {
+	uint32_t len;
+	int n;
+
+	// discard the rest of an oversized record
+	if (ctl->recv_skip) {
+		n= ctl->recv_skip < ctl->recv_buf_pos? ctl->recv_skip : ctl->recv_buf_pos;
+		ctl->recv_buf_pos -= n;
+		memmove(ctl->recv_buf, ctl->recv_buf + n, ctl->recv_buf_pos);
+		ctl->recv_skip -= n;
+	}
+	if (ctl->recv_buf_pos >= CONTROLLER_RECORD_HEADER_SIZE) {
+		memcpy(&len, ctl->recv_buf, sizeof(len));
+		len= ntohl(len);
+		// A bad length means we can't find the next record, so give up
+		if (len < CONTROLLER_RECORD_HEADER_SIZE) {
+			log_error("controller[%d] sent invalid record length %u, closing connection", ctl->id, len);
+			ctl_notify_error(ctl, "invalid record length");
+			ctl->recv_buf_pos= 0;
+			if (ctl->recv_fd >= 0 && ctl->recv_fd != ctl->send_fd) {
+				wake_cancel_fd(ctl->recv_fd);
+				close(ctl->recv_fd);
+			}
+			ctl->recv_fd= -1;
+			ctl->state_fn= ctl_state_close;
+			return true;
+		}
+		if (len <= ctl->recv_buf_pos) {
+			ctl->line_len= len;
+			ctl->state_fn= ctl_state_run_command;
+			return true;
+		}
+		if (len > ctl->recv_buf_size
+			&& !ctl_buf_grow(ctl, &ctl->recv_buf, &ctl->recv_buf_size, ctl->recv_buf_max, len)
+		) {
+			log_debug("controller[%d] record length %u exceeds %d bytes, discarding", ctl->id, len, ctl->recv_buf_size);
+			ctl->recv_overflow= true;
+			ctl->recv_skip= len;
+			ctl->line_len= 0;
+			ctl->state_fn= ctl_state_run_command;
+			return true;
+		}
+	}
+	if (ctl->recv_fd >= 0) {
+		// In a batch, read the rest of it now rather than on the next pass
+		if (ctl->batch_active && (ctl_read_more(ctl) || ctl->recv_fd < 0))
+			return true;
+		log_trace("no command ready");
+		return false;
+	}
+	// EOF.  Ignore any partial record.
+	if (ctl->recv_buf_pos) {
+		log_warn("Command ends with EOF... ignored");
+		ctl->recv_buf_pos= 0;
+	}
+	ctl->recv_skip= 0;
+	ctl->state_fn= ctl_state_close;
+	return true;
+}
+
+/** Decode the binary record at the start of recv_buf
+ *
+ * The record becomes the same line of text as the text protocol would
+ * have received, in ctl_line_buf.  Returns an error message if the record is
+ * invalid, else NULL.
+ */
+static const char * ctl_record_decode(controller_t *ctl, strseg_t *line_out) {
+	const unsigned char *p= (unsigned char*) ctl->recv_buf, *end= p + ctl->line_len;
+	uint16_t opcode, field_count, i, len;
+	int pos= 0;
+
+	memcpy(&opcode, p+4, sizeof(opcode));
+	memcpy(&field_count, p+6, sizeof(field_count));
+	opcode= ntohs(opcode);
+	field_count= ntohs(field_count);
+	p += CONTROLLER_RECORD_HEADER_SIZE;
+	if (opcode >= CTL_OPCODE_COUNT)
+		return "unknown opcode";
+	// The text is never longer than the record plus the name
+	if (ctl->line_len + ctl_opcode_names[opcode].len + 1 > ctl_line_buf_size
+		&& !ctl_buf_grow(ctl, &ctl_line_buf, &ctl_line_buf_size, INT_MAX, ctl->line_len + ctl_opcode_names[opcode].len + 1))
+		return "out of memory";
+	if (opcode) {
+		memcpy(ctl_line_buf, ctl_opcode_names[opcode].data, ctl_opcode_names[opcode].len);
+		pos= ctl_opcode_names[opcode].len;
+	}
+	for (i= 0; i < field_count; i++) {
+		if (end - p < 2)
+			return "record ends before its fields";
+		len= (p[0] << 8) | p[1];
+		p += 2;
+		if (end - p < len)
+			return "record ends before its fields";
+		if (memchr(p, '\t', len) || memchr(p, '\n', len) || memchr(p, '\0', len))
+			return "field contains TAB, newline, or NUL";
+		if (opcode || i > 0)
+			ctl_line_buf[pos++]= '\t';
+		memcpy(ctl_line_buf + pos, p, len);
+		pos += len;
+		p += len;
+	}
+	if (p != end)
+		return "record is longer than its fields";
+	ctl_line_buf[pos]= '\0';
+	log_debug("controller[%d] command: \"%s\"", ctl->id, ctl_line_buf);
+	line_out->data= ctl_line_buf;
+	line_out->len= pos;
+	return NULL;
+}
+
 static bool entirely_whitespace(strseg_t str) {
 	int i;
 	for (i= 0; i < str.len; i++) {
@@ -453,6 +785,8 @@ static bool entirely_whitespace(strseg_t str) {
  */
 bool ctl_state_run_command(controller_t *ctl) {
 	const ctl_command_table_entry_t *cmd;
+	const char *err;
+	strseg_t line;
 
 	// Commands often generate output, so stop if output buffer too full.
 	// For a true solution to the problem, we could add states to each place
@@ -469,15 +803,26 @@ bool ctl_state_run_command(controller_t *ctl) {
 	// check for command overflow
 	if (ctl->recv_overflow) {
 		ctl->recv_overflow= false;
-		if (ctl->recv_buf[0] != '#') { // long comments not an error
-			ctl_notify_error(ctl, "line too long");
+		if (ctl->protocol_binary || ctl->recv_buf[0] != '#') { // long comments not an error
+			ctl_command_failed(ctl, "line too long");
 			log_error("controller[%d] command exceeds buffer size", ctl->id);
 		}
 	}
 	else {
+		// Get the text of the command, decoding it if it is a binary record
+		if (!ctl->protocol_binary) {
+			line.data= ctl->recv_buf;
+			line.len= ctl->line_len - 1; // line_len includes terminating NUL
+		}
+		else if ((err= ctl_record_decode(ctl, &line))) {
+			ctl_command_failed(ctl, "%s", err);
+			log_error("controller[%d] sent invalid record: %s", ctl->id, err);
+			return true;
+		}
+		ctl->stat_commands++;
+		stats.ctl_commands++;
 		// ctl->command is the un-parsed portion of our command.
-		ctl->command.data= ctl->recv_buf;
-		ctl->command.len= ctl->line_len - 1; // line_len includes terminating NUL
+		ctl->command= line;
 		ctl->command_error= "unknown error";
 		
 		// We first parse the command name
@@ -488,21 +833,21 @@ bool ctl_state_run_command(controller_t *ctl) {
 			// suppress non-error cases:
 			// 1. ignore lines starting with '#'
 			// 2. ignore lines containing nothing but whitespace
-			if (ctl->recv_buf[0] == '#') {
+			if (line.data[0] == '#') {
 				log_trace("Ignoring comment line");
-			} else if (entirely_whitespace((strseg_t){ ctl->recv_buf, ctl->line_len - 1 })) {
+			} else if (entirely_whitespace(line)) {
 				log_trace("Ignoring blank line");
 			}
 			// else its an error
 			else {
-				ctl_notify_error(ctl, "Unknown command: %.*s", ctl->command_name.len, ctl->command_name.data);
+				ctl_command_failed(ctl, "Unknown command: %.*s", ctl->command_name.len, ctl->command_name.data);
 				log_error("controller[%d] sent unknown command %.*s", ctl->id, ctl->command_name.len, ctl->command_name.data);
 			}
 		}
 		// dispatch it (returns false if it encounters an error, and sets ctl->command_error)
 		else if (!cmd->fn(ctl)) {
-			ctl_notify_error(ctl, "%s, for command \"%.*s%s\"", ctl->command_error, ctl->line_len > 30? 30 : ctl->line_len, ctl->recv_buf, ctl->line_len > 30? "...":"");
-			log_error("controller[%d] command failed: '%.*s'%s", ctl->id, ctl->line_len > 90? 90 : ctl->line_len, ctl->recv_buf, ctl->line_len > 90? "...":"");
+			ctl_command_failed(ctl, "%s, for command \"%.*s%s\"", ctl->command_error, line.len > 30? 30 : line.len, line.data, line.len > 30? "...":"");
+			log_error("controller[%d] command failed: '%.*s'%s", ctl->id, line.len > 90? 90 : line.len, line.data, line.len > 90? "...":"");
 			log_error("  with error: '%s'", ctl->command_error);
 		}
 	}
@@ -609,6 +954,267 @@ bool ctl_cmd_event_pipe_timeout(controller_t *ctl) {
 	return true;
 }
 
+/*
+=item conn.resume [SEQ]
+
+Catch up after an overflow event.  Without SEQ, this only asks for overflow
+events on this connection to carry the sequence number of the last event
+the connection received ("overflow SEQ"), which is needed to resume.  Any
+use of conn.resume turns that on.
+
+Daemonproxy keeps a journal of recent events, and if it still holds every
+event after SEQ it replies "conn.resume replay LAST" and re-sends just those
+events, in order, before any new ones.  If some of them have already been
+discarded, it replies "conn.resume statedump LAST" and performs a statedump
+instead.  LAST is the sequence number of the newest event at that time, and
+can be used in a later conn.resume.
+
+=cut
+*/
+bool ctl_cmd_conn_resume(controller_t *ctl) {
+	int64_t seq;
+
+	ctl->send_overflow_seq= true;
+	if (!ctl->command.len)
+		return true;
+	if (!ctl_get_arg_int(ctl, &seq))
+		return false;
+	if (seq >= journal_get_next_seq() || seq < 0) {
+		ctl->command_error= "invalid sequence number";
+		return false;
+	}
+	if (seq + 1 < journal_get_first_seq()) {
+		log_debug("controller[%d] resume from %lld not in journal; using statedump", ctl->id, (long long) seq);
+		ctl->send_seq= journal_get_next_seq() - 1;
+		ctl_write(ctl, "conn.resume\tstatedump\t%lld\n", (long long) ctl->send_seq);
+		return ctl_cmd_statedump(ctl);
+	}
+	log_debug("controller[%d] replaying %lld events from journal", ctl->id, (long long)(journal_get_next_seq() - seq - 1));
+	ctl_write(ctl, "conn.resume\treplay\t%lld\n", (long long)(journal_get_next_seq() - 1));
+	ctl->send_seq= seq;
+	ctl->send_replaying= true;
+	ctl->state_fn= ctl_state_replay;
+	return true;
+}
+
+/** Copy events from the journal into the send buffer until caught up.
+ *
+ * Live broadcasts skip this controller until then, since they are also in
+ * the journal.  If the events get evicted before we can send them, fall
+ * back to a statedump.
+ */
+bool ctl_state_replay(controller_t *ctl) {
+	strseg_t event, type, name;
+	while (ctl->send_replaying && !ctl->send_overflow && ctl->send_seq + 1 < journal_get_next_seq()) {
+		if (!ctl_out_buf_ready(ctl))
+			return false;
+		if (!journal_get(ctl->send_seq + 1, &event)) {
+			ctl->send_replaying= false;
+			ctl->send_seq= journal_get_next_seq() - 1;
+			ctl_write(ctl, "conn.resume\tstatedump\t%lld\n", (long long) ctl->send_seq);
+			return ctl_cmd_statedump(ctl);
+		}
+		ctl_event_split(event, &type, &name);
+		if (ctl_subscribed(ctl, type, name))
+			ctl_queue_event(ctl, ctl->send_seq + 1, event);
+		if (!ctl->send_overflow)
+			ctl->send_seq++;
+	}
+	ctl->send_replaying= false;
+	ctl->state_fn= ctl_state_end_command;
+	return true;
+}
+
+/*
+=item conn.subscribe [FILTER_1] [FILTER_2] ... [FILTER_N]
+
+Only deliver the events matching these filters to this connection, including
+the events of a statedump.  Replies to commands (like echo and errors) are
+not affected.  With no filters, all events are delivered again.
+
+Each FILTER is one of "event:PATTERN", matched against the event name (like
+"service.state" or "signal"), "service:PATTERN" matched against the name of
+the service, "tag:PATTERN" matched against each of the service's current
+tags, or "fd:PATTERN" matched against the name of the file handle.  PATTERN
+is a shell wildcard pattern.
+
+An event is delivered if it matches any of the event: filters (or there
+are none), and, for service and fd events, if it matches any of the
+service: and tag: filters or fd: filters respectively (or there are none).
+For example, "event:service.state service:web*" delivers only the state
+changes of services whose names begin with "web".
+
+=cut
+*/
+bool ctl_cmd_conn_subscribe(controller_t *ctl) {
+	char buf[CONTROLLER_SUBSCRIBE_BUF_SIZE];
+	strseg_t filter, type, pattern;
+	int pos= 0;
+
+	while (strseg_tok_next(&ctl->command, '\t', &filter)) {
+		if (!filter.len)
+			continue;
+		type= filter;
+		if (!strseg_split_1(&type, ':', &pattern)
+			|| !(strseg_cmp(type, STRSEG_LITERAL("event")) == 0
+				|| strseg_cmp(type, STRSEG_LITERAL("service")) == 0
+				|| strseg_cmp(type, STRSEG_LITERAL("tag")) == 0
+				|| strseg_cmp(type, STRSEG_LITERAL("fd")) == 0)
+		) {
+			ctl->command_error= "filter must begin with event:, service:, tag:, or fd:";
+			return false;
+		}
+		// leave room for this filter's NUL and the final NUL
+		if (pos + filter.len + 2 > sizeof(buf)) {
+			ctl->command_error= "too many filters";
+			return false;
+		}
+		memcpy(buf + pos, filter.data, filter.len);
+		pos += filter.len;
+		buf[pos++]= '\0';
+	}
+	buf[pos++]= '\0';
+	memcpy(ctl->subscribe_buf, buf, pos);
+	return true;
+}
+
+/*
+=item conn.buffer RECV_MAX SEND_MAX
+
+Set how large this connection's buffers may grow.  RECV_MAX is the longest
+command the connection can send, and SEND_MAX is how many bytes of events
+can wait for the connection to read them before daemonproxy reports an
+overflow.  The buffers start small, and only grow when needed.  Sizes may
+have a suffix of K or M.  The defaults come from --controller-recv-max and
+--controller-send-max.
+
+With --controller-pool, the buffers can't grow beyond the size they were
+allocated with.  Lowering a limit doesn't shrink a buffer that already grew.
+
+=cut
+*/
+static bool ctl_get_arg_buf_size(controller_t *ctl, int min, int max, int *size_out) {
+	strseg_t str;
+	int64_t val;
+	if (!strseg_tok_next(&ctl->command, '\t', &str)
+		|| !strseg_parse_size(&str, &val)
+		|| str.len > 0
+	) {
+		ctl->command_error= "Expected size";
+		return false;
+	}
+	if (val < min || val > max) {
+		snprintf(ctl->command_error_buf, sizeof(ctl->command_error_buf),
+			"buffer size must be %d..%d", min, max);
+		ctl->command_error= ctl->command_error_buf;
+		return false;
+	}
+	*size_out= (int) val;
+	return true;
+}
+
+bool ctl_cmd_conn_buffer(controller_t *ctl) {
+	int recv_max, send_max;
+
+	if (!ctl_get_arg_buf_size(ctl, CONTROLLER_RECV_BUF_SIZE, ctl_pool? ctl->recv_buf_size : CONTROLLER_BUF_MAX_LIMIT, &recv_max)
+		|| !ctl_get_arg_buf_size(ctl, CONTROLLER_SEND_BUF_SIZE, ctl_pool? ctl->send_buf_size : CONTROLLER_BUF_MAX_LIMIT, &send_max))
+		return false;
+
+	ctl->recv_buf_max= recv_max;
+	ctl->send_buf_max= send_max;
+	return true;
+}
+
+/*
+=item conn.protocol text|binary
+
+Switch this connection to the text protocol (the default) or to binary
+records, described in L</BINARY PROTOCOL>.  The reply "conn.protocol MODE"
+is the first event sent in the new protocol, and the next command is read
+in the new protocol.
+
+=cut
+*/
+bool ctl_cmd_conn_protocol(controller_t *ctl) {
+	strseg_t mode;
+
+	if (!ctl_get_arg(ctl, &mode))
+		return false;
+	if (strseg_cmp(mode, STRSEG_LITERAL("binary")) == 0)
+		ctl->protocol_binary= true;
+	else if (strseg_cmp(mode, STRSEG_LITERAL("text")) == 0)
+		ctl->protocol_binary= false;
+	else {
+		ctl->command_error= "protocol must be text or binary";
+		return false;
+	}
+	ctl_write(ctl, "conn.protocol\t%.*s\n", mode.len, mode.data);
+	return true;
+}
+
+/*
+=item batch.begin ID
+
+Start a batch of commands.  The commands up to batch.end run together
+without yielding to other work after every few commands (see
+--controller-iterations), and instead of an error event for each command
+that fails, batch.end replies with a single summary.  Errors are still
+logged.  ID is any string of your choice, used to match the summary to the
+batch.
+
+=item batch.end
+
+End the batch, and reply "batch.end ID ok" if every command succeeded, or
+"batch.end ID error COUNT MESSAGE" where COUNT is the number of commands
+that failed and MESSAGE is the error of the first one.
+
+=cut
+*/
+bool ctl_cmd_batch_begin(controller_t *ctl) {
+	strseg_t id;
+
+	if (ctl->batch_active) {
+		ctl->command_error= "already in a batch";
+		return false;
+	}
+	if (!ctl_get_arg(ctl, &id))
+		return false;
+	if (!id.len || id.len >= sizeof(ctl->batch_id)) {
+		ctl->command_error= "invalid batch ID";
+		return false;
+	}
+	memcpy(ctl->batch_id, id.data, id.len);
+	ctl->batch_id[id.len]= '\0';
+	ctl->batch_errors= 0;
+	ctl->batch_error[0]= '\0';
+	ctl->batch_active= true;
+	return true;
+}
+
+bool ctl_cmd_batch_end(controller_t *ctl) {
+	if (!ctl->batch_active) {
+		ctl->command_error= "not in a batch";
+		return false;
+	}
+	ctl->batch_active= false;
+	if (ctl->batch_errors)
+		ctl_write(ctl, "batch.end\t%s\terror\t%d\t%s\n", ctl->batch_id, ctl->batch_errors, ctl->batch_error);
+	else
+		ctl_write(ctl, "batch.end\t%s\tok\n", ctl->batch_id);
+	return true;
+}
+
+// Count a failed command in the current batch, and keep the first message
+static bool ctl_batch_error(controller_t *ctl, const char *fmt, ...) {
+	va_list val;
+	if (!ctl->batch_errors++) {
+		va_start(val, fmt);
+		vsnprintf(ctl->batch_error, sizeof(ctl->batch_error), fmt, val);
+		va_end(val);
+	}
+	return true;
+}
+
 /*
 =item chdir PATH
 
@@ -646,8 +1252,11 @@ but people expect to be able to type 'exit' to end a command stream.
 =cut
 */
 bool ctl_cmd_exit(controller_t *ctl) {
-	// they asked for it...
-	if (ctl->recv_fd >= 0) close(ctl->recv_fd);
+	// they asked for it...  (but a shared socket stays open to flush replies)
+	if (ctl->recv_fd >= 0 && ctl->recv_fd != ctl->send_fd) {
+		wake_cancel_fd(ctl->recv_fd);
+		close(ctl->recv_fd);
+	}
 	ctl->recv_fd= -1;
 	ctl->state_fn= ctl_state_close;
 	return true;
@@ -682,8 +1291,10 @@ bool ctl_state_dump_fds(controller_t *ctl) {
 	while ((fd= fd_iter_next(fd, ctl->statedump_current))) {
 		log_trace("fd iter = %s", fd_get_name(fd));
  case 1:
+		fd_check(fd);
 		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 1; break; }
-		ctl_notify_fd_state(ctl, fd);
+		if (ctl_subscribed(ctl, STRSEG_LITERAL("fd.state"), STRSEG(fd_get_name(fd))))
+			ctl_notify_fd_state(ctl, fd);
 	}
  } //switch
 	if (fd) { // If we broke the loop early, record name of where to resume
@@ -698,9 +1309,12 @@ bool ctl_state_dump_fds(controller_t *ctl) {
 
 bool ctl_state_dump_services(controller_t *ctl) {
 	service_t *svc= svc_by_name(STRSEG(ctl->statedump_current), false);
+	const svc_usage_t *usage;
+	int factor, jitter, runs, count;
+	int64_t max, reset, window;
 	if (!svc) ctl->command_substate= 0;
 	/* Statedump command, part 2: iterate services and dump each one.
-	 * Like part 1 above, except a service has 4 lines of output.
+	 * Like part 1 above, except a service has several lines of output.
 	 */
  switch (ctl->command_substate) {
  case 0:
@@ -710,20 +1324,73 @@ bool ctl_state_dump_services(controller_t *ctl) {
  case 1:
 		svc_check(svc);
 		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 1; break; }
-		ctl_notify_svc_state(ctl, svc_get_name(svc), svc_get_up_ts(svc),
-			svc_get_reap_ts(svc), svc_get_wstat(svc), svc_get_pid(svc));
+		if (ctl_subscribed(ctl, STRSEG_LITERAL("service.state"), STRSEG(svc_get_name(svc))))
+			ctl_notify_svc_state(ctl, svc_get_name(svc), svc_get_up_ts(svc), svc_get_ready_ts(svc),
+				svc_get_stop_ts(svc), svc_get_reap_ts(svc), svc_get_wstat(svc), svc_get_pid(svc),
+				svc_get_usage(svc));
  case 2:
 		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 2; break; }
-		ctl_notify_svc_tags(ctl, svc_get_name(svc), svc_get_tags(svc));
+		if (ctl_subscribed(ctl, STRSEG_LITERAL("service.tags"), STRSEG(svc_get_name(svc))))
+			ctl_notify_svc_tags(ctl, svc_get_name(svc), svc_get_tags(svc));
  case 3:
 		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 3; break; }
-		ctl_notify_svc_argv(ctl, svc_get_name(svc), svc_get_argv(svc));
+		if (ctl_subscribed(ctl, STRSEG_LITERAL("service.args"), STRSEG(svc_get_name(svc))))
+			ctl_notify_svc_argv(ctl, svc_get_name(svc), svc_get_argv(svc));
  case 4:
 		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 4; break; }
-		ctl_notify_svc_fds(ctl, svc_get_name(svc), svc_get_fds(svc));
+		if (ctl_subscribed(ctl, STRSEG_LITERAL("service.fds"), STRSEG(svc_get_name(svc))))
+			ctl_notify_svc_fds(ctl, svc_get_name(svc), svc_get_fds(svc));
  case 5:
 		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 5; break; }
-		ctl_notify_svc_auto_up(ctl, svc_get_name(svc), svc_get_restart_interval(svc), svc_get_triggers(svc));
+		if (ctl_subscribed(ctl, STRSEG_LITERAL("service.auto_up"), STRSEG(svc_get_name(svc))))
+			ctl_notify_svc_auto_up(ctl, svc_get_name(svc), svc_get_restart_interval(svc), svc_get_triggers(svc));
+ case 6:
+		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 6; break; }
+		if (svc_get_requires(svc)[0] && ctl_subscribed(ctl, STRSEG_LITERAL("service.requires"), STRSEG(svc_get_name(svc))))
+			ctl_notify_svc_requires(ctl, svc_get_name(svc), svc_get_requires(svc));
+ case 7:
+		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 7; break; }
+		if (svc_get_after(svc)[0] && ctl_subscribed(ctl, STRSEG_LITERAL("service.after"), STRSEG(svc_get_name(svc))))
+			ctl_notify_svc_after(ctl, svc_get_name(svc), svc_get_after(svc));
+ case 8:
+		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 8; break; }
+		if (svc_get_ready_timeout(svc) && ctl_subscribed(ctl, STRSEG_LITERAL("service.ready_timeout"), STRSEG(svc_get_name(svc))))
+			ctl_notify_svc_ready_timeout(ctl, svc_get_name(svc), svc_get_ready_timeout(svc));
+ case 9:
+		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 9; break; }
+		if (ctl_subscribed(ctl, STRSEG_LITERAL("service.backoff"), STRSEG(svc_get_name(svc)))) {
+			svc_get_backoff(svc, &factor, &max, &jitter, &reset);
+			if (factor)
+				ctl_notify_svc_backoff(ctl, svc_get_name(svc), factor, max, jitter, reset);
+		}
+ case 10:
+		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 10; break; }
+		if (svc_get_priority(svc) && ctl_subscribed(ctl, STRSEG_LITERAL("service.priority"), STRSEG(svc_get_name(svc))))
+			ctl_notify_svc_priority(ctl, svc_get_name(svc), svc_get_priority(svc));
+ case 11:
+		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 11; break; }
+		if (svc_get_limits(svc)[0] && ctl_subscribed(ctl, STRSEG_LITERAL("service.limits"), STRSEG(svc_get_name(svc))))
+			ctl_notify_svc_limits(ctl, svc_get_name(svc), svc_get_limits(svc));
+ case 12:
+		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 12; break; }
+		if (ctl_subscribed(ctl, STRSEG_LITERAL("service.usage"), STRSEG(svc_get_name(svc)))) {
+			usage= svc_get_usage_total(svc, &runs);
+			if (runs)
+				ctl_notify_svc_usage(ctl, svc_get_name(svc), runs, usage);
+		}
+ case 13:
+		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 13; break; }
+		if (ctl_subscribed(ctl, STRSEG_LITERAL("service.flap_limit"), STRSEG(svc_get_name(svc)))) {
+			svc_get_flap_limit(svc, &count, &window);
+			if (count != SERVICE_FLAP_COUNT_DEFAULT || (count && window != SERVICE_FLAP_WINDOW_DEFAULT))
+				ctl_notify_svc_flap_limit(ctl, svc_get_name(svc), count, window);
+		}
+ case 14:
+		if (!ctl_out_buf_ready(ctl)) { ctl->command_substate= 14; break; }
+		if (svc_is_flapping(svc) && ctl_subscribed(ctl, STRSEG_LITERAL("service.flapping"), STRSEG(svc_get_name(svc)))) {
+			svc_get_flap_limit(svc, &count, &window);
+			ctl_notify_svc_flapping(ctl, svc_get_name(svc), count, window);
+		}
 	}
  }//switch
 	if (svc) { // If we broke the loop early, record name of where to resume
@@ -745,6 +1412,57 @@ bool ctl_state_dump_signals(controller_t *ctl) {
 	return true;
 }
 
+/*
+=item stats
+
+Emit a "stats" event for each of daemonproxy's internal counters and latency
+histograms, followed by one for each controller connection.  The counters
+start at zero when daemonproxy starts, and are never reset.  See the stats
+event for the list.
+
+=cut
+*/
+bool ctl_cmd_stats(controller_t *ctl) {
+	ctl->state_fn= ctl_state_dump_stats;
+	ctl->command_substate= 0;
+	return true;
+}
+
+bool ctl_state_dump_stats(controller_t *ctl) {
+	char buckets[STATS_HIST_BUCKETS * 21];
+	const char *name;
+	int64_t value;
+	stats_hist_t *hist;
+	controller_t *peer;
+	int i;
+	// command_substate is the index of the next statistic, and then of the
+	// next controller in ctl_list after the last statistic.
+	while (stats_get(ctl->command_substate, &name, &value, &hist)) {
+		if (!ctl_out_buf_ready(ctl))
+			return false;
+		if (!hist)
+			ctl_write(ctl, "stats\t%s\t%lld\n", name, (long long) value);
+		else {
+			stats_hist_format(hist, buckets, sizeof(buckets));
+			ctl_write(ctl, "stats\t%s\t%lld\t%lld\t%lld\t%s\n", name,
+				(long long) hist->count, (long long) hist->sum, (long long) hist->max, buckets);
+		}
+		ctl->command_substate++;
+	}
+	for (i= ctl->command_substate - stats_count; i < ctl_list_count; i++, ctl->command_substate++) {
+		peer= ctl_list[i];
+		if (!peer->state_fn || peer->state_fn == ctl_state_free)
+			continue;
+		if (!ctl_out_buf_ready(ctl))
+			return false;
+		ctl_write(ctl, "stats\tconn\t%d\t%lld\t%lld\t%lld\t%lld\t%lld\n", peer->id,
+			(long long) peer->stat_commands, (long long) peer->stat_bytes_in, (long long) peer->stat_bytes_out,
+			(long long) peer->stat_events, (long long) peer->stat_overflows);
+	}
+	ctl->state_fn= ctl_state_end_command;
+	return true;
+}
+
 /*
 =item fd.pipe NAME_READ NAME_WRITE FLAGS
 
@@ -1235,6 +1953,13 @@ be created if it didn't exist.  The name 'null' is always available
 and refers to /dev/null.  '-' means to pass the service a closed
 file descriptor.
 
+The name 'control.ready' passes the write end of a pipe, for the service
+to report that it has finished starting up.  Such a service goes from 'up'
+to 'ready' when it writes a line to this descriptor (a bare newline, like
+the s6 notification-fd, is enough), and dependent services wait for that
+instead of for the fork.  Closing it without writing a line doesn't make the
+service ready.  See service.ready_timeout.
+
 =cut
 */
 bool ctl_cmd_svc_fds(controller_t *ctl) {
@@ -1321,76 +2046,455 @@ bool ctl_cmd_svc_auto_up(controller_t *ctl) {
 }
 
 /*
-=item service.start NAME [FUTURE_TIMESTAMP]
-
-Start the service, optionally at a future time (or cancel a previous request).
+=item service.backoff NAME FACTOR MAX_INTERVAL [JITTER [RESET_UPTIME]]
 
-FUTURE_TIMESTAMP is an integer of seconds according to CLOCK_MONOTONIC.
-(This might be extended to allow fractional seconds in the future.)
-The service.start will take place as soon as that time is past, but if
-the timestamp is more than 100000 seconds in the past it is considered
-an error.  The service.state will become 'start'.
+Back off exponentially when auto_up restarts a service which keeps failing.
+Instead of waiting MIN_INTERVAL (from service.auto_up) before each restart of
+a service which ran less than RESET_UPTIME seconds, the wait starts at
+MIN_INTERVAL, or 1 second if MIN_INTERVAL is less than that, and is
+multiplied by FACTOR after each such restart, up to MAX_INTERVAL seconds.
+A run of at least RESET_UPTIME seconds starts it over, and the service is
+restarted right away.  RESET_UPTIME defaults to MAX_INTERVAL.
 
-If FUTURE_TIMESTAMP is the string "-", a pending start event will be
-canceled.  However, because commands are asynchronous the service might
-get started anyway.  Watch for the service.state event to find out whether
-it started or was canceled.
+Each wait is then randomly lengthened or shortened by up to JITTER percent
+(default 10) so that many services failing for a common reason, such as a
+shared database going away, don't all restart at the same moment.
 
-Starting a service can reveal configuration errors, such as invalid FD names,
-or an argv that can't be executed.  Error messages are events, so they are
-asynchronous and might be received in any order.
+"service.backoff NAME -" turns it off again.
 
 =cut
 */
-bool ctl_cmd_svc_start(controller_t *ctl) {
-	const char *argv;
-	int64_t starttime_ts;
+bool ctl_cmd_svc_backoff(controller_t *ctl) {
 	service_t *svc;
-	strseg_t when;
+	int64_t factor, max, jitter= 10, reset;
+	int cur_factor, cur_jitter;
 	
-	if (!ctl_get_arg_service(ctl, true, NULL, &svc))
+	if (!ctl_get_arg_service(ctl, false, NULL, &svc))
 		return false;
 	
-	// Optional timestamp for service start
-	if (ctl_peek_arg(ctl, &when)) {
-		if (0 == strseg_cmp(when, STRSEG("-"))) {
-			if (svc_cancel_start(svc))
-				return true;
-			ctl->command_error= "no service.start pending";
+	if (ctl->command.len == 1 && ctl->command.data[0] == '-')
+		factor= max= jitter= reset= 0;
+	else {
+		if (!ctl_get_arg_int(ctl, &factor) || !ctl_get_arg_int(ctl, &max))
 			return false;
-		}
-		if (!ctl_get_arg_ts(ctl, &starttime_ts) || starttime_ts - wake->now < -100000) {
-			ctl->command_error= "invalid timestamp";
+		if (ctl->command.len > 0 && !ctl_get_arg_int(ctl, &jitter))
+			return false;
+		reset= max;
+		if (ctl->command.len > 0 && !ctl_get_arg_int(ctl, &reset))
+			return false;
+		if (factor < 1 || factor > 1000 || max < 1 || (max >> 31) || reset < 0 || (reset >> 31)) {
+			ctl->command_error= "invalid backoff interval";
 			return false;
 		}
 	}
-	else starttime_ts= wake->now;
 	
-	argv= svc_get_argv(svc);
-	if (!argv[0] || argv[0] == '\t') {
-		ctl->command_error= "no args configured for service";
+	if (!svc_set_backoff(svc, (int) factor, max << 32, (int) jitter, reset << 32)) {
+		ctl->command_error= "invalid backoff jitter";
 		return false;
 	}
 	
-	if (svc_handle_start(svc, starttime_ts))
-		return true;
-	ctl->command_error= "service is not startable";
-	return false;
+	svc_get_backoff(svc, &cur_factor, &max, &cur_jitter, &reset);
+	ctl_notify_svc_backoff(NULL, svc_get_name(svc), cur_factor, max, cur_jitter, reset);
+	return true;
 }
 
 /*
-=item service.signal NAME SIGNAL [FLAGS]
+=item service.priority NAME PRIORITY
 
-Send SIGNAL to the named service's pid, if it is running.  If you specify the
-flag "group" and the service is leading a process group, then the entire group
-receives the signal.
+Set the priority of the service when starts are limited by --spawn-rate.
+Services with a higher PRIORITY get to start first, and those of equal
+priority start in the order they were queued.  The default is 0, and
+negative numbers are allowed.
 
 =cut
 */
-bool ctl_cmd_svc_signal(controller_t *ctl) {
+bool ctl_cmd_svc_priority(controller_t *ctl) {
 	service_t *svc;
-	bool group= false;
-	strseg_t flags, flag;
+	int64_t priority;
+	
+	if (!ctl_get_arg_service(ctl, false, NULL, &svc))
+		return false;
+	if (!ctl_get_arg_int(ctl, &priority))
+		return false;
+	if (priority < INT_MIN || priority > INT_MAX || !svc_set_priority(svc, (int) priority)) {
+		ctl->command_error= "invalid priority";
+		return false;
+	}
+	
+	ctl_notify_svc_priority(NULL, svc_get_name(svc), svc_get_priority(svc));
+	return true;
+}
+
+/*
+=item service.limits NAME [SETTING_1] ... [SETTING_N]
+
+Set the resources that NAME may use, as a list of KEY=VALUE settings which
+replaces any previous list.  They are applied by the new process before it
+execs the service, so they take effect at the next start.  The settings are:
+
+  cgroup=PATH          Use this cgroup instead of the default from --cgroup.
+                       Relative paths are relative to the --cgroup directory.
+  memory.max=BYTES     Written to the cgroup's interface file of that name.
+  memory.high=BYTES    Likewise cpu.weight, cpu.max, io.weight,
+  pids.max=N           and memory.swap.max.  These require a cgroup.
+  rlimit.NAME=SOFT[:HARD]
+                       Set a resource limit, where NAME is as, core, cpu,
+                       data, fsize, memlock, nofile, nproc, or stack.  Values
+                       take a size suffix like 64M, or may be "unlimited".
+                       HARD defaults to SOFT.
+  nice=N               Scheduling priority, -20 to 19.
+  ionice=CLASS[:LEVEL] I/O class realtime, best-effort, or idle, and a LEVEL
+                       of 0 (highest) to 7 (default 4).
+  cpus=LIST            CPU affinity, like 0-3,6.
+
+Invalid settings are rejected, as are cgroup settings for a service that has
+no cgroup, and a relative cgroup=PATH without --cgroup.  If a setting of the
+new process can't be applied (for example a negative nice value without
+privilege), the start fails like a failed exec, and is logged.  If the cgroup
+can't be created or its settings can't be written, that is logged and the
+start is retried every few seconds until the service is stopped.  Settings
+within the cgroup are rewritten each time the service starts.
+
+=cut
+*/
+bool ctl_cmd_svc_limits(controller_t *ctl) {
+	service_t *svc;
+	const char *err;
+	strseg_t limits;
+	
+	if (!ctl_get_arg_service(ctl, false, NULL, &svc))
+		return false;
+	limits= ctl->command;
+	if ((err= svc_check_limits(limits))) {
+		ctl->command_error= err;
+		return false;
+	}
+	if (!svc_set_limits(svc, limits)) {
+		ctl->command_error= "unable to set limits";
+		return false;
+	}
+	
+	ctl_notify_svc_limits(NULL, svc_get_name(svc), svc_get_limits(svc));
+	return true;
+}
+
+/*
+=item service.flap_limit NAME COUNT SECONDS
+
+Set how many failures in a row, within SECONDS, mean that NAME is
+crash-looping.  A failure is an exit with a non-zero status, or by a
+signal other than from service.stop.  auto_up then stops restarting the
+service, and daemonproxy emits a service.flapping event, until something
+starts it again.  The default is 5 failures within 60 seconds.  COUNT may
+be at most the number of runs in service.history (8).  A COUNT of 0, or
+'-', turns this off.
+
+=cut
+*/
+bool ctl_cmd_svc_flap_limit(controller_t *ctl) {
+	service_t *svc;
+	int64_t count, seconds= 0;
+	int64_t window;
+	int flap_count;
+	strseg_t tmp;
+	
+	if (!ctl_get_arg_service(ctl, false, NULL, &svc))
+		return false;
+	tmp= ctl->command;
+	if (tmp.len == 1 && tmp.data[0] == '-')
+		count= 0;
+	else if (!ctl_get_arg_int(ctl, &count))
+		return false;
+	else if (count && !ctl_get_arg_int(ctl, &seconds))
+		return false;
+	if (count < 0 || seconds < 0 || (seconds >> 31) || !svc_set_flap_limit(svc, (int) count, seconds << 32)) {
+		ctl->command_error= "invalid flap limit";
+		return false;
+	}
+	
+	svc_get_flap_limit(svc, &flap_count, &window);
+	ctl_notify_svc_flap_limit(NULL, svc_get_name(svc), flap_count, window);
+	return true;
+}
+
+/*
+=item service.history NAME
+
+Emit a service.history event (to this controller only) for each of the
+recent runs of NAME which daemonproxy remembers, oldest first.  It keeps
+the last 8 runs of each service.
+
+=cut
+*/
+bool ctl_cmd_svc_history(controller_t *ctl) {
+	strseg_t name;
+	
+	if (!ctl_get_arg_service(ctl, true, &name, NULL))
+		return false;
+	memcpy(ctl->statedump_current, name.data, name.len); // length of name has already been checked
+	ctl->statedump_current[name.len]= '\0';
+	ctl->state_fn= ctl_state_dump_history;
+	ctl->command_substate= 0;
+	return true;
+}
+
+bool ctl_state_dump_history(controller_t *ctl) {
+	service_t *svc= svc_by_name(STRSEG(ctl->statedump_current), false);
+	int64_t up_ts, reap_ts;
+	int wstat;
+	// command_substate is the index of the next run to report
+	while (svc && svc_get_history(svc, ctl->command_substate, &up_ts, &reap_ts, &wstat)) {
+		if (!ctl_out_buf_ready(ctl))
+			return false;
+		ctl_notify_svc_history(ctl, svc_get_name(svc), up_ts, reap_ts, wstat);
+		ctl->command_substate++;
+	}
+	ctl->state_fn= ctl_state_end_command;
+	return true;
+}
+
+/*
+=item service.requires NAME [SERVICE_1] ... [SERVICE_N]
+
+Set the list of services which NAME requires.  Whenever NAME is started,
+any of these which are down get started too, and NAME waits until all of
+them are up.  If one of them doesn't exist or ends up down instead (such as
+by exiting before NAME could start), the start of NAME is cancelled and an
+error is logged.  An empty list removes the requirements.
+
+Services whose dependencies are satisfied are all started together, in the
+same iteration of daemonproxy's main loop, so a controller can start a whole
+tree of services with one service.start (or with auto_up) rather than
+waiting for each one to come up.  The names don't need to exist yet, but a
+list that would make a service wait on itself is an error.
+
+=cut
+*/
+bool ctl_cmd_svc_requires(controller_t *ctl) {
+	return ctl_set_svc_deps(ctl, true);
+}
+
+/*
+=item service.after NAME [SERVICE_1] ... [SERVICE_N]
+
+Set the list of services which NAME starts after.  Unlike service.requires,
+this doesn't start them.  It only means that if any of them are starting
+when NAME is about to start, NAME waits until they are up, or ready if they
+use control.ready (or until they have failed).  An empty list removes them.
+
+=cut
+*/
+bool ctl_cmd_svc_after(controller_t *ctl) {
+	return ctl_set_svc_deps(ctl, false);
+}
+
+/*
+=item service.ready_timeout NAME SECONDS
+
+Set how long NAME may take to report ready on control.ready after it
+starts.  If it hasn't by then, daemonproxy logs an error and sends it
+SIGTERM.  Services which require it fail right away instead of waiting
+forever, and auto_up can restart it.  A value of 0 or '-' means no limit,
+which is the default.  Takes effect from the next start.
+
+=cut
+*/
+bool ctl_cmd_svc_ready_timeout(controller_t *ctl) {
+	service_t *svc;
+	int64_t timeout;
+	strseg_t tmp;
+
+	if (!ctl_get_arg_service(ctl, false, NULL, &svc))
+		return false;
+
+	tmp= ctl->command;
+	if (tmp.len == 1 && tmp.data[0] == '-')
+		timeout= 0;
+	else if (!ctl_get_arg_int(ctl, &timeout))
+		return false;
+	else if (timeout < 0 || (timeout >> 31)) {
+		ctl->command_error= "invalid timeout";
+		return false;
+	}
+
+	if (!svc_set_ready_timeout(svc, timeout << 32)) {
+		ctl->command_error= "unable to set ready timeout";
+		return false;
+	}
+
+	ctl_notify_svc_ready_timeout(NULL, svc_get_name(svc), svc_get_ready_timeout(svc));
+	return true;
+}
+
+static bool ctl_set_svc_deps(controller_t *ctl, bool requires) {
+	service_t *svc;
+	strseg_t deps, name;
+	const char *cycle;
+
+	if (!ctl_get_arg_service(ctl, false, NULL, &svc))
+		return false;
+
+	deps= ctl->command;
+	while (strseg_tok_next(&ctl->command, '\t', &name)) {
+		if (!svc_check_name(name)) {
+			ctl->command_error= "invalid service name";
+			return false;
+		}
+	}
+	if ((cycle= svc_deps_cycle(svc, deps))) {
+		snprintf(ctl->command_error_buf, sizeof(ctl->command_error_buf), "dependency cycle through \"%s\"", cycle);
+		ctl->command_error= ctl->command_error_buf;
+		return false;
+	}
+	if (!(requires? svc_set_requires(svc, deps) : svc_set_after(svc, deps))) {
+		ctl->command_error= "unable to set dependencies";
+		return false;
+	}
+
+	if (requires)
+		ctl_notify_svc_requires(NULL, svc_get_name(svc), svc_get_requires(svc));
+	else
+		ctl_notify_svc_after(NULL, svc_get_name(svc), svc_get_after(svc));
+	return true;
+}
+
+/*
+=item service.start NAME [FUTURE_TIMESTAMP]
+
+Start the service, optionally at a future time (or cancel a previous request).
+
+FUTURE_TIMESTAMP is an integer of seconds according to CLOCK_MONOTONIC.
+(This might be extended to allow fractional seconds in the future.)
+The service.start will take place as soon as that time is past, but if
+the timestamp is more than 100000 seconds in the past it is considered
+an error.  The service.state will become 'start'.
+
+If FUTURE_TIMESTAMP is the string "-", a pending start event will be
+canceled.  However, because commands are asynchronous the service might
+get started anyway.  Watch for the service.state event to find out whether
+it started or was canceled.
+
+Starting a service can reveal configuration errors, such as invalid FD names,
+or an argv that can't be executed.  Error messages are events, so they are
+asynchronous and might be received in any order.
+
+Starting a service that auto_up has paused for failing too often (see
+service.flap_limit) lets auto_up restart it again.
+
+=cut
+*/
+bool ctl_cmd_svc_start(controller_t *ctl) {
+	const char *argv;
+	int64_t starttime_ts;
+	service_t *svc;
+	strseg_t when;
+	
+	if (!ctl_get_arg_service(ctl, true, NULL, &svc))
+		return false;
+	
+	// Optional timestamp for service start
+	if (ctl_peek_arg(ctl, &when)) {
+		if (0 == strseg_cmp(when, STRSEG("-"))) {
+			if (svc_cancel_start(svc))
+				return true;
+			ctl->command_error= "no service.start pending";
+			return false;
+		}
+		if (!ctl_get_arg_ts(ctl, &starttime_ts) || starttime_ts - wake->now < -100000) {
+			ctl->command_error= "invalid timestamp";
+			return false;
+		}
+	}
+	else starttime_ts= wake->now;
+	
+	argv= svc_get_argv(svc);
+	if (!argv[0] || argv[0] == '\t') {
+		ctl->command_error= "no args configured for service";
+		return false;
+	}
+	
+	if (svc_handle_start(svc, starttime_ts))
+		return true;
+	ctl->command_error= "service is not startable";
+	return false;
+}
+
+/*
+=item service.stop NAME [TIMEOUT]
+
+Stop the service.  If it is running, it is sent SIGTERM and its state becomes
+'stopping', and if it is still running TIMEOUT seconds later (default 10),
+daemonproxy sends it SIGKILL.  A TIMEOUT of '-' means never send SIGKILL.
+If it was waiting to start, the start is cancelled.
+
+A stopped service is not restarted by service.auto_up until it is started
+again by service.start or a dependent service.
+
+=cut
+*/
+bool ctl_cmd_svc_stop(controller_t *ctl) {
+	service_t *svc;
+	int64_t timeout;
+	
+	if (!ctl_get_arg_service(ctl, true, NULL, &svc))
+		return false;
+	if (!ctl_get_arg_stop_timeout(ctl, &timeout))
+		return false;
+	svc_handle_stop(svc, timeout);
+	return true;
+}
+
+/*
+=item service.stop_all [TIMEOUT]
+
+Stop every service, as with service.stop, all at once.  The exception is
+that a service which some other running service requires (or starts after)
+isn't sent SIGTERM until all of those are down, so services stop in the
+reverse of the order they start in.  This is meant for shutting down a
+whole host or container in bounded time.
+
+=cut
+*/
+bool ctl_cmd_svc_stop_all(controller_t *ctl) {
+	int64_t timeout;
+	
+	if (!ctl_get_arg_stop_timeout(ctl, &timeout))
+		return false;
+	svc_stop_all(timeout);
+	return true;
+}
+
+// Optional stop timeout argument in seconds, or '-' for none (-1)
+static bool ctl_get_arg_stop_timeout(controller_t *ctl, int64_t *timeout_out) {
+	if (ctl->command.len <= 0)
+		*timeout_out= SERVICE_STOP_TIMEOUT;
+	else if (ctl->command.len == 1 && ctl->command.data[0] == '-')
+		*timeout_out= -1;
+	else if (!ctl_get_arg_int(ctl, timeout_out))
+		return false;
+	else if (*timeout_out < 0 || (*timeout_out >> 31)) {
+		ctl->command_error= "invalid timeout";
+		return false;
+	}
+	else
+		*timeout_out <<= 32;
+	return true;
+}
+
+/*
+=item service.signal NAME SIGNAL [FLAGS]
+
+Send SIGNAL to the named service's pid, if it is running.  If you specify the
+flag "group", the entire process group led by the service receives the signal.
+If the service isn't leading a process group, the command fails and nothing is
+signalled.
+
+=cut
+*/
+bool ctl_cmd_svc_signal(controller_t *ctl) {
+	service_t *svc;
+	bool group= false;
+	strseg_t flags, flag;
 	int sig;
 	
 	if (!ctl_get_arg_service(ctl, true, NULL, &svc))
@@ -1734,40 +2838,78 @@ bool ctl_notify_signal(controller_t *ctl, int sig_num, int64_t sig_ts, int count
 }
 
 /*
-=item service.state NAME STATE TS PID EXITREASON EXITVALUE UPTIME DOWNTIME
-
-The state of service has changed.  STATE is 'start', 'up', 'down', or 'deleted'.
-TS is a timestamp from CLOCK_MONOTONIC.  PID is the process ID if relevant,
-and '-' otherwise.  EXITREASON is '-', 'exit', or 'signal'.  EXITVALUE is an
-integer or signal name.  UPTIME and DOWNTIME are in seconds, and '-' if not
-relevant.
+=item service.state NAME STATE TS PID EXITREASON EXITVALUE UPTIME DOWNTIME [USAGE]
+
+The state of service has changed.  STATE is 'start', 'up', 'ready', 'stopping',
+'down', or 'deleted'.  'ready' only happens for services given a control.ready
+handle, once they report ready.  'stopping' is from service.stop or
+service.stop_all.  TS is a timestamp from CLOCK_MONOTONIC.  PID is the process
+ID if relevant, and '-' otherwise.  EXITREASON is '-', 'exit', or 'signal'.
+EXITVALUE is an integer or signal name.  UPTIME and DOWNTIME are in seconds,
+and '-' if not relevant.
+
+When a service that ran goes down, the event ends with what that run used:
+USER_MS SYS_MS MAXRSS_KB VCSW IVCSW, which are the user and system CPU time
+in milliseconds, the largest resident size of any of its processes, and the
+number of voluntary and involuntary context switches.  These include any
+processes it left behind which were charged to it (see --subreaper), and
+with a cgroup (see --cgroup) the CPU time is that of the cgroup.
 
 =cut
 */
 
-bool ctl_notify_svc_state(controller_t *ctl, const char *name, int64_t up_ts, int64_t reap_ts, int wstat, pid_t pid) {
+bool ctl_notify_svc_state(controller_t *ctl, const char *name, int64_t up_ts, int64_t ready_ts, int64_t stop_ts, int64_t reap_ts, int wstat, pid_t pid, const svc_usage_t *usage) {
+	static const svc_usage_t no_usage;
 	const char *signame;
-	log_trace("ctl_notify_svc_state(%s, %lld, %lld, %d, %d)", name, up_ts, reap_ts, pid, wstat);
+	log_trace("ctl_notify_svc_state(%s, %lld, %lld, %lld, %lld, %d, %d)", name, up_ts, ready_ts, stop_ts, reap_ts, pid, wstat);
 	if (!up_ts)
 		return ctl_write(ctl, "service.state	%s	down	-	-	-	-	-	-\n", name);
 	else if ((up_ts - wake->now) >= 0 && !pid)
 		return ctl_write(ctl, "service.state	%s	start	%d	-	-	-	-	-\n",
 			name, (int)(up_ts>>32));
+	else if (!reap_ts && stop_ts)
+		return ctl_write(ctl, "service.state	%s	stopping	%d	%d	-	-	%d	-\n",
+			name, (int)(stop_ts>>32), (int) pid, (int)((wake->now - up_ts)>>32));
+	else if (!reap_ts && ready_ts)
+		return ctl_write(ctl, "service.state	%s	ready	%d	%d	-	-	%d	-\n",
+			name, (int)(ready_ts>>32), (int) pid, (int)((wake->now - up_ts)>>32));
 	else if (!reap_ts)
 		return ctl_write(ctl, "service.state	%s	up	%d	%d	-	-	%d	-\n",
 			name, (int)(up_ts>>32), (int) pid, (int)((wake->now - up_ts)>>32));
-	else if (WIFEXITED(wstat))
-		return ctl_write(ctl, "service.state	%s	down	%d	%d	exit	%d	%d	%d\n",
+	if (!usage)
+		usage= &no_usage;
+	if (WIFEXITED(wstat))
+		return ctl_write(ctl, "service.state	%s	down	%d	%d	exit	%d	%d	%d	%lld	%lld	%lld	%lld	%lld\n",
 			name, (int)(reap_ts>>32), (int) pid, WEXITSTATUS(wstat),
-			(int)((reap_ts - up_ts)>>32), (int)((wake->now - reap_ts)>>32));
+			(int)((reap_ts - up_ts)>>32), (int)((wake->now - reap_ts)>>32),
+			(long long)(usage->user_usec / 1000), (long long)(usage->sys_usec / 1000),
+			(long long) usage->maxrss_kb, (long long) usage->nvcsw, (long long) usage->nivcsw);
 	else {
 		signame= sig_name_by_num(WTERMSIG(wstat));
-		return ctl_write(ctl, "service.state	%s	down	%d	%d	signal	SIG%s	%d	%d\n",
+		return ctl_write(ctl, "service.state	%s	down	%d	%d	signal	SIG%s	%d	%d	%lld	%lld	%lld	%lld	%lld\n",
 			name, (int)(reap_ts>>32), (int) pid, signame? signame : "-?",
-			(int)((reap_ts - up_ts)>>32), (int)((wake->now - reap_ts)>>32));
+			(int)((reap_ts - up_ts)>>32), (int)((wake->now - reap_ts)>>32),
+			(long long)(usage->user_usec / 1000), (long long)(usage->sys_usec / 1000),
+			(long long) usage->maxrss_kb, (long long) usage->nvcsw, (long long) usage->nivcsw);
 	}
 }
 
+/*
+=item service.usage NAME RUNS USER_MS SYS_MS MAXRSS_KB VCSW IVCSW
+
+The resources used by all runs of a service so far, reported by statedump
+for services which have run.  RUNS is the number of runs which have ended,
+MAXRSS_KB is the largest of any run, and the rest are totals, as in the
+service.state event.
+
+=cut
+*/
+bool ctl_notify_svc_usage(controller_t *ctl, const char *name, int runs, const svc_usage_t *total) {
+	return ctl_write(ctl, "service.usage	%s	%d	%lld	%lld	%lld	%lld	%lld\n", name, runs,
+		(long long)(total->user_usec / 1000), (long long)(total->sys_usec / 1000),
+		(long long) total->maxrss_kb, (long long) total->nvcsw, (long long) total->nivcsw);
+}
+
 /*
 =item service.tags NAME TAG_1 TAG_2 ... TAG_N
 
@@ -1816,6 +2958,128 @@ bool ctl_notify_svc_auto_up(controller_t *ctl, const char *name, int64_t interva
 	return true;
 }
 
+/*
+=item service.backoff NAME FACTOR MAX_INTERVAL JITTER RESET_UPTIME
+
+The restart backoff of a service has changed.  It is "service.backoff NAME -"
+if disabled, and a statedump only reports services which have it enabled.
+
+=cut
+*/
+bool ctl_notify_svc_backoff(controller_t *ctl, const char *name, int factor, int64_t max, int jitter, int64_t reset) {
+	if (!factor)
+		return ctl_write(ctl, "service.backoff	%s	-\n", name);
+	return ctl_write(ctl, "service.backoff	%s	%d	%d	%d	%d\n",
+		name, factor, (int)(max>>32), jitter, (int)(reset>>32));
+}
+
+/*
+=item service.priority NAME PRIORITY
+
+The spawn priority of a service has changed.  A statedump only reports
+services with a priority other than 0.
+
+=cut
+*/
+bool ctl_notify_svc_priority(controller_t *ctl, const char *name, int priority) {
+	return ctl_write(ctl, "service.priority	%s	%d\n", name, priority);
+}
+
+/*
+=item service.history NAME UP_TS REAP_TS EXITREASON EXITVALUE
+
+One of the recent runs of a service, in reply to service.history.  UP_TS and
+REAP_TS are when it started and was reaped, and EXITREASON and EXITVALUE
+are as in service.state.
+
+=cut
+*/
+bool ctl_notify_svc_history(controller_t *ctl, const char *name, int64_t up_ts, int64_t reap_ts, int wstat) {
+	const char *signame;
+	if (WIFEXITED(wstat))
+		return ctl_write(ctl, "service.history	%s	%d	%d	exit	%d\n",
+			name, (int)(up_ts>>32), (int)(reap_ts>>32), WEXITSTATUS(wstat));
+	signame= sig_name_by_num(WTERMSIG(wstat));
+	return ctl_write(ctl, "service.history	%s	%d	%d	signal	SIG%s\n",
+		name, (int)(up_ts>>32), (int)(reap_ts>>32), signame? signame : "-?");
+}
+
+/*
+=item service.flap_limit NAME COUNT SECONDS
+
+The crash-loop limit of a service has changed.  COUNT is '-' (with no
+SECONDS) if it is turned off.  A statedump only reports services which
+don't have the default.
+
+=cut
+*/
+bool ctl_notify_svc_flap_limit(controller_t *ctl, const char *name, int count, int64_t window) {
+	if (count)
+		return ctl_write(ctl, "service.flap_limit	%s	%d	%d\n", name, count, (int)(window>>32));
+	return ctl_write(ctl, "service.flap_limit	%s	-\n", name);
+}
+
+/*
+=item service.flapping NAME FAILURES SECONDS
+
+=item service.flapping NAME -
+
+The service failed FAILURES times within SECONDS, so auto_up won't restart
+it until something starts it.  The second form means it was started, and
+auto_up applies again.  A statedump reports the services which are paused.
+
+=cut
+*/
+bool ctl_notify_svc_flapping(controller_t *ctl, const char *name, int failures, int64_t window) {
+	if (failures)
+		return ctl_write(ctl, "service.flapping	%s	%d	%d\n", name, failures, (int)(window>>32));
+	return ctl_write(ctl, "service.flapping	%s	-\n", name);
+}
+
+/*
+=item service.limits NAME [SETTING_1] ... [SETTING_N]
+
+The resource settings of a service have changed.  A statedump only reports
+services which have some.
+
+=cut
+*/
+bool ctl_notify_svc_limits(controller_t *ctl, const char *name, const char *tsv_fields) {
+	return ctl_write(ctl, "service.limits	%s	%s\n", name, tsv_fields);
+}
+
+/*
+=item service.requires NAME [SERVICE_1] ... [SERVICE_N]
+
+=item service.after NAME [SERVICE_1] ... [SERVICE_N]
+
+The dependencies of a service have changed.  A statedump only reports
+services which have some.
+
+=cut
+*/
+bool ctl_notify_svc_requires(controller_t *ctl, const char *name, const char *tsv_fields) {
+	return ctl_write(ctl, "service.requires	%s	%s\n", name, tsv_fields);
+}
+
+bool ctl_notify_svc_after(controller_t *ctl, const char *name, const char *tsv_fields) {
+	return ctl_write(ctl, "service.after	%s	%s\n", name, tsv_fields);
+}
+
+/*
+=item service.ready_timeout NAME SECONDS
+
+The readiness timeout of a service has changed.  SECONDS is '-' for no limit.
+A statedump only reports services which have one.
+
+=cut
+*/
+bool ctl_notify_svc_ready_timeout(controller_t *ctl, const char *name, int64_t timeout) {
+	if (timeout)
+		return ctl_write(ctl, "service.ready_timeout	%s	%d\n", name, (int)(timeout>>32));
+	return ctl_write(ctl, "service.ready_timeout	%s	-\n", name);
+}
+
 /*
 =item fd.state NAME TYPE FLAGS DESCRIPTION
 
@@ -1872,6 +3136,45 @@ bool ctl_notify_fd_state(controller_t *ctl, fd_t *fd) {
 	}
 }
 
+/*
+=item stats NAME VALUE
+
+=item stats NAME COUNT SUM MAX BUCKETS
+
+=item stats conn ID COMMANDS BYTES_IN BYTES_OUT EVENTS OVERFLOWS
+
+Reply to the stats command.  Counters have a single VALUE.  Latency
+histograms have the number of samples, their total and maximum (in
+microseconds), and a comma-separated count of samples per bucket.  Bucket 0
+is under 1us, and bucket N is from 2^(N-1) to 2^N us, with trailing empty
+buckets left off ('-' if there are no samples).
+
+  loop.iterations  Passes through the main loop
+  loop.busy        Histogram of time from waking to waiting again
+  wake.fd          Wakeups because a file handle was ready
+  wake.timer       Wakeups because a timer came due
+  wake.deadline    Wakeups at the time requested by a state machine
+  wake.interrupt   Wakeups with none of the above (like a signal)
+  service.spawn    Histogram of fork until the child calls exec (or until
+                   fork returns, on systems without a working vfork)
+  service.restart  Histogram of reaping a service until its automatic
+                   restart, including any restart interval delay
+  reap.orphans     Processes left behind by a service which were reaped and
+                   charged to it (with --subreaper)
+  reap.unowned     Reaped processes which did not belong to any service
+  conn.commands    Commands received by all controllers
+  conn.bytes_in    Bytes read from all controllers
+  conn.bytes_out   Bytes written to all controllers
+  conn.events      Broadcast events queued to all controllers
+  conn.overflows   Overflow events sent to all controllers
+  log.lost         Log messages lost because the log was blocked
+
+The "conn" events give the same totals for each connected controller, where
+ID is the number that daemonproxy uses for it in log messages.
+
+=cut
+*/
+
 /*----------------------------------------------------------------------------
  * End of events
 
@@ -1885,10 +3188,86 @@ token, but MESSAGE being arbitrary ascii text.
 =cut
 */
 
+/*
+=head2 BINARY PROTOCOL
+
+After "conn.protocol binary", commands and events are sent as binary records
+instead of lines of text.  Each record is the same list of fields as the
+text would have had, but with a length prefix instead of separators, so the
+client doesn't need to scan for TABs and newlines.  All integers are unsigned
+and in network byte order.
+
+  uint32  LENGTH       Length of the record, including this header
+  uint16  OPCODE       Number of the command or event, or 0
+  uint16  FIELD_COUNT  Number of fields that follow
+  FIELD_COUNT times:
+    uint16  FIELD_LEN
+    FIELD_LEN bytes of field
+
+If OPCODE is 0, the first field is the name of the command or event.  The
+values are still text (like decimal numbers), and fields still can't contain
+TAB, newline, or NUL, because daemonproxy converts records to and from the
+text protocol internally.  Records longer than the limit for commands (see
+conn.buffer) are discarded with an error, like long lines.  A record with a
+LENGTH less than 8 closes the connection.
+
+Opcodes are:
+
+  1 error               18 socket.create       35 terminate.exec_args
+  2 overflow            19 socket.delete       36 terminate.guard
+  3 signal              20 fd.pipe             37 stats
+  4 service.state       21 fd.open             38 service.requires
+  5 service.tags        22 fd.socket           39 service.after
+  6 service.args        23 fd.delete           40 service.ready_timeout
+  7 service.fds         24 fd.take             41 service.backoff
+  8 service.auto_up     25 chdir               42 service.priority
+  9 fd.state            26 exit                43 service.stop
+ 10 conn.resume         27 log.filter          44 service.stop_all
+ 11 conn.protocol       28 log.dest            45 service.limits
+ 12 batch.end           29 conn.event_timeout  46 service.usage
+ 13 echo                30 conn.subscribe      47 service.history
+ 14 statedump           31 conn.buffer         48 service.flap_limit
+ 15 service.start       32 batch.begin         49 service.flapping
+ 16 service.signal      33 signal.clear
+ 17 service.delete      34 terminate
+
+=cut
+*/
+
+// Enlarge a buffer to at least 'need' bytes, doubling its size up to 'max'.
+// Returns false if that exceeds max or if out of memory.
+static bool ctl_buf_grow(controller_t *ctl, char **buf, int *size, int max, int need) {
+	char *new_buf;
+	int new_size= *size > 0? *size : 256;
+	if (need > max)
+		return false;
+	while (new_size < need)
+		new_size= new_size > max/2? max : new_size*2;
+	if (!(new_buf= (char*) realloc(*buf, new_size))) {
+		log_error("controller[%d] can't grow buffer to %d bytes: %s", ctl->id, new_size, strerror(errno));
+		return false;
+	}
+	log_debug("controller[%d] buffer grew from %d to %d bytes", ctl->id, *size, new_size);
+	*buf= new_buf;
+	*size= new_size;
+	return true;
+}
+
+// Make room to read more of a command that doesn't fit in recv_buf.
+// This must not be called while a command in recv_buf is being processed.
+static bool ctl_recv_buf_grow(controller_t *ctl) {
+	return ctl_buf_grow(ctl, &ctl->recv_buf, &ctl->recv_buf_size, ctl->recv_buf_max, ctl->recv_buf_size + 1);
+}
+
+// Make room for 'need' bytes of unwritten data in send_buf.
+static bool ctl_send_buf_grow(controller_t *ctl, int need) {
+	return ctl_buf_grow(ctl, &ctl->send_buf, &ctl->send_buf_size, ctl->send_buf_max, need);
+}
+
 // Read more controller input from recv_fd
 bool ctl_read_more(controller_t *ctl) {
 	int n, e;
-	if (ctl->recv_fd < 0 || ctl->recv_buf_pos >= CONTROLLER_RECV_BUF_SIZE)
+	if (ctl->recv_fd < 0 || ctl->recv_buf_pos >= ctl->recv_buf_size)
 		return false;
 	if (ctl->recv_is_socket) {
 		char control_buf[64];
@@ -1897,7 +3276,7 @@ bool ctl_read_more(controller_t *ctl) {
 		memset(&msg, 0, sizeof(msg));
 		memset(&iov, 0, sizeof(iov));
 		iov.iov_base= ctl->recv_buf + ctl->recv_buf_pos;
-		iov.iov_len=  CONTROLLER_RECV_BUF_SIZE - ctl->recv_buf_pos;
+		iov.iov_len=  ctl->recv_buf_size - ctl->recv_buf_pos;
 		msg.msg_iov= &iov;
 		msg.msg_iovlen= 1;
 		msg.msg_control= control_buf;
@@ -1907,7 +3286,7 @@ bool ctl_read_more(controller_t *ctl) {
 			ctl_read_ancillary_fds(ctl, &msg);
 	}
 	else {
-		n= read(ctl->recv_fd, ctl->recv_buf + ctl->recv_buf_pos, CONTROLLER_RECV_BUF_SIZE - ctl->recv_buf_pos);
+		n= read(ctl->recv_fd, ctl->recv_buf + ctl->recv_buf_pos, ctl->recv_buf_size - ctl->recv_buf_pos);
 	}
 	if (n <= 0) {
 		e= errno;
@@ -1915,14 +3294,19 @@ bool ctl_read_more(controller_t *ctl) {
 		if (n == 0 || (e != EINTR && e != EAGAIN && e != EWOULDBLOCK)) {
 			if (n < 0)
 				log_error("read(client[%d])): %s", ctl->id, strerror(e));
-			// EOF.  Close file descriptor
-			close(ctl->recv_fd);
+			// EOF.  Close file descriptor, unless still in use by send_fd
+			if (ctl->recv_fd != ctl->send_fd) {
+				wake_cancel_fd(ctl->recv_fd);
+				close(ctl->recv_fd);
+			}
 			ctl->recv_fd= -1;
 		}
 		errno= e;
 		return false;
 	}
 	ctl->recv_buf_pos += n;
+	ctl->stat_bytes_in += n;
+	stats.ctl_bytes_in += n;
 	log_trace("controller[%d] read %d bytes (%d in recv buf)", ctl->id, n, ctl->recv_buf_pos);
 	return true;
 }
@@ -1951,81 +3335,366 @@ void ctl_read_ancillary_fds(controller_t *ctl, struct msghdr *msg) {
 	}
 }
 
+// Get the event name and the name of the object it is about from the text
+// of an event.
+static void ctl_event_split(strseg_t msg, strseg_t *event_out, strseg_t *name_out) {
+	if (msg.len && msg.data[msg.len-1] == '\n')
+		msg.len--;
+	if (!strseg_tok_next(&msg, '\t', event_out))
+		*event_out= STRSEG_LITERAL("");
+	if (!strseg_tok_next(&msg, '\t', name_out))
+		*name_out= STRSEG_LITERAL("");
+}
+
+// Match a NUL-terminated copy of str against a shell wildcard pattern.
+static bool ctl_filter_match(const char *pattern, strseg_t str) {
+	char buf[NAME_BUF_SIZE];
+	if (str.len >= sizeof(buf))
+		return false;
+	memcpy(buf, str.data, str.len);
+	buf[str.len]= '\0';
+	return fnmatch(pattern, buf, 0) == 0;
+}
+
+// Check whether an event passes the controller's filters (conn.subscribe).
+// See the description of that command for the rules.
+static bool ctl_subscribed(controller_t *ctl, strseg_t event, strseg_t name) {
+	const char *filter;
+	bool is_svc, is_fd, event_filtered= false, event_ok= false, name_filtered= false, name_ok= false;
+	service_t *svc= NULL;
+	strseg_t tags, tag;
+
+	if (!ctl->subscribe_buf[0])
+		return true;
+	is_svc= event.len > 8 && memcmp(event.data, "service.", 8) == 0;
+	is_fd= event.len > 3 && memcmp(event.data, "fd.", 3) == 0;
+	for (filter= ctl->subscribe_buf; *filter; filter += strlen(filter) + 1) {
+		if (strncmp(filter, "event:", 6) == 0) {
+			event_filtered= true;
+			if (!event_ok)
+				event_ok= ctl_filter_match(filter+6, event);
+		}
+		else if (strncmp(filter, "service:", 8) == 0) {
+			if (!is_svc) continue;
+			name_filtered= true;
+			if (!name_ok)
+				name_ok= ctl_filter_match(filter+8, name);
+		}
+		else if (strncmp(filter, "tag:", 4) == 0) {
+			if (!is_svc) continue;
+			name_filtered= true;
+			if (name_ok || !(svc || (svc= svc_by_name(name, false))))
+				continue;
+			tags= STRSEG(svc_get_tags(svc));
+			while (!name_ok && strseg_tok_next(&tags, '\t', &tag))
+				name_ok= ctl_filter_match(filter+4, tag);
+		}
+		else if (strncmp(filter, "fd:", 3) == 0) {
+			if (!is_fd) continue;
+			name_filtered= true;
+			if (!name_ok)
+				name_ok= ctl_filter_match(filter+3, name);
+		}
+	}
+	return (!event_filtered || event_ok) && (!name_filtered || name_ok);
+}
+
+// Move unwritten data to the start of send_buf
+static void ctl_send_buf_compact(controller_t *ctl) {
+	ctl->send_buf_pos -= ctl->send_buf_start;
+	memmove(ctl->send_buf, ctl->send_buf + ctl->send_buf_start, ctl->send_buf_pos);
+	ctl->send_buf_start= 0;
+}
+
+// Make room for len more bytes at the end of a controller's send buffer,
+// flushing or growing it if needed.  Returns a pointer to the free space,
+// or if it can't fit, sets the overflow flag and returns NULL.
+static char * ctl_send_buf_reserve(controller_t *ctl, int len) {
+	int p;
+	while (len >= ctl->send_buf_size - ctl->send_buf_pos) {
+		if (ctl->send_buf_start) {
+			ctl_send_buf_compact(ctl);
+			continue;
+		}
+		p= ctl->send_buf_pos;
+		ctl_flush_outbuf(ctl);
+		// check if flushing made any progress, else try growing the buffer
+		if (!ctl->send_buf_start && p == ctl->send_buf_pos
+			&& !ctl_send_buf_grow(ctl, ctl->send_buf_pos + len + 1)
+		) {
+			log_debug("client[%d]: can't write msg, %d > buffer free %d", ctl->id, len, ctl->send_buf_size - ctl->send_buf_pos);
+			ctl->send_overflow= true;
+			return NULL;
+		}
+	}
+	return ctl->send_buf + ctl->send_buf_pos;
+}
+
+// Append a message to a controller's send buffer, flushing to make room if
+// needed.  If it can't fit, set the overflow flag and return false.
+static bool ctl_write_buf(controller_t *ctl, strseg_t msg) {
+	char *p= ctl_send_buf_reserve(ctl, msg.len);
+	if (!p)
+		return false;
+	memcpy(p, msg.data, msg.len);
+	ctl->send_buf_pos += msg.len;
+	return true;
+}
+
+// Append a line of text to a controller's send buffer as a binary record.
+// The first field becomes the opcode, if it has one.  If it can't fit, set
+// the overflow flag and return false.
+static bool ctl_write_record(controller_t *ctl, strseg_t msg) {
+	strseg_t fields, field;
+	unsigned char *p;
+	uint32_t n32;
+	uint16_t n16;
+	int opcode, field_count= 0, size= CONTROLLER_RECORD_HEADER_SIZE;
+
+	if (msg.len && msg.data[msg.len-1] == '\n')
+		msg.len--;
+	fields= msg;
+	strseg_tok_next(&fields, '\t', &field);
+	if (!(opcode= ctl_opcode_by_name(field)))
+		fields= msg;
+	// measure it
+	for (msg= fields; strseg_tok_next(&msg, '\t', &field); field_count++) {
+		if (field.len > 0xFFFF) {
+			log_debug("client[%d]: can't write msg, field longer than %d", ctl->id, 0xFFFF);
+			ctl->send_overflow= true;
+			return false;
+		}
+		size += 2 + field.len;
+	}
+	if (!(p= (unsigned char*) ctl_send_buf_reserve(ctl, size)))
+		return false;
+	n32= htonl(size);
+	memcpy(p, &n32, 4);
+	n16= htons(opcode);
+	memcpy(p+4, &n16, 2);
+	n16= htons(field_count);
+	memcpy(p+6, &n16, 2);
+	p += CONTROLLER_RECORD_HEADER_SIZE;
+	while (strseg_tok_next(&fields, '\t', &field)) {
+		n16= htons(field.len);
+		memcpy(p, &n16, 2);
+		memcpy(p+2, field.data, field.len);
+		p += 2 + field.len;
+	}
+	ctl->send_buf_pos += size;
+	return true;
+}
+
+// Queue an event from the journal.  If nothing is waiting in send_buf, the
+// controller just takes a reference, and writes it straight from the journal
+// later.  Otherwise it gets copied to send_buf, after what is already there.
+static bool ctl_queue_event(controller_t *ctl, int64_t seq, strseg_t msg) {
+	bool ring_empty= ctl->send_ring_next > ctl->send_ring_end;
+	if (ctl->protocol_binary)
+		return ctl_write_record(ctl, msg);
+	if (ctl->send_buf_start == ctl->send_buf_pos
+		&& (ring_empty || ctl->send_ring_end == seq - 1)
+		&& ctl->send_ring_bytes + msg.len <= CONTROLLER_SEND_RING_MAX
+	) {
+		journal_ref(seq);
+		if (ring_empty)
+			ctl->send_ring_next= seq;
+		ctl->send_ring_end= seq;
+		ctl->send_ring_bytes += msg.len;
+		return true;
+	}
+	return ctl_write_buf(ctl, msg);
+}
+
+// Release the references to events the controller hasn't written
+static void ctl_send_ring_release(controller_t *ctl) {
+	while (ctl->send_ring_next <= ctl->send_ring_end)
+		journal_unref(ctl->send_ring_next++);
+	ctl->send_ring_ofs= 0;
+	ctl->send_ring_bytes= 0;
+}
+
+/* Drop a controller's connection from outside its own state machine.
+ *
+ * Both fds are closed and the pending input and output are discarded.  The
+ * controller object itself is left to ctl_state_close, which the next
+ * command boundary reaches now that recv_fd is gone.
+ */
+static void ctl_disconnect(controller_t *ctl) {
+	if (ctl->recv_fd >= 0) {
+		wake_cancel_fd(ctl->recv_fd);
+		close(ctl->recv_fd);
+	}
+	if (ctl->send_fd >= 0 && ctl->send_fd != ctl->recv_fd) {
+		wake_cancel_fd(ctl->send_fd);
+		close(ctl->send_fd);
+	}
+	ctl->recv_fd= ctl->send_fd= -1;
+	ctl->recv_buf_pos= 0;
+	ctl_send_ring_release(ctl);
+	ctl->send_buf_start= ctl->send_buf_pos= 0;
+	ctl->send_overflow= false;
+	wake->next= wake->now;
+}
+
+/** Copy journal events [send_ring_next, last] to the front of send_buf,
+ * releasing their references.
+ *
+ * This may take send_buf past send_buf_max, by at most the ring's size, but
+ * pool buffers can't grow at all.  Returns false if it doesn't fit.
+ */
+static bool ctl_send_ring_copy(controller_t *ctl, int64_t last) {
+	strseg_t event;
+	int64_t seq;
+	int len= 0, ofs;
+	for (seq= ctl->send_ring_next; seq <= last; seq++) {
+		journal_get(seq, &event);
+		len += event.len;
+	}
+	len -= ctl->send_ring_ofs;
+	ctl_send_buf_compact(ctl);
+	if (ctl->send_buf_pos + len > ctl->send_buf_size
+		&& (ctl_pool || !ctl_buf_grow(ctl, &ctl->send_buf, &ctl->send_buf_size,
+			ctl->send_buf_max + len, ctl->send_buf_pos + len))
+	)
+		return false;
+	memmove(ctl->send_buf + len, ctl->send_buf, ctl->send_buf_pos);
+	ctl->send_buf_pos += len;
+	for (ofs= 0; ctl->send_ring_next <= last; ofs += event.len) {
+		journal_get(ctl->send_ring_next, &event);
+		event.data += ctl->send_ring_ofs;
+		event.len -= ctl->send_ring_ofs;
+		memcpy(ctl->send_buf + ofs, event.data, event.len);
+		ctl->send_ring_bytes -= event.len;
+		ctl->send_ring_ofs= 0;
+		journal_unref(ctl->send_ring_next++);
+	}
+	return true;
+}
+
+/** Give up journal events that a controller hasn't written yet.
+ *
+ * The journal calls this when it needs the space.  If the controller has
+ * nothing in send_buf, it drops the events and gets an overflow, the same as
+ * if its send_buf had filled.  (If the start of an event was already written,
+ * the rest of it moves to send_buf so that the peer doesn't see half a line.)
+ * Anything in send_buf may include newer events, so then all of the events
+ * move to send_buf instead, to keep them in order and the sequence number of
+ * the overflow correct.  If they don't fit, the connection is closed rather
+ * than lose anything.
+ */
+void ctl_notify_journal_evict(int64_t seq) {
+	controller_t *ctl;
+	bool keep_all;
+	int i;
+	for (i= 0; i < ctl_list_count; i++) {
+		ctl= ctl_list[i];
+		if (!ctl->state_fn || seq < ctl->send_ring_next || seq > ctl->send_ring_end)
+			continue;
+		log_debug("controller[%d] fell behind the event journal", ctl->id);
+		keep_all= ctl->send_buf_pos > ctl->send_buf_start;
+		if (!ctl_send_ring_copy(ctl, keep_all? ctl->send_ring_end
+			: ctl->send_ring_ofs? ctl->send_ring_next : ctl->send_ring_next - 1)
+		) {
+			log_error("controller[%d] can't buffer events evicted from the journal, closing connection", ctl->id);
+			ctl_disconnect(ctl);
+			continue;
+		}
+		if (!keep_all) {
+			ctl->send_seq= ctl->send_ring_next - 1;
+			ctl_send_ring_release(ctl);
+			ctl->send_overflow= true;
+		}
+	}
+}
+
 // Try to write data to a controller, nonblocking.
 // Return true if the message was queued, or false if it can't be written.
-// If ctl is NULL, then all controllers with send_fd will be notified, assuming
+// If ctl is NULL, then the message is an event: it gets recorded in the
+//  journal, and all controllers with send_fd will be notified, assuming
 //  they aren't in an overflow condition.  Return value is always true when broadcasting.
 bool ctl_write(controller_t *single_dest, const char *fmt, ... ) {
-	controller_t * dest[CONTROLLER_MAX_CLIENTS];
-	int dest_n, i;
+	controller_t *dest;
+	strseg_t msg, type, name;
+	int64_t seq;
+	int i, buf_free;
+	va_list val;
 	
-	// Either send one message, or iterate all clients
-	if (single_dest) {
-		if (!single_dest->state_fn || single_dest->send_fd < 0 || single_dest->send_overflow)
-			return true;
-		dest[0]= single_dest;
-		dest_n= 1;
-	}
-	else {
-		dest_n= 0;
-		for (i= 0; i < CONTROLLER_MAX_CLIENTS; i++) {
-			if (!client[i].state_fn || client[i].send_fd < 0 || client[i].send_overflow)
+	if (!single_dest) {
+		va_start(val, fmt);
+		seq= journal_append(&msg, fmt, val);
+		va_end(val);
+		log_trace("event %lld to %d controllers", (long long) seq, ctl_list_count);
+		if (msg.data)
+			ctl_event_split(msg, &type, &name);
+		for (i= 0; i < ctl_list_count; i++) {
+			dest= ctl_list[i];
+			// Controllers that are replaying the journal will get to this event on their own
+			if (!dest->state_fn || dest->send_fd < 0 || dest->send_overflow || dest->send_replaying)
 				continue;
-			dest[dest_n++]= &client[i];
+			// A message too large for the journal is too large for the send buffer, too
+			if (!msg.data)
+				dest->send_overflow= true;
+			// Events the controller didn't subscribe to count as delivered
+			else if (!ctl_subscribed(dest, type, name))
+				dest->send_seq= seq;
+			else if (ctl_queue_event(dest, seq, msg)) {
+				dest->send_seq= seq;
+				dest->stat_events++;
+				stats.ctl_events++;
+				log_debug("client[%d] event: \"%.*s\"", dest->id, msg.len, msg.data);
+			}
 		}
-		if (!dest_n)
-			return true;
+		return true;
 	}
-	log_trace("write msg to %d controllers", dest_n);
-	
-	const char *msg_data= NULL;
-	int msg_len= -1;
-	int p, buf_free;
-	for (i= 0; i < dest_n; i++) {
-		check_space:
-		buf_free= CONTROLLER_SEND_BUF_SIZE - dest[i]->send_buf_pos;
-		// see if message fits in buffer
-		if (msg_len >= buf_free) {
-			// try flushing
-			p= dest[i]->send_buf_pos;
-			ctl_flush_outbuf(dest[i]);
-			// check if flushing made any progress
-			if (p != dest[i]->send_buf_pos)
-				goto check_space;
-			
-			log_debug("client[%d]: can't write msg, %d > buffer free %d", dest[i]->id, msg_len, buf_free);
-			// if it is a broadcast, we mark the client outbuf as having overflowed
-			//if (!single_dest)
-				dest[i]->send_overflow= true;
-		}
-		else {
-			// If this is the second+ time printing, we can memcpy from the first
-			if (msg_data)
-				memcpy(dest[i]->send_buf + dest[i]->send_buf_pos, msg_data, msg_len);
-			// else printf
-			else {
-				va_list val;
-				va_start(val, fmt);
-				msg_len= vsnprintf(
-					dest[i]->send_buf + dest[i]->send_buf_pos,
-					buf_free,
-					fmt, val);
-				va_end(val);
-				// This might be the first time we ran printf, in which case we haven't really
-				// tested msg_len yet.
-				if (msg_len >= buf_free) {
-					log_trace("first write attempt didn't fit");
-					goto check_space;
-				}
-				msg_data= dest[i]->send_buf + dest[i]->send_buf_pos; // save for next iter
+	
+	dest= single_dest;
+	if (!dest->state_fn || dest->send_fd < 0 || dest->send_overflow)
+		return true;
+	// For binary records, printf the text and then encode it
+	if (dest->protocol_binary) {
+		while (1) {
+			va_start(val, fmt);
+			msg.len= vsnprintf(ctl_fmt_buf, ctl_fmt_buf_size, fmt, val);
+			va_end(val);
+			if (msg.len < ctl_fmt_buf_size)
+				break;
+			if (!ctl_buf_grow(dest, &ctl_fmt_buf, &ctl_fmt_buf_size, INT_MAX, msg.len + 1)) {
+				dest->send_overflow= true;
+				return true;
 			}
-			dest[i]->send_buf_pos += msg_len;
-			log_debug("client[%d] event: \"%.*s\"", dest[i]->id, msg_len, msg_data);
 		}
+		msg.data= ctl_fmt_buf;
+		if (ctl_write_record(dest, msg))
+			log_debug("client[%d] event: \"%.*s\"", dest->id, msg.len, msg.data);
+		return true;
 	}
-	
-	// return true if was a broadcast, or if succeeded
-	return true;//!single_dest || msg_data;
+	// printf directly into the buffer, since it usually fits
+	while (1) {
+		buf_free= dest->send_buf_size - dest->send_buf_pos;
+		va_start(val, fmt);
+		msg.data= dest->send_buf + dest->send_buf_pos;
+		msg.len= vsnprintf(dest->send_buf + dest->send_buf_pos, buf_free, fmt, val);
+		va_end(val);
+		if (msg.len < buf_free) {
+			dest->send_buf_pos += msg.len;
+			log_debug("client[%d] event: \"%.*s\"", dest->id, msg.len, msg.data);
+			return true;
+		}
+		if (dest->send_buf_start) {
+			ctl_send_buf_compact(dest);
+			continue;
+		}
+		// try flushing, and check if it made any progress, else try growing
+		i= dest->send_buf_pos;
+		ctl_flush_outbuf(dest);
+		if (!dest->send_buf_start && i == dest->send_buf_pos
+			&& !ctl_send_buf_grow(dest, dest->send_buf_pos + msg.len + 1))
+			break;
+	}
+	log_debug("client[%d]: can't write msg, %d > buffer free %d", dest->id, msg.len, buf_free);
+	dest->send_overflow= true;
+	return true;
 }
 
 void create_missing_dirs(char *path) {
@@ -2037,66 +3706,147 @@ void create_missing_dirs(char *path) {
 	}
 }
 
-// Try to flush the output buffer (nonblocking)
+// Advance past n bytes written from the journal events and then send_buf
+static void ctl_send_consume(controller_t *ctl, int n) {
+	strseg_t event;
+	int rem;
+	while (n > 0 && ctl->send_ring_next <= ctl->send_ring_end) {
+		journal_get(ctl->send_ring_next, &event);
+		rem= event.len - ctl->send_ring_ofs;
+		if (n < rem) {
+			ctl->send_ring_ofs += n;
+			ctl->send_ring_bytes -= n;
+			return;
+		}
+		n -= rem;
+		ctl->send_ring_bytes -= rem;
+		ctl->send_ring_ofs= 0;
+		journal_unref(ctl->send_ring_next++);
+	}
+	ctl->send_buf_start += n;
+	if (ctl->send_buf_start == ctl->send_buf_pos)
+		ctl->send_buf_start= ctl->send_buf_pos= 0;
+}
+
+// Try to flush the output (nonblocking), which is any events waiting in the
+// journal followed by send_buf, written together with writev.
 // Return true if flushed completely.  false otherwise.
 static bool ctl_flush_outbuf(controller_t *ctl) {
-	int n, eol;
-	while (ctl->send_buf_pos) {
-		// find end of last line in buffer
-		for (eol= ctl->send_buf_pos-1; eol >= 0; eol--)
-			if (ctl->send_buf[eol] == '\n')
-				break;
-		log_trace("controller[%d] write buffer %d bytes pending, final eol at %d, %s",
-			ctl->id, ctl->send_buf_pos, eol, ctl->send_overflow? "(overflow flag set)" : "");
-		// if no send_fd, discard buffer
-		if (ctl->send_fd == -1)
-			ctl->send_buf_pos= 0;
-		// if no eol, can't continue
-		// This prevents partial lines from being written, which could get
-		// interrupted by an overflow condition and result in the controller
-		// script seeing a half-event.
-		else if (eol < 0) {
-			// if overflow is set, discard partial line.
-			if (ctl->send_overflow) ctl->send_buf_pos= 0;
-			else return false;
-		}
-		// else write as much as we can (on nonblocking fd)
-		else {
-			n= write(ctl->send_fd, ctl->send_buf, eol+1);
-			if (n > 0) {
-				log_trace("controller[%d] flushed %d bytes", ctl->id, n);
-				ctl->send_buf_pos -= n;
-				ctl->send_blocked_ts= 0;
-				memmove(ctl->send_buf, ctl->send_buf + n, ctl->send_buf_pos);
+	struct iovec iov[CONTROLLER_WRITEV_MAX];
+	strseg_t event;
+	int64_t seq;
+	int n, eol, iov_n;
+	while (ctl_send_pending(ctl)) {
+		log_trace("controller[%d] write pending: %d bytes in journal, %d in buffer %s",
+			ctl->id, ctl->send_ring_bytes, ctl->send_buf_pos - ctl->send_buf_start, ctl->send_overflow? "(overflow flag set)" : "");
+		// if no send_fd, discard everything
+		if (ctl->send_fd == -1) {
+			ctl_send_ring_release(ctl);
+			ctl->send_buf_start= ctl->send_buf_pos= 0;
+			break;
+		}
+		iov_n= 0;
+		for (seq= ctl->send_ring_next; seq <= ctl->send_ring_end && iov_n < CONTROLLER_WRITEV_MAX; seq++) {
+			journal_get(seq, &event); // can't fail, while we hold a reference
+			if (seq == ctl->send_ring_next) {
+				event.data += ctl->send_ring_ofs;
+				event.len -= ctl->send_ring_ofs;
 			}
-			else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
-				// mark the time when this happened.  We clear this next time a write succeeds
-				// If the write blocks for too long, ctl_run will perform timeout actions
-				if (!ctl->send_blocked_ts)
-					ctl->send_blocked_ts= wake->now? wake->now : 1; // timestamp must be nonzero
-				return false;
-			} else {
-				// fatal error
-				log_debug("controller[%d] outbuf write failed: %s", ctl->id, strerror(errno));
+			// consecutive events are usually adjacent in the journal
+			if (iov_n && (char*) iov[iov_n-1].iov_base + iov[iov_n-1].iov_len == event.data)
+				iov[iov_n-1].iov_len += event.len;
+			else {
+				iov[iov_n].iov_base= (char*) event.data;
+				iov[iov_n].iov_len= event.len;
+				iov_n++;
+			}
+		}
+		// Then send_buf, if there was room for all the events.
+		if (seq > ctl->send_ring_end && iov_n < CONTROLLER_WRITEV_MAX) {
+			// find end of last line in buffer (binary records are always whole)
+			if (ctl->protocol_binary)
+				eol= ctl->send_buf_pos-1;
+			else for (eol= ctl->send_buf_pos-1; eol >= ctl->send_buf_start; eol--)
+				if (ctl->send_buf[eol] == '\n')
+					break;
+			if (eol >= ctl->send_buf_start) {
+				iov[iov_n].iov_base= ctl->send_buf + ctl->send_buf_start;
+				iov[iov_n].iov_len= eol + 1 - ctl->send_buf_start;
+				iov_n++;
+			}
+			// if no eol, can't continue
+			// This prevents partial lines from being written, which could get
+			// interrupted by an overflow condition and result in the controller
+			// script seeing a half-event.
+			else if (!iov_n) {
+				// if overflow is set, discard partial line.
+				if (!ctl->send_overflow)
+					return false;
+				ctl->send_buf_start= ctl->send_buf_pos= 0;
+				continue;
+			}
+		}
+		// write as much as we can (on nonblocking fd)
+		n= writev(ctl->send_fd, iov, iov_n);
+		if (n > 0) {
+			log_trace("controller[%d] flushed %d bytes", ctl->id, n);
+			ctl->stat_bytes_out += n;
+			stats.ctl_bytes_out += n;
+			ctl_send_consume(ctl, n);
+			ctl->send_blocked_ts= 0;
+			wake_timer_cancel(&ctl->write_timer);
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			// mark the time when this happened.  We clear this next time a write succeeds
+			// If the write blocks for too long, ctl_run will perform timeout actions
+			if (!ctl->send_blocked_ts)
+				ctl->send_blocked_ts= wake->now? wake->now : 1; // timestamp must be nonzero
+			return false;
+		} else {
+			// fatal error
+			log_debug("controller[%d] outbuf write failed: %s", ctl->id, strerror(errno));
+			// If the handle is shared with recv_fd, leave it open so that any
+			// commands the peer sent before it went away still get read.
+			if (ctl->send_fd != ctl->recv_fd) {
+				wake_cancel_fd(ctl->send_fd);
 				close(ctl->send_fd);
-				ctl->send_fd= -1;
-				return true;  // the buffer is now "flushed" for all practical purposes
 			}
+			ctl->send_fd= -1;
+			ctl_send_ring_release(ctl);
+			ctl->send_buf_start= ctl->send_buf_pos= 0;
+			return true;  // the buffer is now "flushed" for all practical purposes
 		}
 	}
 	// If we just finished emptying the buffer, and the overflow flag is set,
 	// then send the overflow message.
+	// Clients which use conn.resume also get the sequence number to resume from.
 	if (ctl->send_overflow) {
-		memcpy(ctl->send_buf, "overflow\n", 9);
-		ctl->send_buf_pos= 9;
+		ctl->send_buf_pos= ctl->send_overflow_seq
+			? snprintf(ctl->send_buf, ctl->send_buf_size, "overflow\t%lld\n", (long long) ctl->send_seq)
+			: snprintf(ctl->send_buf, ctl->send_buf_size, "overflow\n");
 		ctl->send_overflow= false;
+		ctl->send_replaying= false; // controller must ask again
+		ctl->stat_overflows++;
+		stats.ctl_overflows++;
+		// send_buf was empty, so encoding from a copy of it can't overflow
+		if (ctl->protocol_binary) {
+			char msg[32];
+			strseg_t text= { msg, ctl->send_buf_pos };
+			memcpy(msg, ctl->send_buf, ctl->send_buf_pos);
+			ctl->send_buf_pos= 0;
+			ctl_write_record(ctl, text);
+		}
 		return ctl_flush_outbuf(ctl);
 	}
 	return true;
 }
 
+// The buffer is ready if the largest write would fit, after growing send_buf
+// as far as it is allowed.  Binary records can be up to about twice the size
+// of the text.
 static bool ctl_out_buf_ready(controller_t *ctl) {
-	return ctl->send_buf_pos <= (CONTROLLER_SEND_BUF_SIZE-CONTROLLER_LARGEST_WRITE)
+	int limit= ctl->send_buf_max > ctl->send_buf_size? ctl->send_buf_max : ctl->send_buf_size;
+	return ctl->send_buf_pos - ctl->send_buf_start <= limit - CONTROLLER_LARGEST_WRITE * (ctl->protocol_binary? 2 : 1)
 		|| ctl->send_overflow // if overflow, just allow writes to be discarded
 		|| ctl_flush_outbuf(ctl);
 }
@@ -0,0 +1,215 @@
+// File generated by ../scripts/generate_controller_data.pl
+
+const char *ctl_get_state_name(ctl_state_fn_t *fn) {
+	if (fn == ctl_state_next_command) return "ctl_state_next_command";
+	if (fn == ctl_state_run_command) return "ctl_state_run_command";
+	if (fn == ctl_state_end_command) return "ctl_state_end_command";
+	if (fn == ctl_state_close) return "ctl_state_close";
+	if (fn == ctl_state_free) return "ctl_state_free";
+	if (fn == ctl_state_dump_fds) return "ctl_state_dump_fds";
+	if (fn == ctl_state_dump_services) return "ctl_state_dump_services";
+	if (fn == ctl_state_dump_signals) return "ctl_state_dump_signals";
+	if (fn == ctl_state_dump_stats) return "ctl_state_dump_stats";
+	if (fn == ctl_state_dump_history) return "ctl_state_dump_history";
+	if (fn == ctl_state_replay) return "ctl_state_replay";
+	return "invalid state";
+}
+
+// 42 commands
+// table size is 128, mul is 346, shift is 6
+
+int ctl_command_hash_func(strseg_t name) {
+	uint32_t x= 0;
+	int i= 0;
+	for (i= 0; i < name.len; i++)
+		x= ((x * 346) >> 6) + (name.data[i] & 0xFF);
+	
+	return x & 127;
+}
+
+const ctl_command_table_entry_t ctl_command_table[]= {
+	{ { NULL, 0 }, NULL },
+	{ { "service.stop", 12}, ctl_cmd_svc_stop },
+	{ { "statedump", 9}, ctl_cmd_statedump },
+	{ { "service.after", 13}, ctl_cmd_svc_after },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "fd.socket", 9}, ctl_cmd_fd_socket },
+	{ { NULL, 0 }, NULL },
+	{ { "batch.end", 9}, ctl_cmd_batch_end },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "socket.delete", 13}, ctl_cmd_socket_delete },
+	{ { NULL, 0 }, NULL },
+	{ { "service.stop_all", 16}, ctl_cmd_svc_stop_all },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "log.filter", 10}, ctl_cmd_log_filter },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "conn.protocol", 13}, ctl_cmd_conn_protocol },
+	{ { NULL, 0 }, NULL },
+	{ { "conn.buffer", 11}, ctl_cmd_conn_buffer },
+	{ { NULL, 0 }, NULL },
+	{ { "service.auto_up", 15}, ctl_cmd_svc_auto_up },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "fd.take", 7}, ctl_cmd_fd_take },
+	{ { NULL, 0 }, NULL },
+	{ { "conn.event_timeout", 18}, ctl_cmd_event_pipe_timeout },
+	{ { NULL, 0 }, NULL },
+	{ { "service.requires", 16}, ctl_cmd_svc_requires },
+	{ { NULL, 0 }, NULL },
+	{ { "service.delete", 14}, ctl_cmd_svc_delete },
+	{ { "socket.create", 13}, ctl_cmd_socket_create },
+	{ { "batch.begin", 11}, ctl_cmd_batch_begin },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "service.fds", 11}, ctl_cmd_svc_fds },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "fd.open", 7}, ctl_cmd_fd_open },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "exit", 4}, ctl_cmd_exit },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "service.limits", 14}, ctl_cmd_svc_limits },
+	{ { "service.tags", 12}, ctl_cmd_svc_tags },
+	{ { "service.signal", 14}, ctl_cmd_svc_signal },
+	{ { NULL, 0 }, NULL },
+	{ { "fd.pipe", 7}, ctl_cmd_fd_pipe },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "echo", 4}, ctl_cmd_echo },
+	{ { NULL, 0 }, NULL },
+	{ { "terminate.exec_args", 19}, ctl_cmd_terminate_exec_args },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "service.history", 15}, ctl_cmd_svc_history },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "service.start", 13}, ctl_cmd_svc_start },
+	{ { "stats", 5}, ctl_cmd_stats },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "signal.clear", 12}, ctl_cmd_signal_clear },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "terminate", 9}, ctl_cmd_terminate },
+	{ { NULL, 0 }, NULL },
+	{ { "conn.resume", 11}, ctl_cmd_conn_resume },
+	{ { NULL, 0 }, NULL },
+	{ { "fd.delete", 9}, ctl_cmd_fd_delete },
+	{ { NULL, 0 }, NULL },
+	{ { "conn.subscribe", 14}, ctl_cmd_conn_subscribe },
+	{ { "service.priority", 16}, ctl_cmd_svc_priority },
+	{ { NULL, 0 }, NULL },
+	{ { "service.backoff", 15}, ctl_cmd_svc_backoff },
+	{ { "chdir", 5}, ctl_cmd_chdir },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "service.args", 12}, ctl_cmd_svc_args },
+	{ { NULL, 0 }, NULL },
+	{ { "service.flap_limit", 18}, ctl_cmd_svc_flap_limit },
+	{ { "terminate.guard", 15}, ctl_cmd_terminate_guard },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "service.ready_timeout", 21}, ctl_cmd_svc_ready_timeout },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { "log.dest", 8}, ctl_cmd_log_dest },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ { NULL, 0 }, NULL },
+	{ {NULL, 0}, NULL}
+};
+
+// 49 opcodes, from the list in BINARY PROTOCOL
+
+const strseg_t ctl_opcode_names[]= {
+	{ NULL, 0 },
+	{ "error", 5 },
+	{ "overflow", 8 },
+	{ "signal", 6 },
+	{ "service.state", 13 },
+	{ "service.tags", 12 },
+	{ "service.args", 12 },
+	{ "service.fds", 11 },
+	{ "service.auto_up", 15 },
+	{ "fd.state", 8 },
+	{ "conn.resume", 11 },
+	{ "conn.protocol", 13 },
+	{ "batch.end", 9 },
+	{ "echo", 4 },
+	{ "statedump", 9 },
+	{ "service.start", 13 },
+	{ "service.signal", 14 },
+	{ "service.delete", 14 },
+	{ "socket.create", 13 },
+	{ "socket.delete", 13 },
+	{ "fd.pipe", 7 },
+	{ "fd.open", 7 },
+	{ "fd.socket", 9 },
+	{ "fd.delete", 9 },
+	{ "fd.take", 7 },
+	{ "chdir", 5 },
+	{ "exit", 4 },
+	{ "log.filter", 10 },
+	{ "log.dest", 8 },
+	{ "conn.event_timeout", 18 },
+	{ "conn.subscribe", 14 },
+	{ "conn.buffer", 11 },
+	{ "batch.begin", 11 },
+	{ "signal.clear", 12 },
+	{ "terminate", 9 },
+	{ "terminate.exec_args", 19 },
+	{ "terminate.guard", 15 },
+	{ "stats", 5 },
+	{ "service.requires", 16 },
+	{ "service.after", 13 },
+	{ "service.ready_timeout", 21 },
+	{ "service.backoff", 15 },
+	{ "service.priority", 16 },
+	{ "service.stop", 12 },
+	{ "service.stop_all", 16 },
+	{ "service.limits", 14 },
+	{ "service.usage", 13 },
+	{ "service.history", 15 },
+	{ "service.flap_limit", 18 },
+	{ "service.flapping", 16 },
+};
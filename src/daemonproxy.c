@@ -10,9 +10,6 @@ bool     main_terminate= false;
 int      main_exitcode= 0;
 controller_t *interactive_controller;
 
-wake_t   main_wake; // global used for tracking things that should wake the main loop
-wake_t  *wake= &main_wake; // this is exported to other modules
-
 const char * copyright=
 	"Copyright (C) 2014-2015  Michael Conrad";
 const char * license=
@@ -30,20 +27,6 @@ static void fd_to_dev_null(fd_t *fd);
 static void daemonize();
 
 int main(int argc, char** argv) {
-	int wstat, ret;
-	pid_t pid;
-	struct timeval tv;
-	service_t *svc;
-	
-	// initialize wake structure, which is owned by main
-	memset(wake, 0, sizeof(*wake));
-	// just in case, but probably redundant
-	FD_ZERO(&wake->fd_read);
-	FD_ZERO(&wake->fd_write);
-	FD_ZERO(&wake->fd_err);
-	FD_ZERO(&wake->fd_ready_read);
-	FD_ZERO(&wake->fd_ready_write);
-	FD_ZERO(&wake->fd_ready_err);
 	// wake structure holds current time so we don't keep calling clock_gettime()
 	wake->now= gettime_mon_frac();
 	
@@ -51,6 +34,7 @@ int main(int argc, char** argv) {
 	svc_init();
 	fd_init();
 	ctl_init();
+	journal_init();
 
 	// Special defaults when running as init
 	if (getpid() == 1) {
@@ -77,6 +61,11 @@ int main(int argc, char** argv) {
 	if (!register_open_fds())
 		fatal(EXIT_BAD_OPTIONS, "Not enough FD objects to register all open FDs");
 
+	// Choose the event backend for the main loop
+	// Do this AFTER registering all open FDs, because it might create an fd
+	if (!wake_init(opt_event_backend))
+		fatal(EXIT_INVALID_ENVIRONMENT, "Can't initialize event backend");
+
 	// Set up signal handlers and signal mask and signal self-pipe
 	// Do this AFTER registering all open FDs, because it creates a pipe
 	sig_init();
@@ -86,7 +75,17 @@ int main(int argc, char** argv) {
 		if (!svc_preallocate(opt_svc_pool_count, opt_svc_pool_size_each))
 			fatal(EXIT_INVALID_ENVIRONMENT, "Unable to preallocate service objects");
 
+	// Adopt orphaned processes and set up cgroups, before any service can start
+	if (opt_subreaper)
+		svc_init_subreaper();
+	if (opt_cgroup)
+		svc_init_cgroup();
+
 	// Initialize controller object pool
+	if (opt_ctl_pool_count > 0)
+		if (!ctl_preallocate(opt_ctl_pool_count))
+			fatal(EXIT_INVALID_ENVIRONMENT, "Unable to preallocate controller objects");
+
 	control_socket_init();
 
 	if (opt_socket_path && !control_socket_start(STRSEG(opt_socket_path)))
@@ -120,23 +119,17 @@ int main(int argc, char** argv) {
 	while (!main_terminate) {
 		// set our wait parameters so other methods can inject new wake reasons
 		wake->next= wake->now + (200LL<<32); // wake at least every 200 seconds
-		wake->max_fd= -1;
 		
 		log_run();
 
 		// collect new signals since last iteration and set read-wake on signal fd
 		sig_run();
 		
+		// fire any timers that are due, possibly activating services
+		wake_run_timers();
+		
 		// reap all zombies, possibly waking services
-		while ((pid= waitpid(-1, &wstat, WNOHANG)) > 0) {
-			log_trace("waitpid found pid = %d", (int)pid);
-			if ((svc= svc_by_pid(pid)))
-				svc_handle_reaped(svc, wstat);
-			else
-				log_trace("pid does not belong to any service");
-		}
-		if (pid < 0)
-			log_trace("waitpid: %s", strerror(errno));
+		svc_reap_children();
 		
 		// run state machine of each service that is active.
 		svc_run_active();
@@ -151,37 +144,7 @@ int main(int argc, char** argv) {
 		
 		// Wait until an event or the next time a state machine needs to run
 		// (state machines edit wake.next)
-		wake->now= gettime_mon_frac();
-		if (wake->next - wake->now > 0) {
-			tv.tv_sec= (long)((wake->next - wake->now) >> 32);
-			tv.tv_usec= (long)((((wake->next - wake->now)&0xFFFFFFFFLL) * 1000000) >> 32);
-			log_trace("wait up to %d.%d sec", tv.tv_sec, tv.tv_usec);
-		}
-		else
-			tv.tv_sec= tv.tv_usec= 0;
-		
-		ret= select(wake->max_fd+1, &wake->fd_read, &wake->fd_write, &wake->fd_err, &tv);
-		if (ret < 0) {
-			// shouldn't ever fail, but if not EINTR, at least log it and prevent
-			// looping too fast
-			if (errno != EINTR) {
-				log_error("select: %s", strerror(errno));
-				usleep(500000);
-			}
-		}
-
-		// We want to keep track of the ready-sets separate from the wait-for sets,
-		// so that the state machines can check whether they've decided to wake on
-		// a file descriptor, and so we don't accidentally forget to clear a bit
-		// in the case we don't want to wake on it again.
-		memcpy(&wake->fd_ready_read,  &wake->fd_read,  sizeof(fd_set));
-		memcpy(&wake->fd_ready_write, &wake->fd_write, sizeof(fd_set));
-		memcpy(&wake->fd_ready_err,   &wake->fd_err,   sizeof(fd_set));
-		FD_ZERO(&wake->fd_read);
-		FD_ZERO(&wake->fd_write);
-		FD_ZERO(&wake->fd_err);
-
-		wake->now= gettime_mon_frac();
+		wake_wait();
 	}
 	
 	if (opt_exec_on_exit)
@@ -274,6 +237,7 @@ static void daemonize() {
 			log_trace("fd %d %s fdnum is %d", i, fd? fd_get_name(fd) : "null", fd? fd_get_fdnum(fd) : -1);
 			if (fd && (fdnum= fd_get_fdnum(fd)) == i) {
 				fd_to_dev_null(fd);
+				wake_cancel_fd(i);
 				close(i);
 			}
 		}
@@ -11,6 +11,8 @@ typedef struct fd_s fd_t;
 
 struct service_s;
 typedef struct service_s service_t;
+struct svc_usage_s;
+typedef struct svc_usage_s svc_usage_t;
 
 struct controller_s;
 typedef struct controller_s controller_t;
@@ -45,6 +47,109 @@ bool strseg_parse_size(strseg_t *string, int64_t *val);
 bool strseg_parse_sockaddr(strseg_t *string, int addr_family, struct sockaddr_storage *a_out, int *len_out);
 
 
+//----------------------------------------------------------------------------
+// name-hash.c interface
+
+// An unordered index of named objects, for fast lookup by name.
+// The key function returns the object's name, which must not change while indexed.
+typedef strseg_t name_hash_key_fn_t(void *obj);
+
+typedef struct name_hash_entry_s {
+	uint32_t hash;
+	void *obj;                 // NULL for empty slot
+} name_hash_entry_t;
+
+typedef struct name_hash_s {
+	name_hash_entry_t *table;
+	int count, limit;          // limit is 0 or a power of 2
+	bool fixed;                // table was preallocated, and can't grow
+	name_hash_key_fn_t *key_fn;
+} name_hash_t;
+
+uint32_t name_hash_func(strseg_t name);
+void name_hash_init(name_hash_t *h, name_hash_key_fn_t *key_fn);
+
+// Make room for 'count' objects (total) so that adding them never allocates
+bool name_hash_reserve(name_hash_t *h, int count);
+
+// Make room for 'count' objects, and don't allow growth beyond that
+bool name_hash_preallocate(name_hash_t *h, int count);
+
+bool name_hash_add(name_hash_t *h, void *obj);
+void * name_hash_find(name_hash_t *h, strseg_t name);
+void name_hash_remove(name_hash_t *h, void *obj);
+
+//----------------------------------------------------------------------------
+// journal.c interface
+
+void journal_init();
+
+// Format an event into the journal, returning its sequence number
+int64_t journal_append(strseg_t *event_out, const char *fmt, va_list val);
+
+// Look up a previous event.  Returns false if it is no longer available.
+bool journal_get(int64_t seq, strseg_t *event_out);
+
+// Reference counts of controllers waiting to send an event
+void journal_ref(int64_t seq);
+void journal_unref(int64_t seq);
+
+// Range of sequence numbers currently in the journal is [first, next)
+int64_t journal_get_first_seq();
+int64_t journal_get_next_seq();
+
+//----------------------------------------------------------------------------
+// stats.c interface
+
+// Durations are recorded in microseconds.  Bucket 0 counts durations under
+// 1us, and bucket N counts [2^(N-1), 2^N) us.
+typedef struct stats_hist_s {
+	int64_t count, sum, max;
+	int64_t bucket[STATS_HIST_BUCKETS];
+} stats_hist_t;
+
+typedef struct stats_s {
+	int64_t loop_iterations;
+	stats_hist_t loop_busy;    // time from waking up to waiting again
+	int64_t wake_fd,           // reasons the main loop woke up
+		wake_timer,
+		wake_deadline,
+		wake_interrupt;
+	stats_hist_t spawn;        // fork until exec (or until fork returns)
+	stats_hist_t restart;      // reap until the auto-restart is forked
+	int64_t reap_orphans,      // orphans reaped and charged to a service
+		reap_unowned;          // reaped children that no service claimed
+	int64_t ctl_commands,      // totals for all controllers
+		ctl_bytes_in,
+		ctl_bytes_out,
+		ctl_events,
+		ctl_overflows;
+	int64_t log_lost;
+} stats_t;
+
+extern stats_t stats;
+
+// Add a duration (32.32 fixed point) to a histogram
+static inline void stats_hist_add(stats_hist_t *h, int64_t duration) {
+	int64_t usec= duration > 0? ((duration >> 12) * 1000000) >> 20 : 0;
+	int b= usec? 64 - __builtin_clzll(usec) : 0;
+	h->bucket[b < STATS_HIST_BUCKETS? b : STATS_HIST_BUCKETS-1]++;
+	h->count++;
+	h->sum += usec;
+	if (usec > h->max)
+		h->max= usec;
+}
+
+extern const int stats_count;
+
+// Iterate the statistics by index.  Returns false past the last one.
+// Each one is either a counter (*value_out) or a histogram (*hist_out).
+bool stats_get(int idx, const char **name_out, int64_t *value_out, stats_hist_t **hist_out);
+
+// Format the histogram buckets as comma-separated counts, omitting trailing
+// zeroes, or "-" if empty.
+void stats_hist_format(stats_hist_t *h, char *buf, int buf_size);
+
 //----------------------------------------------------------------------------
 // daemonproxy.c interface
 
@@ -63,9 +168,31 @@ int64_t gettime_mon_frac();
 // says otherwise.
 void fatal(int exitcode, const char * msg, ...);
 
+extern bool    main_terminate;
+extern int     main_exitcode;
+
+// callback type function so main can handle the termination of a controller
+void main_notify_controller_freed(controller_t *ctl);
+
+// util function to perform "mkdir -p"
+void create_missing_dirs(char *path);
+
+
+//----------------------------------------------------------------------------
+// wake.c interface
+
+#define WAKE_READ   1
+#define WAKE_WRITE  2
+#define WAKE_ERR    4
+#define WAKE_ANY    7
+#define WAKE_LISTED 0x80 // internal: fd is already in want_list
+
 typedef struct wake_s {
-	fd_set fd_read, fd_write, fd_err, fd_ready_read, fd_ready_write, fd_ready_err;
-	int max_fd;
+	uint8_t *fd_want;  // per-fd WAKE_* bits that the main loop should wait for
+	uint8_t *fd_ready; // per-fd WAKE_* bits that were reported by the last wait
+	int fd_limit;      // allocated length of fd_want / fd_ready
+	int *want_list, want_count;   // fds which were given wake_on_* this iteration
+	int *ready_list, ready_count; // fds which have nonzero fd_ready
 	// times might wrap! (in theory) never compare times with > >= < <=, only differences.
 	int64_t now;  // current time according to main loop
 	int64_t next; // time when we next need to process something
@@ -73,54 +200,98 @@ typedef struct wake_s {
 
 extern wake_t *wake;
 
+// Choose an event backend by name ("epoll", "select"), or the best available if NULL
+bool wake_init(const char *backend_name);
+const char * wake_backend_name();
+
+// Block until one of the requested fds is ready, or until wake->next
+void wake_wait();
+
+// Grow the per-fd arrays to hold at least this fd (called from wake_want_fd)
+void wake_fd_grow(int fd);
+
+// Remove any interest in (and readiness of) fd.  Call before closing an fd
+// that might have been given to wake_on_*.
+void wake_cancel_fd(int fd);
+
+// Wait for WAKE_* bits on fd on every iteration until wake_cancel_fd, instead
+// of calling wake_on_* each time.  Readiness is reported with woke_on_*.
+// Returns false if the backend can't watch this fd.
+bool wake_watch_fd(int fd, int bits);
+
+struct wake_timer_s;
+typedef void wake_timer_fn_t(struct wake_timer_s *timer);
+
+// A timer is embedded in the object it belongs to.  Callback may be NULL if
+// the only purpose is to wake the main loop.
+typedef struct wake_timer_s {
+	int64_t when;
+	int heap_idx;              // position in the timer heap, or -1 if not pending
+	wake_timer_fn_t *callback;
+	void *obj;                 // the object that owns this timer
+} wake_timer_t;
+
+void wake_timer_init(wake_timer_t *t, wake_timer_fn_t *callback, void *obj);
+
+// Make room for 'count' more timers (added to any previous reservations),
+// so that setting them never allocates
+bool wake_timer_reserve(int count);
+
+// Schedule (or re-schedule) a timer
+void wake_timer_set(wake_timer_t *t, int64_t when);
+
+// Un-schedule a timer, if pending
+void wake_timer_cancel(wake_timer_t *t);
+
+static inline bool wake_timer_pending(wake_timer_t *t) {
+	return t->heap_idx >= 0;
+}
+
+// Run the callback of each timer which has come due
+void wake_run_timers();
+
+static inline void wake_want_fd(int fd, int bits) {
+	if (fd >= wake->fd_limit)
+		wake_fd_grow(fd);
+	if (!(wake->fd_want[fd] & WAKE_LISTED))
+		wake->want_list[wake->want_count++]= fd;
+	wake->fd_want[fd] |= bits | WAKE_LISTED;
+}
+
 static inline void wake_on_readable(int fd) {
-	FD_SET(fd, &wake->fd_read);
-	FD_SET(fd, &wake->fd_err);
-	if (fd > wake->max_fd)
-		wake->max_fd= fd;
+	wake_want_fd(fd, WAKE_READ|WAKE_ERR);
 }
 
 static inline void wake_on_writeable(int fd) {
-	FD_SET(fd, &wake->fd_write);
-	FD_SET(fd, &wake->fd_err);
-	if (fd > wake->max_fd)
-		wake->max_fd= fd;
+	wake_want_fd(fd, WAKE_WRITE|WAKE_ERR);
 }
 
 static inline void wake_on_writeable_only(int fd) {
-	FD_SET(fd, &wake->fd_write);
-	if (fd > wake->max_fd)
-		wake->max_fd= fd;
+	wake_want_fd(fd, WAKE_WRITE);
 }
 
 static inline void wake_on_fd(int fd) {
-	FD_SET(fd, &wake->fd_read);
-	FD_SET(fd, &wake->fd_write);
-	FD_SET(fd, &wake->fd_err);
-	if (fd > wake->max_fd)
-		wake->max_fd= fd;
+	wake_want_fd(fd, WAKE_ANY);
 }
 
-static inline void wake_cancel_fd(int fd) {
-	FD_CLR(fd, &wake->fd_read);
-	FD_CLR(fd, &wake->fd_write);
-	FD_CLR(fd, &wake->fd_err);
+static inline int woke_on_bits(int fd) {
+	return fd >= 0 && fd < wake->fd_limit? wake->fd_ready[fd] : 0;
 }
 
 static inline bool woke_on_readable(int fd) {
-	return FD_ISSET(fd, &wake->fd_ready_read) || FD_ISSET(fd, &wake->fd_ready_err);
+	return woke_on_bits(fd) & (WAKE_READ|WAKE_ERR);
 }
 
 static inline bool woke_on_writeable(int fd) {
-	return FD_ISSET(fd, &wake->fd_ready_write) || FD_ISSET(fd, &wake->fd_ready_err);
+	return woke_on_bits(fd) & (WAKE_WRITE|WAKE_ERR);
 }
 
 static inline bool woke_on_writeable_only(int fd) {
-	return FD_ISSET(fd, &wake->fd_ready_write);
+	return woke_on_bits(fd) & WAKE_WRITE;
 }
 
 static inline bool woke_on_fd(int fd) {
-	return FD_ISSET(fd, &wake->fd_ready_read) || FD_ISSET(fd, &wake->fd_ready_write) || FD_ISSET(fd, &wake->fd_ready_err);
+	return woke_on_bits(fd) & WAKE_ANY;
 }
 
 static inline void wake_at_time(int64_t ts) {
@@ -128,16 +299,6 @@ static inline void wake_at_time(int64_t ts) {
 		wake->next= ts;
 }
 
-extern bool    main_terminate;
-extern int     main_exitcode;
-
-// callback type function so main can handle the termination of a controller
-void main_notify_controller_freed(controller_t *ctl);
-
-// util function to perform "mkdir -p"
-void create_missing_dirs(char *path);
-
-
 //----------------------------------------------------------------------------
 // version.autogen.c interface
 
@@ -160,6 +321,13 @@ extern int      opt_fd_pool_count;
 extern int      opt_fd_pool_size_each;
 extern int      opt_svc_pool_count;
 extern int      opt_svc_pool_size_each;
+extern int      opt_ctl_pool_count;
+extern int      opt_ctl_recv_buf_max;
+extern int      opt_ctl_send_buf_max;
+extern int      opt_ctl_iterations;
+extern int      opt_spawn_rate;
+extern bool     opt_subreaper;
+extern const char * opt_cgroup;
 extern const char * opt_socket_path;
 extern const char * opt_config_file;
 extern bool     opt_interactive;
@@ -167,6 +335,7 @@ extern bool     opt_exec_on_exit;
 extern strseg_t opt_exec_on_exit_args;
 extern bool     opt_mlockall;
 extern int64_t  opt_terminate_guard;
+extern const char * opt_event_backend;
 
 // Parse main's argv[] to find option settings
 void parse_opts(char **argv);
@@ -248,6 +417,9 @@ void control_socket_stop();
 // Initialize controller module
 void ctl_init();
 
+// Allocate a fixed number of controllers, and never allocate more
+bool ctl_preallocate(int count);
+
 // Create new controller on specified file handles
 controller_t * ctl_new(int recv_fd, int send_fd);
 
@@ -272,22 +444,42 @@ bool ctl_write(controller_t *ctl, const char *msg, ... );
 
 // Notify functions are simply a way to keep all the event "printf" statements in one place.
 bool ctl_notify_signal(controller_t *ctl, int sig_num, int64_t sig_ts, int count);
-bool ctl_notify_svc_state(controller_t *ctl, const char *name, int64_t up_ts, int64_t reap_ts, pid_t pid, int wstat);
+bool ctl_notify_svc_state(controller_t *ctl, const char *name, int64_t up_ts, int64_t ready_ts, int64_t stop_ts, int64_t reap_ts, int wstat, pid_t pid, const svc_usage_t *usage);
+bool ctl_notify_svc_usage(controller_t *ctl, const char *name, int runs, const svc_usage_t *total);
+bool ctl_notify_svc_flap_limit(controller_t *ctl, const char *name, int count, int64_t window);
+bool ctl_notify_svc_flapping(controller_t *ctl, const char *name, int failures, int64_t window);
+bool ctl_notify_svc_history(controller_t *ctl, const char *name, int64_t up_ts, int64_t reap_ts, int wstat);
 bool ctl_notify_svc_tags(controller_t *ctl, const char *name, const char *tsv_fields);
 bool ctl_notify_svc_argv(controller_t *ctl, const char *name, const char *tsv_fields);
 bool ctl_notify_svc_fds(controller_t *ctl, const char *name, const char *tsv_fields);
 bool ctl_notify_svc_auto_up(controller_t *ctl, const char *name, int64_t interval, const char *tsv_triggers);
+bool ctl_notify_svc_priority(controller_t *ctl, const char *name, int priority);
+bool ctl_notify_svc_limits(controller_t *ctl, const char *name, const char *tsv_fields);
+bool ctl_notify_svc_backoff(controller_t *ctl, const char *name, int factor, int64_t max, int jitter, int64_t reset);
+bool ctl_notify_svc_requires(controller_t *ctl, const char *name, const char *tsv_fields);
+bool ctl_notify_svc_after(controller_t *ctl, const char *name, const char *tsv_fields);
+bool ctl_notify_svc_ready_timeout(controller_t *ctl, const char *name, int64_t timeout);
 bool ctl_notify_fd_state(controller_t *ctl, fd_t *fd);
 #define ctl_notify_error(ctl, msg, ...) (ctl_write(ctl, "error\t" msg "\n", ##__VA_ARGS__))
 
 // Run all active controller state machines
 void ctl_run();
 
+// Callback from the journal when an event that controllers still need to
+// send is being discarded
+void ctl_notify_journal_evict(int64_t seq);
+
 //----------------------------------------------------------------------------
 // service.c interface
 
 void svc_init();
 
+// Become a child subreaper and track each service's process group
+void svc_init_subreaper();
+
+// Create the --cgroup directory and enable controllers for its children
+void svc_init_cgroup();
+
 // Initialize the service pool
 bool svc_preallocate(int service_count, int data_size_each);
 
@@ -301,8 +493,25 @@ bool svc_check_name(strseg_t name);
 pid_t   svc_get_pid(service_t *svc);
 int     svc_get_wstat(service_t *svc);
 int64_t svc_get_up_ts(service_t *svc);
+int64_t svc_get_ready_ts(service_t *svc); // 0 unless state is "ready"
+int64_t svc_get_stop_ts(service_t *svc);  // 0 unless state is "stopping"
 int64_t svc_get_reap_ts(service_t *svc);
+
+// Resources used by a service's processes, as reported by wait4()
+struct svc_usage_s {
+	int64_t user_usec, sys_usec;   // CPU time
+	int64_t maxrss_kb;             // largest of any one process
+	int64_t nvcsw, nivcsw;         // voluntary and involuntary context switches
+};
+
+// Usage of the current or most recent run (if down), and the total of all
+// runs with the number of runs.  svc_get_usage returns NULL if not down.
+const svc_usage_t * svc_get_usage(service_t *svc);
+const svc_usage_t * svc_get_usage_total(service_t *svc, int *runs);
 int64_t svc_get_restart_interval(service_t *svc);
+int64_t svc_get_ready_timeout(service_t *svc);
+int     svc_get_priority(service_t *svc);
+void    svc_get_backoff(service_t *svc, int *factor_out, int64_t *max_out, int *jitter_out, int64_t *reset_out);
 
 // Set tags for a service. Fails if unable to allocate the needed space
 bool svc_set_tags(service_t *svc, strseg_t tsv_fields);
@@ -322,6 +531,12 @@ bool svc_set_fds(service_t *svc, strseg_t tsv_fields);
 // Return TSV string of fds
 const char * svc_get_fds(service_t *svc);
 
+// Set TSV list of resource settings (see service.limits), after checking
+// them with svc_check_limits, which returns an error message or NULL.
+const char * svc_check_limits(strseg_t limits_tsv);
+bool svc_set_limits(service_t *svc, strseg_t limits_tsv);
+const char * svc_get_limits(service_t *svc);
+
 // Set restart interval (used if service has an auto_up trigger)
 bool svc_set_restart_interval(service_t *svc, int64_t interval);
 
@@ -331,15 +546,57 @@ const char * svc_get_triggers(service_t *svc);
 // Set TSV string of triggers for the auto_up feature
 bool svc_set_triggers(service_t *svc, strseg_t triggers_tsv);
 
+// Set TSV list of services which must be up before this one starts, and
+// which are started along with it.  Fails if unable to allocate the space.
+bool svc_set_requires(service_t *svc, strseg_t deps_tsv);
+const char * svc_get_requires(service_t *svc);
+
+// Set TSV list of services which, if they are starting, must be up before
+// this one starts.  Fails if unable to allocate the space.
+bool svc_set_after(service_t *svc, strseg_t deps_tsv);
+const char * svc_get_after(service_t *svc);
+
+// Set priority for the --spawn-rate queue, higher goes first
+bool svc_set_priority(service_t *svc, int priority);
+
+// Set the number of failures within 'window' which pause auto_up (0 for
+// never), and whether the service is paused that way
+bool svc_set_flap_limit(service_t *svc, int count, int64_t window);
+void svc_get_flap_limit(service_t *svc, int *count, int64_t *window);
+bool svc_is_flapping(service_t *svc);
+
+// Get the start time, reap time, and wait status of recent runs, from 0 for
+// the oldest remembered.  Returns false past the most recent.
+bool svc_get_history(service_t *svc, int idx, int64_t *up_ts, int64_t *reap_ts, int *wstat);
+
+// Set exponential backoff for auto-restarts, factor 0 to disable
+bool svc_set_backoff(service_t *svc, int factor, int64_t max, int jitter, int64_t reset);
+
+// Set how long the service may take to write to control.ready, 0 for no limit
+bool svc_set_ready_timeout(service_t *svc, int64_t timeout);
+
+// Return the name of a service in deps_tsv which depends on svc (making
+// a cycle if svc depended on it), or NULL if none.
+const char * svc_deps_cycle(service_t *svc, strseg_t deps_tsv);
+
 // Tell service state machine to start at specified time
 bool svc_handle_start(service_t *svc, int64_t when);
 
 // Cancel a pending service.start; return service to 'down' state
 bool svc_cancel_start(service_t *svc);
 
+// SIGTERM the service, then SIGKILL after timeout (never, if negative)
+bool svc_handle_stop(service_t *svc, int64_t timeout);
+
+// Stop all services, each after the running services that depend on it
+void svc_stop_all(int64_t timeout);
+
 // Tell service state machine it has been reaped
 void svc_handle_reaped(service_t *svc, int wstat);
 
+// Collect exited children and pass them to svc_handle_reaped
+void svc_reap_children();
+
 // Run an iteration of the state machine for the service
 void svc_run(service_t *svc);
 
@@ -433,12 +690,19 @@ void fd_delete(fd_t *fd);
 // Find a FD by name, NULL if not found
 fd_t * fd_by_name(strseg_t name);
 
-// Find a FD by file descriptor number (not indexed, could be slow)
+// Find a FD by file descriptor number
 fd_t * fd_by_num(int fdnum);
 
 // Iterate list of FDs, either from a previous obj, or from a previous name
 fd_t * fd_iter_next(fd_t *current, const char *from_name);
 
+// If debugging, fd_check routine performs sanity check on fd object.
+#ifdef NDEBUG
+#define fd_check(fd)
+#else
+void fd_check(fd_t *fd);
+#endif
+
 //----------------------------------------------------------------------------
 // signal.c interface
 
@@ -21,6 +21,7 @@ struct fd_s {
 	int size;
 	fd_flags_t flags;
 	int fd;
+	int list_idx;          // position within fd_list
 	RBTreeNode name_index_node;
 	union attr_union_u {
 		struct file_attr_s {
@@ -36,12 +37,18 @@ struct fd_s {
 
 fd_t **fd_list= NULL;
 int fd_list_count= 0, fd_list_limit= 0;
-RBTree fd_by_name_index;
+RBTree fd_by_name_index;      // sorted index by name
+name_hash_t fd_by_name_hash;  // unsorted index by name, for lookups
+fd_t **fd_by_fdnum= NULL;     // objects indexed by descriptor number
+int fd_by_fdnum_limit= 0;
+bool fd_by_fdnum_fixed= false;    // can't grow, because using object pool
+bool fd_by_fdnum_overflow= false; // some descriptor numbers didn't fit in the table
 void *fd_obj_pool= NULL;
 int fd_obj_pool_size_each= 0;
 int fd_dev_null;
 
 bool fd_list_resize(int new_limit);
+static void fd_assign_fdnum(fd_t *fd, int fdnum);
 void add_fd_by_name(fd_t *fd);
 void create_missing_dirs(char *path);
 static const char * append_elipses(char *buffer, int bufsize, strseg_t source);
@@ -52,8 +59,13 @@ int fd_by_name_compare(void *data, RBTreeNode *node) {
 	return strseg_cmp(*name, (strseg_t){ obj->buffer, obj->name_len });
 }
 
+strseg_t fd_by_name_hash_key(void *obj) {
+	return (strseg_t){ ((fd_t*) obj)->buffer, ((fd_t*) obj)->name_len };
+}
+
 void fd_init() {
 	RBTree_Init( &fd_by_name_index, fd_by_name_compare );
+	name_hash_init( &fd_by_name_hash, fd_by_name_hash_key );
 }
 
 bool fd_init_special_handles() {
@@ -82,11 +94,16 @@ bool fd_init_special_handles() {
 		&&
 		fd_new_file(STRSEG("control.socket"), -1,
 			(fd_flags_t){ .special= true, .read= true, .write= true, .is_const= true },
-			STRSEG("daemonproxy control socket"));
+			STRSEG("daemonproxy control socket"))
+		&&
+		fd_new_file(STRSEG("control.ready"), -1,
+			(fd_flags_t){ .special= true, .write= true, .is_const= true },
+			STRSEG("daemonproxy readiness notification"));
 }
 
 bool fd_preallocate(int count, int data_size_each) {
-	int i, size_each;
+	int i, size_each, fdnum_limit;
+	struct rlimit nofile;
 	assert(fd_list == NULL);
 	assert(fd_obj_pool == NULL);
 	
@@ -99,6 +116,19 @@ bool fd_preallocate(int count, int data_size_each) {
 
 	if (!(fd_obj_pool= malloc(count * size_each)))
 		return false;
+	if (!name_hash_preallocate(&fd_by_name_hash, count))
+		return false;
+	// Descriptor numbers aren't limited by the pool size, but daemonproxy has
+	// only a few of its own, so twice the pool is plenty, and no number can
+	// reach RLIMIT_NOFILE.  fd_by_num can still find any that don't fit.
+	fdnum_limit= count * 2;
+	if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur != RLIM_INFINITY
+		&& nofile.rlim_cur < fdnum_limit)
+		fdnum_limit= nofile.rlim_cur;
+	if (!(fd_by_fdnum= (fd_t**) calloc(fdnum_limit, sizeof(fd_t*))))
+		return false;
+	fd_by_fdnum_limit= fdnum_limit;
+	fd_by_fdnum_fixed= true;
 	fd_obj_pool_size_each= size_each;
 	for (i= 0; i < count; i++)
 		fd_list[i]= (fd_t*) (((char*) fd_obj_pool) + size_each * i);
@@ -124,6 +154,8 @@ fd_t * fd_new(int size, strseg_t name) {
 	if (fd_list_count >= fd_list_limit)
 		if (fd_obj_pool || !fd_list_resize(fd_list_limit + 32))
 			return NULL;
+	if (!name_hash_reserve(&fd_by_name_hash, fd_list_count + 1))
+		return NULL;
 	// allocate space (unless using a pool)
 	if (fd_obj_pool) {
 		size= fd_obj_pool_size_each;
@@ -139,6 +171,7 @@ fd_t * fd_new(int size, strseg_t name) {
 	memset(obj, 0, size);
 	obj->size= size;
 	obj->fd= -1;
+	obj->list_idx= fd_list_count - 1;
 	RBTreeNode_Init( &obj->name_index_node );
 	obj->name_index_node.Object= obj;
 	memcpy(obj->buffer, name.data, name.len);
@@ -146,6 +179,7 @@ fd_t * fd_new(int size, strseg_t name) {
 	obj->name_len= name.len;
 
 	RBTree_Add( &fd_by_name_index, &obj->name_index_node, &name );
+	name_hash_add( &fd_by_name_hash, obj ); // space was reserved above
 
 	return obj;
 }
@@ -165,24 +199,25 @@ void fd_delete(fd_t *fd) {
 		if (log_get_fd() == fd->fd)
 			log_fd_reset();
 		
+		wake_cancel_fd(fd->fd);
 		int result= close(fd->fd);
 		log_trace("close(%d) => %d", fd->fd, result);
 	}
-	// Remove name from index
+	fd_assign_fdnum(fd, -1);
+	// Remove name from indexes
 	RBTreeNode_Prune( &fd->name_index_node );
+	name_hash_remove( &fd_by_name_hash, fd );
 	// remove the pointer from fd_list and free the mem (or swap within list, for obj pool)
-	for (i= 0; i < fd_list_count; i++) {
-		if (fd_list[i] == fd) {
-			fd_list[i]= fd_list[--fd_list_count];
-			// free the memory (unless object pool)
-			if (fd_obj_pool)
-				fd_list[fd_list_count]= fd;
-			else {
-				fd_list[fd_list_count]= NULL;
-				free(fd);
-			}
-			break;
-		}
+	i= fd->list_idx;
+	assert(fd_list[i] == fd);
+	fd_list[i]= fd_list[--fd_list_count];
+	fd_list[i]->list_idx= i;
+	// free the memory (unless object pool)
+	if (fd_obj_pool)
+		fd_list[fd_list_count]= fd;
+	else {
+		fd_list[fd_list_count]= NULL;
+		free(fd);
 	}
 }
 
@@ -195,7 +230,35 @@ int fd_get_fdnum(fd_t *fd) {
 }
 
 void fd_set_fdnum(fd_t *fd, int fdnum) {
+	fd_assign_fdnum(fd, fdnum);
+}
+
+/** Change an object's descriptor number, and keep fd_by_fdnum in sync.
+ *
+ * If the table can't grow to hold the number, set the overflow flag so that
+ * fd_by_num knows to search the list instead.
+ */
+void fd_assign_fdnum(fd_t *fd, int fdnum) {
+	fd_t **new_table;
+	int n;
+	
+	if (fd->fd >= 0 && fd->fd < fd_by_fdnum_limit && fd_by_fdnum[fd->fd] == fd)
+		fd_by_fdnum[fd->fd]= NULL;
 	fd->fd= fdnum;
+	if (fdnum < 0)
+		return;
+	if (fdnum >= fd_by_fdnum_limit && !fd_by_fdnum_fixed) {
+		for (n= fd_by_fdnum_limit? fd_by_fdnum_limit : 64; n <= fdnum; n <<= 1);
+		if ((new_table= (fd_t**) realloc(fd_by_fdnum, n * sizeof(fd_t*)))) {
+			memset(new_table + fd_by_fdnum_limit, 0, (n - fd_by_fdnum_limit) * sizeof(fd_t*));
+			fd_by_fdnum= new_table;
+			fd_by_fdnum_limit= n;
+		}
+	}
+	if (fdnum < fd_by_fdnum_limit)
+		fd_by_fdnum[fdnum]= fd;
+	else
+		fd_by_fdnum_overflow= true;
 }
 
 fd_flags_t fd_get_flags(fd_t *fd) {
@@ -245,14 +308,14 @@ fd_t * fd_new_pipe(strseg_t name1, int num1, strseg_t name2, int num2, fd_flags_
 	f1->flags.pipe= true;
 	f1->flags.read= true;
 	f1->flags.write= flags->socket;
-	f1->fd= num1;
+	fd_assign_fdnum(f1, num1);
 	f1->attr.pipe.peer= f2;
 
 	f2->flags= *flags;
 	f2->flags.pipe= true;
 	f1->flags.read= flags->socket;
 	f2->flags.write= true;
-	f2->fd= num2;
+	fd_assign_fdnum(f2, num2);
 	f2->attr.pipe.peer= f1;
 	
 	return f1;
@@ -274,7 +337,7 @@ fd_t * fd_new_file(strseg_t name, int fdnum, fd_flags_t flags, strseg_t path) {
 	// it worked, so delete the old one, if any
 	if (old) fd_delete(old);
 	
-	f->fd= fdnum;
+	fd_assign_fdnum(f, fdnum);
 	f->flags= flags;
 	// copy as much of path into the buffer as we can.
 	buf_free= f->size - sizeof(fd_t) - name.len - 1;
@@ -308,18 +371,20 @@ const char* append_elipses(char *buffer, int bufsize, strseg_t source) {
 
 fd_t * fd_by_name(strseg_t name) {
 	assert(name.len < NAME_BUF_SIZE);
-	RBTreeSearch s= RBTree_Find( &fd_by_name_index, &name );
-	if (s.Relation == 0)
-		return (fd_t*) s.Nearest->Object;
-	return NULL;
+	return (fd_t*) name_hash_find( &fd_by_name_hash, name );
 }
 
-// This happens so seldom (only at startup in main()), its not worth a R/B Tree.
 fd_t * fd_by_num(int fdnum) {
 	int i;
-	for (i= 0; i< fd_list_count; i++)
-		if (fd_list[i]->fd == fdnum)
-			return fd_list[i];
+	if (fdnum < 0)
+		return NULL;
+	if (fdnum < fd_by_fdnum_limit)
+		return fd_by_fdnum[fdnum];
+	// Only numbers which didn't fit in the table need a search
+	if (fd_by_fdnum_overflow)
+		for (i= 0; i < fd_list_count; i++)
+			if (fd_list[i]->fd == fdnum)
+				return fd_list[i];
 	return NULL;
 }
 
@@ -368,3 +433,15 @@ void fd_load_flags(fd_flags_t *flags, int fh) {
 		}
 	}
 }
+
+#ifndef NDEBUG
+void fd_check(fd_t *fd) {
+	assert(fd != NULL);
+	assert(fd->name_len > 0 && fd->name_len < NAME_BUF_SIZE);
+	assert(fd->buffer[fd->name_len] == 0);
+	assert(name_hash_find(&fd_by_name_hash, (strseg_t){ fd->buffer, fd->name_len }) == fd);
+	assert(fd->list_idx >= 0 && fd->list_idx < fd_list_count && fd_list[fd->list_idx] == fd);
+	if (fd->fd >= 0)
+		assert(fd_by_num(fd->fd) == fd);
+}
+#endif
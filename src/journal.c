@@ -0,0 +1,160 @@
+/* journal.c - bounded history of broadcast events
+ * Copyright (C) 2014  Michael Conrad
+ * Distributed under GPLv2, see LICENSE
+ */
+
+#include "config.h"
+#include "daemonproxy.h"
+
+// Every broadcast event is formatted once into the journal, and given the
+// next sequence number.  The journal keeps the most recent events, so that a
+// controller which fell behind can replay just the ones it missed instead of
+// requesting a full statedump.
+//
+// Event text lives in a ring buffer.  An event is never split across the end
+// of the buffer; if it doesn't fit in the remaining space, it starts over at
+// offset 0 and the tail goes unused until the next lap.  The oldest events
+// are evicted to make room, or when the event table is full.
+//
+// Controllers send events straight out of the journal, so each event counts
+// the controllers still waiting to write it.  Evicting an event that is still
+// referenced tells the controller module, which overflows those controllers.
+
+typedef struct journal_event_s {
+	int ofs, len;
+	int refs;
+} journal_event_t;
+
+static char journal_buf[JOURNAL_BUF_SIZE];
+static journal_event_t journal_event[JOURNAL_MAX_EVENTS];
+static int journal_write_pos;
+
+// Events in the range [journal_first_seq, journal_next_seq) are available.
+static int64_t journal_first_seq, journal_next_seq;
+
+#define JOURNAL_EVENT(seq) (&journal_event[(seq) % JOURNAL_MAX_EVENTS])
+
+void journal_init() {
+	journal_write_pos= 0;
+	journal_first_seq= 1;
+	journal_next_seq= 1;
+}
+
+static void journal_evict_oldest() {
+	if (JOURNAL_EVENT(journal_first_seq)->refs) {
+		ctl_notify_journal_evict(journal_first_seq);
+		assert(JOURNAL_EVENT(journal_first_seq)->refs == 0);
+	}
+	journal_first_seq++;
+	if (journal_first_seq == journal_next_seq)
+		journal_write_pos= 0;
+}
+
+/* Evict events until there are at least 'need' contiguous bytes at
+ * journal_write_pos (moving it to the start of the buffer if needed).
+ * 'need' must not exceed JOURNAL_BUF_SIZE.
+ *
+ * Returns the number of contiguous bytes available.
+ */
+static int journal_make_room(int need) {
+	int oldest;
+	while (journal_first_seq < journal_next_seq) {
+		oldest= JOURNAL_EVENT(journal_first_seq)->ofs;
+		// free space is between the write position and the oldest event
+		if (oldest >= journal_write_pos) {
+			if (oldest - journal_write_pos >= need)
+				return oldest - journal_write_pos;
+		}
+		// else free space is the tail of the buffer, and the space before the oldest
+		else if (JOURNAL_BUF_SIZE - journal_write_pos >= need)
+			return JOURNAL_BUF_SIZE - journal_write_pos;
+		else if (oldest >= need) {
+			journal_write_pos= 0;
+			return oldest;
+		}
+		journal_evict_oldest();
+	}
+	return JOURNAL_BUF_SIZE - journal_write_pos;
+}
+
+/** Format an event and add it to the journal.
+ *
+ * Returns the event's sequence number, and points event_out at its text.
+ * If the event is too large for the journal, the whole journal is discarded
+ * (since the history is no longer complete) and event_out->data is NULL.
+ */
+int64_t journal_append(strseg_t *event_out, const char *fmt, va_list val) {
+	journal_event_t *ev;
+	va_list tmp;
+	int avail, len;
+
+	if (journal_next_seq - journal_first_seq >= JOURNAL_MAX_EVENTS)
+		journal_evict_oldest();
+
+	// Usually an event fits in the reserved space, and only needs formatted once.
+	avail= journal_make_room(CONTROLLER_LARGEST_WRITE);
+	va_copy(tmp, val);
+	len= vsnprintf(journal_buf + journal_write_pos, avail, fmt, tmp);
+	va_end(tmp);
+	if (len >= avail) {
+		if (len >= JOURNAL_BUF_SIZE) {
+			log_warn("event of %d bytes is too large for the journal", len);
+			while (journal_first_seq < journal_next_seq)
+				journal_evict_oldest();
+			journal_first_seq= ++journal_next_seq;
+			event_out->data= NULL;
+			event_out->len= len;
+			return journal_next_seq - 1;
+		}
+		avail= journal_make_room(len + 1);
+		va_copy(tmp, val);
+		vsnprintf(journal_buf + journal_write_pos, avail, fmt, tmp);
+		va_end(tmp);
+	}
+	ev= JOURNAL_EVENT(journal_next_seq);
+	ev->ofs= journal_write_pos;
+	ev->len= len;
+	ev->refs= 0;
+	journal_write_pos += len;
+	event_out->data= journal_buf + ev->ofs;
+	event_out->len= len;
+	return journal_next_seq++;
+}
+
+/** Look up an event by sequence number.
+ *
+ * Returns false if the event was evicted, or doesn't exist yet.
+ */
+bool journal_get(int64_t seq, strseg_t *event_out) {
+	journal_event_t *ev;
+	if (seq < journal_first_seq || seq >= journal_next_seq)
+		return false;
+	ev= JOURNAL_EVENT(seq);
+	event_out->data= journal_buf + ev->ofs;
+	event_out->len= ev->len;
+	return true;
+}
+
+/** Keep an event from being discarded silently.
+ *
+ * Each reference must be released with journal_unref, or else the holder
+ * must release it when notified by ctl_notify_journal_evict.
+ */
+void journal_ref(int64_t seq) {
+	assert(seq >= journal_first_seq && seq < journal_next_seq);
+	JOURNAL_EVENT(seq)->refs++;
+}
+
+void journal_unref(int64_t seq) {
+	assert(seq >= journal_first_seq && seq < journal_next_seq);
+	assert(JOURNAL_EVENT(seq)->refs > 0);
+	JOURNAL_EVENT(seq)->refs--;
+}
+
+int64_t journal_get_first_seq() {
+	return journal_first_seq;
+}
+
+int64_t journal_get_next_seq() {
+	return journal_next_seq;
+}
@@ -15,6 +15,7 @@ int  log_fd= 2;
 int  log_msg_lost= 0;
 bool log_blocked= false;
 int64_t log_blocked_next_attempt= 0;
+wake_timer_t log_retry_timer;
 
 const char * log_level_names[]= { "none", "trace", "debug", "info", "warning", "error", "fatal" };
 
@@ -28,6 +29,7 @@ static bool log_flush();
 static bool log_fd_attach();
 
 void log_init() {
+	wake_timer_init(&log_retry_timer, NULL, NULL);
 	log_fd= 2;
 	log_fd_attach();
 }
@@ -96,6 +98,7 @@ bool log_write(int level, const char *msg, ...) {
 
 	if (log_msg_lost) {
 		log_msg_lost++;
+		stats.log_lost++;
 		return false;
 	}
 
@@ -105,6 +108,7 @@ bool log_write(int level, const char *msg, ...) {
 	n= snprintf(p , limit - p, "%s: ", log_level_name(level));
 	if (n >= limit - p) {
 		log_msg_lost++;
+		stats.log_lost++;
 		return false;
 	}
 	p+= n;
@@ -113,6 +117,7 @@ bool log_write(int level, const char *msg, ...) {
 	va_end(val);
 	if (n >= limit - p) {
 		log_msg_lost++;
+		stats.log_lost++;
 		return false;
 	}
 	p+= n;
@@ -166,7 +171,7 @@ void log_run() {
 		// If still blocked, set an appropriate wake event
 		if (log_blocked) {
 			if (log_blocked_next_attempt)
-				wake_at_time(log_blocked_next_attempt);
+				wake_timer_set(&log_retry_timer, log_blocked_next_attempt);
 			else
 				// Don't also wake on fd_err, because we don't care.  Error is the same as
 				// not-writable (blocked) for logging purposes.
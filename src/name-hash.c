@@ -0,0 +1,122 @@
+/* name-hash.c - hash index of named objects
+ * Copyright (C) 2014  Michael Conrad
+ * Distributed under GPLv2, see LICENSE
+ */
+
+#include "config.h"
+#include "daemonproxy.h"
+
+// Open addressing with linear probing.  The table is always a power of 2
+// and kept at most half full, so probe sequences stay short.  Deletion
+// shifts the following entries back instead of leaving tombstones.
+//
+// Each entry caches the hash of its name, so probing only compares names
+// when the hashes match, and resizing never needs to look at the objects.
+
+uint32_t name_hash_func(strseg_t name) {
+	uint32_t h= 2166136261U; // FNV-1a
+	int i;
+	for (i= 0; i < name.len; i++) {
+		h ^= (unsigned char) name.data[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+void name_hash_init(name_hash_t *h, name_hash_key_fn_t *key_fn) {
+	memset(h, 0, sizeof(*h));
+	h->key_fn= key_fn;
+}
+
+static void name_hash_insert(name_hash_entry_t *table, int limit, uint32_t hash, void *obj) {
+	int i;
+	for (i= hash & (limit-1); table[i].obj; i= (i+1) & (limit-1));
+	table[i].hash= hash;
+	table[i].obj= obj;
+}
+
+/** Make sure the table can hold 'count' objects without growing.
+ *
+ * Returns false if the allocation fails, or if the table is fixed-size
+ * and too small.
+ */
+bool name_hash_reserve(name_hash_t *h, int count) {
+	name_hash_entry_t *new_table;
+	int i, new_limit;
+
+	if (count * 2 <= h->limit)
+		return true;
+	if (h->fixed)
+		return false;
+	for (new_limit= h->limit? h->limit : NAME_HASH_LIMIT_INITIAL; new_limit < count * 2; new_limit <<= 1);
+
+	log_trace("growing name hash from %d to %d", h->limit, new_limit);
+	if (!(new_table= (name_hash_entry_t*) calloc(new_limit, sizeof(name_hash_entry_t))))
+		return false;
+	for (i= 0; i < h->limit; i++)
+		if (h->table[i].obj)
+			name_hash_insert(new_table, new_limit, h->table[i].hash, h->table[i].obj);
+	free(h->table);
+	h->table= new_table;
+	h->limit= new_limit;
+	return true;
+}
+
+/** Size the table for 'count' objects, and never grow it after that.
+ *
+ * This is for the object pools, which must not allocate after startup.
+ */
+bool name_hash_preallocate(name_hash_t *h, int count) {
+	if (!name_hash_reserve(h, count))
+		return false;
+	h->fixed= true;
+	return true;
+}
+
+/** Add an object to the index.
+ *
+ * Duplicate names are allowed (briefly, while an object is being replaced)
+ * in which case find returns either one.
+ */
+bool name_hash_add(name_hash_t *h, void *obj) {
+	if (!name_hash_reserve(h, h->count + 1))
+		return false;
+	name_hash_insert(h->table, h->limit, name_hash_func(h->key_fn(obj)), obj);
+	h->count++;
+	return true;
+}
+
+void * name_hash_find(name_hash_t *h, strseg_t name) {
+	uint32_t hash;
+	int i;
+
+	if (!h->count)
+		return NULL;
+	hash= name_hash_func(name);
+	for (i= hash & (h->limit-1); h->table[i].obj; i= (i+1) & (h->limit-1))
+		if (h->table[i].hash == hash && strseg_cmp(h->key_fn(h->table[i].obj), name) == 0)
+			return h->table[i].obj;
+	return NULL;
+}
+
+void name_hash_remove(name_hash_t *h, void *obj) {
+	int i, j, home, mask= h->limit-1;
+
+	if (!h->count)
+		return;
+	for (i= name_hash_func(h->key_fn(obj)) & mask; h->table[i].obj != obj; i= (i+1) & mask)
+		if (!h->table[i].obj)
+			return; // not indexed
+	h->count--;
+	// Shift back any following entries that would no longer be reachable
+	// across the hole.
+	for (j= (i+1) & mask; h->table[j].obj; j= (j+1) & mask) {
+		home= h->table[j].hash & mask;
+		// if home is cyclically within (i, j], the entry can stay
+		if (i <= j? (home > i && home <= j) : (home > i || home <= j))
+			continue;
+		h->table[i]= h->table[j];
+		i= j;
+	}
+	h->table[i].obj= NULL;
+}
@@ -15,6 +15,13 @@ int         opt_fd_pool_count= 0;
 int         opt_fd_pool_size_each= 0;
 int         opt_svc_pool_count= 0;
 int         opt_svc_pool_size_each= 0;
+int         opt_ctl_pool_count= 0;
+int         opt_ctl_recv_buf_max= CONTROLLER_RECV_BUF_MAX_DEFAULT;
+int         opt_ctl_send_buf_max= CONTROLLER_SEND_BUF_MAX_DEFAULT;
+int         opt_ctl_iterations= CONTROLLER_ITERATIONS_DEFAULT;
+int         opt_spawn_rate= 0;
+bool        opt_subreaper= false;
+const char *opt_cgroup= NULL;
 const char *opt_socket_path= NULL;
 const char *opt_config_file= NULL;
 bool        opt_exec_on_exit= false;
@@ -23,6 +30,7 @@ strseg_t    opt_exec_on_exit_args;
 bool        opt_interactive= false;
 bool        opt_mlockall= false;
 int64_t     opt_terminate_guard= 0;
+const char *opt_event_backend= NULL;
 
 static void parse_option(char shortname, char* longname, char ***argv);
 
@@ -297,13 +305,181 @@ void set_opt_svc_prealloc(char **argv) {
 	opt_svc_pool_size_each= (int) val_m;
 }
 
+/*
+=item --controller-pool N
+
+Pre-allocate N controllers.  This prevents further dynamic allocations, and
+restricts you to N simultaneous controllers, including the config file,
+interactive mode, control socket clients, and services using the control.*
+handles.  Without this option, controllers are allocated as they connect.
+
+=cut
+*/
+void set_opt_ctl_prealloc(char **argv) {
+	int64_t val_n;
+	strseg_t arg= STRSEG(argv[0]);
+
+	if (!strseg_atoi(&arg, &val_n) || arg.len > 0)
+		fatal(EXIT_BAD_OPTIONS, "Expected integer for --controller-pool");
+
+	if (val_n < CONTROLLER_POOL_SIZE_MIN) {
+		log_warn("At least %d controller objects required; using minimum", CONTROLLER_POOL_SIZE_MIN);
+		val_n= CONTROLLER_POOL_SIZE_MIN;
+	} else if (val_n > CONTROLLER_POOL_SIZE_MAX) {
+		log_warn("controller pool size exceeds maximum; limiting to %d", CONTROLLER_POOL_SIZE_MAX);
+		val_n= CONTROLLER_POOL_SIZE_MAX;
+	}
+
+	opt_ctl_pool_count= (int) val_n;
+}
+
+static int parse_ctl_buf_size(const char *arg, int min) {
+	int64_t val;
+	strseg_t str= STRSEG(arg);
+
+	if (!strseg_parse_size(&str, &val) || str.len > 0)
+		fatal(EXIT_BAD_OPTIONS, "Expected size (integer with optional suffix)");
+	if (val < min) {
+		log_warn("buffer size increased to minimum of %d", min);
+		val= min;
+	} else if (val > CONTROLLER_BUF_MAX_LIMIT) {
+		log_warn("buffer size limited to maximum of %d", CONTROLLER_BUF_MAX_LIMIT);
+		val= CONTROLLER_BUF_MAX_LIMIT;
+	}
+	return (int) val;
+}
+
+/*
+=item --controller-recv-max SIZE
+
+Limit the length of a controller command to SIZE bytes.  Each controller's
+command buffer starts small and only grows when a longer command arrives.
+Default is 4K.  A controller can change its own limit with conn.buffer.
+
+=cut
+*/
+void set_opt_ctl_recv_buf_max(char **argv) {
+	opt_ctl_recv_buf_max= parse_ctl_buf_size(argv[0], CONTROLLER_RECV_BUF_SIZE);
+}
+
+/*
+=item --controller-send-max SIZE
+
+Limit the unread events buffered for a controller to SIZE bytes.  The
+event buffer grows while the controller isn't reading its events, until
+daemonproxy reports an overflow.  Default is 16K.  A controller can change
+its own limit with conn.buffer.
+
+With --controller-pool, the buffers of each controller are allocated at
+these maximum sizes up front.
+
+=cut
+*/
+void set_opt_ctl_send_buf_max(char **argv) {
+	opt_ctl_send_buf_max= parse_ctl_buf_size(argv[0], CONTROLLER_SEND_BUF_SIZE);
+}
+
+/*
+=item --controller-iterations N
+
+Run at most N steps of each controller per main loop pass.  This keeps one
+busy controller from delaying the others or the handling of signals and
+exited services.  A command takes about 3 steps.  Default is 10.  Commands
+between batch.begin and batch.end are not limited by this.
+
+=cut
+*/
+void set_opt_ctl_iterations(char **argv) {
+	int64_t val_n;
+	strseg_t arg= STRSEG(argv[0]);
+
+	if (!strseg_atoi(&arg, &val_n) || arg.len > 0)
+		fatal(EXIT_BAD_OPTIONS, "Expected integer for --controller-iterations");
+
+	if (val_n < 1) {
+		log_warn("controller iterations increased to minimum of 1");
+		val_n= 1;
+	} else if (val_n > CONTROLLER_ITERATIONS_MAX) {
+		log_warn("controller iterations limited to maximum of %d", CONTROLLER_ITERATIONS_MAX);
+		val_n= CONTROLLER_ITERATIONS_MAX;
+	}
+
+	opt_ctl_iterations= (int) val_n;
+}
+
+/*
+=item --spawn-rate N
+
+Start at most N services per second, and at most N at once.  Starts beyond
+that wait in a queue, ordered by service.priority, instead of all forking in
+the same instant, such as when a signal triggers many services.  Default is
+no limit.
+
+=cut
+*/
+void set_opt_spawn_rate(char **argv) {
+	int64_t val_n;
+	strseg_t arg= STRSEG(argv[0]);
+
+	if (!strseg_atoi(&arg, &val_n) || arg.len > 0)
+		fatal(EXIT_BAD_OPTIONS, "Expected integer for --spawn-rate");
+
+	if (val_n < 1) {
+		log_warn("spawn rate increased to minimum of 1");
+		val_n= 1;
+	} else if (val_n > SPAWN_RATE_MAX) {
+		log_warn("spawn rate limited to maximum of %d", SPAWN_RATE_MAX);
+		val_n= SPAWN_RATE_MAX;
+	}
+
+	opt_spawn_rate= (int) val_n;
+}
+
+/*
+=item --subreaper
+
+Adopt processes which the services leave behind, and keep track of them.
+daemonproxy becomes a child subreaper (unless it is already process 1), and
+each service is started in its own process group.  When a process orphaned
+by a service exits, it is reaped and charged to that service, and the
+service is not "down" until every process in its group has exited.  Service
+stop signals go to the whole group.
+
+A service with a cgroup (see --cgroup and service.limits) is tracked by its
+cgroup instead, so this also covers processes which start a new session or
+process group of their own.  Without a cgroup, those can't be attributed,
+and are just reaped.
+
+=cut
+*/
+void set_opt_subreaper(char **argv) {
+	opt_subreaper= true;
+}
+
+/*
+=item --cgroup DIR
+
+Start each service in its own cgroup (version 2), named DIR/SERVICE_NAME.
+DIR is created if needed, and the cpu, io, memory, and pids controllers are
+enabled for the cgroups within it, so it must be a cgroup that daemonproxy
+may write to and is not itself a member of.  See service.limits for the
+settings that can be applied to each cgroup.
+
+=cut
+*/
+void set_opt_cgroup(char **argv) {
+	if (!argv[0][0])
+		fatal(EXIT_BAD_OPTIONS, "Expected directory for --cgroup");
+	opt_cgroup= argv[0];
+}
+
 /*
 =item -M
 
 =item --mlockall
 
 Call mlockall() after allocating structures.  This is primarily intended for
-use with --fd-pool or --service-pool when running as process 1.
+use with --fd-pool, --service-pool, or --controller-pool when running as process 1.
 
 =cut
 */
@@ -311,6 +487,22 @@ void set_opt_mlockall(char **argv) {
 	opt_mlockall= true;
 }
 
+/*
+=item --event-backend NAME
+
+Choose the mechanism used to wait for file descriptors.  NAME is C<epoll>
+or C<select>.  The default is epoll where available, which does not need
+to re-scan every file descriptor on each wakeup and is not limited to
+descriptors below FD_SETSIZE.
+
+=cut
+*/
+void set_opt_event_backend(char **argv) {
+	if (0 != strcmp(argv[0], "epoll") && 0 != strcmp(argv[0], "select"))
+		fatal(EXIT_BAD_OPTIONS, "Unknown event backend '%s'", argv[0]);
+	opt_event_backend= argv[0];
+}
+
 /*
 =item -v
 
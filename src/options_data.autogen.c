@@ -0,0 +1,46 @@
+void set_opt_configfile(char **);
+void set_opt_stdin(char **);
+void opt_set_socket_path(char **);
+void opt_set_daemonize(char **);
+void set_opt_failsafe(char **);
+void set_opt_exec_on_exit(char **);
+void set_opt_fd_prealloc(char **);
+void set_opt_svc_prealloc(char **);
+void set_opt_ctl_prealloc(char **);
+void set_opt_ctl_recv_buf_max(char **);
+void set_opt_ctl_send_buf_max(char **);
+void set_opt_ctl_iterations(char **);
+void set_opt_spawn_rate(char **);
+void set_opt_subreaper(char **);
+void set_opt_cgroup(char **);
+void set_opt_mlockall(char **);
+void set_opt_event_backend(char **);
+void set_opt_verbose(char **);
+void set_opt_quiet(char **);
+void show_help(char **);
+void show_version(char **);
+
+const struct option_table_entry_s option_table[]= {
+	{ 'c', "config"          , "FILENAME", set_opt_configfile  , "Read command stream from FILENAME at startup" },
+	{ 'i', "interactive"     , NULL      , set_opt_stdin       , "Use STDIN+STDOUT as a controller communication pipe" },
+	{ 'S', "socket"          , "PATH"    , opt_set_socket_path , "Listen on PATH for controller connections" },
+	{ 'D', "daemonize"       , NULL      , opt_set_daemonize   , "Fork into the background" },
+	{  0 , "exit-guard"      , "INTEGER" , set_opt_failsafe    , "Guard against accidental termination" },
+	{ 'E', "exit-exec"       , "TSV_ARGS", set_opt_exec_on_exit, "exec() args in any trappable exit scenario" },
+	{  0 , "fd-pool"         , "N[xM]"   , set_opt_fd_prealloc , "Pre-allocate N named handles [of M bytes each]" },
+	{  0 , "service-pool"    , "N[xM]"   , set_opt_svc_prealloc, "Pre-allocate N services [of M bytes each]" },
+	{  0 , "controller-pool" , "N"       , set_opt_ctl_prealloc, "Pre-allocate N controllers" },
+	{  0 , "controller-recv-max", "SIZE"    , set_opt_ctl_recv_buf_max, "Limit the length of a controller command to SIZE bytes" },
+	{  0 , "controller-send-max", "SIZE"    , set_opt_ctl_send_buf_max, "Limit the unread events buffered for a controller to SIZE bytes" },
+	{  0 , "controller-iterations", "N"       , set_opt_ctl_iterations, "Run at most N steps of each controller per main loop pass" },
+	{  0 , "spawn-rate"      , "N"       , set_opt_spawn_rate  , "Start at most N services per second, and at most N at once" },
+	{  0 , "subreaper"       , NULL      , set_opt_subreaper   , "Adopt processes which the services leave behind, and keep track of them" },
+	{  0 , "cgroup"          , "DIR"     , set_opt_cgroup      , "Start each service in its own cgroup (version 2), named DIR/SERVICE_NAME" },
+	{ 'M', "mlockall"        , NULL      , set_opt_mlockall    , "Call mlockall() after allocating structures" },
+	{  0 , "event-backend"   , "NAME"    , set_opt_event_backend, "Choose the mechanism used to wait for file descriptors" },
+	{ 'v', "verbose"         , NULL      , set_opt_verbose     , "Enable another level of logging output" },
+	{ 'q', "quiet"           , NULL      , set_opt_quiet       , "Suppress another level of logging output" },
+	{ 'h', "help"            , NULL      , show_help           , "Quick usage synopsis" },
+	{  0 , "version"         , NULL      , show_version        , "Print complete version information" },
+	{  0 , NULL, NULL, NULL, NULL }
+};
@@ -16,9 +16,60 @@
 #define SVC_STATE_START         2
 #define SVC_STATE_UP            3
 #define SVC_STATE_REAPED        4
+#define SVC_STATE_READY         5
+#define SVC_STATE_STOPPING      6
+
+// Resource limits that service.limits can set, as "rlimit.NAME"
+static const struct svc_rlimit_name_s {
+	const char *name;
+	int resource;
+} svc_rlimit_names[]= {
+	{ "as",      RLIMIT_AS },
+	{ "core",    RLIMIT_CORE },
+	{ "cpu",     RLIMIT_CPU },
+	{ "data",    RLIMIT_DATA },
+	{ "fsize",   RLIMIT_FSIZE },
+	#ifdef RLIMIT_MEMLOCK
+	{ "memlock", RLIMIT_MEMLOCK },
+	#endif
+	{ "nofile",  RLIMIT_NOFILE },
+	#ifdef RLIMIT_NPROC
+	{ "nproc",   RLIMIT_NPROC },
+	#endif
+	{ "stack",   RLIMIT_STACK },
+};
+#define SVC_RLIMIT_COUNT (sizeof(svc_rlimit_names)/sizeof(*svc_rlimit_names))
+
+// cgroup v2 interface files that service.limits can write
+static const char * const svc_cgroup_files[]= {
+	"cpu.max", "cpu.weight", "io.weight", "memory.high", "memory.max",
+	"memory.swap.max", "pids.max", NULL
+};
+
+// The args, fds, and limits of a service, pre-split so that starting the
+// service doesn't need to parse anything.  Rebuilt after any of them change.
+typedef struct svc_exec_plan_s {
+	int fd_count;
+	strseg_t *fd_names;    // fd name for each descriptor number in the child
+	char **argv;           // NULL-terminated, for execvp
+	int rlimit_count;
+	struct {
+		int resource;
+		struct rlimit lim;
+	} rlimits[SVC_RLIMIT_COUNT];
+	bool set_nice: 1,
+		set_ioprio: 1,
+		set_affinity: 1;
+	int nice;
+	int ioprio;            // as for ioprio_set(2)
+	#ifdef CPU_SETSIZE
+	cpu_set_t affinity;
+	#endif
+} svc_exec_plan_t;
 
 struct service_s {
 	int state;
+	int list_idx;          // position within svc_list
 	char name_buf[NAME_BUF_SIZE];
 	strseg_t
 		name,              // constant.  points to name_buf
@@ -26,20 +77,64 @@ struct service_s {
 	RBTreeNode             // nodes for Red/Black tree indexing
 		name_index_node, 
 		pid_index_node;
+	wake_timer_t start_timer; // pending for a delayed start, a readiness timeout, or a stop timeout
 	struct service_s       // doubly linked lists
 		**active_prev_ptr, *active_next,
-		**sigwake_prev_ptr, *sigwake_next;
+		**sigwake_prev_ptr, *sigwake_next,
+		**depwait_prev_ptr, *depwait_next,
+		**spawnq_prev_ptr, *spawnq_next,
+		**stopwait_prev_ptr, *stopwait_next;
 	pid_t pid;
+	int pidfd;             // pidfd of the running process, or -1
+	int ready_fd;          // our end of the control.ready pipe, or -1
+	svc_exec_plan_t *exec_plan; // NULL until needed, and always NULL with service pool
 	bool auto_restart: 1,
 		sigwake: 1,
 		uses_control_event: 1,
 		uses_control_cmd: 1,
-		uses_control_socket: 1;
-	int wait_status;
+		uses_control_socket: 1,
+		uses_control_ready: 1,
+		ready_pending: 1,      // up, but hasn't written to control.ready yet
+		ready_failed: 1,       // ready_timeout ran out while ready_pending
+		has_deps: 1,           // has "requires" or "after" services
+		deps_started: 1,       // required services were started for this start
+		spawn_permit: 1,       // granted a fork by the spawn rate limit
+		stop_requested: 1,     // don't auto-restart until started again
+		tree_alive: 1,         // main process reaped, but others in its group (or cgroup) remain
+		in_cgroup: 1,          // the current run was started in the service's cgroup
+		flapping: 1;           // failed too often, so auto_up is paused until started again
+	int wait_status;       // (while tree_alive, the status of the main process)
 	int64_t  start_time;   // 32-bit-precision fixed point fraction
+	int64_t  ready_time;
+	int64_t  stop_time;
+	int64_t  stop_timeout;     // for a service waiting on stopwait_list; -1 for no SIGKILL
 	int64_t  reap_time;
+	int64_t  restart_reap_time; // reap_time which led to a pending auto-restart, or 0
 	int64_t  restart_interval;
+	int64_t  restart_backoff;  // delay before the last auto-restart, while backing off
+	int64_t  backoff_max;      // limit for restart_backoff
+	int64_t  backoff_reset;    // uptime after which restart_backoff starts over
+	int      backoff_factor;   // 0 means no backoff, just restart_interval
+	int      backoff_jitter;   // percent of the delay to randomly add or remove
+	int      priority;         // higher priority gets through the spawn rate limit first
+	int64_t  ready_timeout;
+	svc_usage_t usage;         // of the current or last run, including its orphans
+	svc_usage_t usage_total;   // of all runs which have ended
+	int      run_count;
+	int64_t  cgroup_user_base; // cgroup's CPU time at the start of the run, or -1
+	int64_t  cgroup_sys_base;
+	struct {
+		int64_t start_time, reap_time;
+		int wait_status;
+		bool stopped;          // ended by service.stop, so not a failure
+	} history[SERVICE_HISTORY_SIZE]; // ring of the most recent runs
+	int      history_next;     // slot for the next run to end
+	int      history_count;
+	int      flap_count;       // failures within flap_window which pause auto_up, or 0
+	int64_t  flap_window;
+	int64_t  flap_since;       // failures before this don't count
 	sigset_t autostart_signals;
+	unsigned dep_visit;    // marks services seen while searching dependencies
 };
 
 // Service list - a vector of service references.
@@ -55,9 +150,22 @@ void *svc_pool= NULL;
 int svc_pool_size_each= 0;
 
 RBTree svc_by_name_index;           // sorted index by name
+name_hash_t svc_by_name_hash;       // unsorted index by name, for lookups
 RBTree svc_by_pid_index;            // sorted index by PID (only if running)
+service_t **svc_by_fd= NULL;        // services indexed by their pidfd or ready_fd number
+int svc_by_fd_limit= 0;
+bool svc_reap_any= false;           // whether main loop needs waitpid(-1) to find children
+bool svc_track_groups= false;       // run each service in its own process group, and wait for all of it
 service_t *svc_active_list= NULL;   // linked list of services that need processed each iteration
 service_t *svc_sigwake_list= NULL;  // linked list of services that can wake via signals
+service_t *svc_depwait_list= NULL;  // linked list of services waiting for their dependencies
+bool svc_deps_changed= false;       // a service changed state while others were waiting
+unsigned svc_dep_visit= 0;          // generation counter for dep_visit
+service_t *svc_spawnq_list= NULL;   // services waiting on the spawn rate limit, by priority
+int64_t svc_spawn_tokens= 0;        // forks available now, as 32.32 fixed point
+int64_t svc_spawn_refill_ts= 0;     // when svc_spawn_tokens was last refilled
+wake_timer_t svc_spawn_timer;       // pending while the queue waits for a token
+service_t *svc_stopwait_list= NULL; // services to stop once their dependents are down
 int64_t svc_last_signal_ts= 0;      // last signal we saw, for triggering services.
 
 static service_t *svc_new(strseg_t name);
@@ -67,11 +175,47 @@ static void svc_dtor(service_t *svc);
 static bool svc_list_resize(int new_limit);
 static void svc_notify_state(service_t *svc);
 static void svc_change_pid(service_t *svc, pid_t pid);
+static void svc_pidfd_open(service_t *svc);
+static void svc_pidfd_close(service_t *svc);
+static bool svc_watch_fd(service_t *svc, int fd);
+static void svc_unwatch_fd(int fd);
+static void svc_handle_ready(service_t *svc);
+static pid_t svc_wait_any(int *wstat, service_t **owner, struct rusage *ru);
+static bool svc_tree_alive(service_t *svc);
+static void svc_handle_orphan_reaped(service_t *svc, pid_t pid, int wstat);
+static void svc_charge_rusage(service_t *svc, struct rusage *ru);
+static void svc_usage_finish(service_t *svc);
+static void svc_history_add(service_t *svc);
+static void svc_check_flapping(service_t *svc);
+static bool svc_cgroup_read_cpu(service_t *svc, int64_t *user_usec, int64_t *sys_usec);
+static int svc_cgroup_populated(service_t *svc);
+static bool svc_cgroup_signal(service_t *svc, int signum);
+static service_t * svc_by_cgroup_of(pid_t pid);
+static void svc_ready_close(service_t *svc);
+static bool svc_signal_tree(service_t *svc, int signum);
 static bool svc_do_fork(service_t *svc);
-static void svc_do_exec(service_t *svc);
+static const char * svc_exec_child(svc_exec_plan_t *plan, int *fd_map, int cgroup_fd);
+static const char * svc_parse_limit(strseg_t setting, svc_exec_plan_t *plan);
+static bool svc_is_cgroup_file(strseg_t name);
+static int svc_cgroup_path(service_t *svc, char *buf, int buf_size);
+static bool svc_cgroup_prepare(service_t *svc, int *procs_fd);
+static void svc_log_exec_failure(svc_exec_plan_t *plan, const char *failed_op, int err);
+static int svc_exec_plan_size(service_t *svc);
+static svc_exec_plan_t * svc_exec_plan_build(service_t *svc, void *buffer);
+static void svc_exec_plan_reset(service_t *svc);
 static void svc_set_active(service_t *svc, bool activate);
 static void svc_set_sigwake(service_t *svc, bool sigwake);
+static void svc_set_depwait(service_t *svc, bool depwait);
+static int svc_check_deps(service_t *svc);
 static bool svc_check_sigwake(service_t *svc);
+static void svc_start_timer_cb(wake_timer_t *timer);
+static void svc_set_spawnq(service_t *svc, bool queued);
+static bool svc_spawn_grant();
+static void svc_spawn_timer_cb(wake_timer_t *timer);
+static void svc_begin_stop(service_t *svc, int64_t timeout);
+static void svc_set_stopwait(service_t *svc, bool stopwait);
+static void svc_stopwait_run();
+static int64_t svc_restart_delay(service_t *svc);
 
 int svc_by_name_compare(void *data, RBTreeNode *node) {
 	strseg_t *name= (strseg_t*) data;
@@ -79,6 +223,10 @@ int svc_by_name_compare(void *data, RBTreeNode *node) {
 	return strseg_cmp(*name, obj->name);
 }
 
+strseg_t svc_by_name_hash_key(void *obj) {
+	return ((service_t*) obj)->name;
+}
+
 int svc_by_pid_compare(void *key, RBTreeNode *node) {
 	pid_t a= * (pid_t*) key;
 	pid_t b= ((service_t*) node->Object)->pid;
@@ -88,6 +236,34 @@ int svc_by_pid_compare(void *key, RBTreeNode *node) {
 void svc_init() {
 	RBTree_Init( &svc_by_name_index, svc_by_name_compare );
 	RBTree_Init( &svc_by_pid_index,  svc_by_pid_compare );
+	name_hash_init( &svc_by_name_hash, svc_by_name_hash_key );
+	// As init, orphaned processes get re-parented to us and need reaped too
+	svc_reap_any= (getpid() == 1);
+	// for restart backoff jitter, which only needs to differ between hosts
+	srandom((unsigned) (gettime_mon_frac() ^ getpid()));
+	wake_timer_init(&svc_spawn_timer, svc_spawn_timer_cb, NULL);
+}
+
+/** Arrange to adopt the processes that services orphan, for --subreaper.
+ *
+ * As init they get re-parented to us anyway.  Otherwise, without
+ * PR_SET_CHILD_SUBREAPER they'd go to init and we'd never see the group
+ * empty, so only track groups if it works.
+ */
+void svc_init_subreaper() {
+	if (getpid() != 1) {
+		#ifdef PR_SET_CHILD_SUBREAPER
+		if (prctl(PR_SET_CHILD_SUBREAPER, 1) < 0) {
+			log_error("prctl(PR_SET_CHILD_SUBREAPER): %s", strerror(errno));
+			return;
+		}
+		#else
+		log_error("--subreaper is not supported on this platform");
+		return;
+		#endif
+	}
+	svc_reap_any= true;
+	svc_track_groups= true;
 }
 
 bool svc_preallocate(int count, int data_size_each) {
@@ -104,6 +280,11 @@ bool svc_preallocate(int count, int data_size_each) {
 	
 	if (!(svc_pool= malloc(count * size_each)))
 		return false;
+	if (!name_hash_preallocate(&svc_by_name_hash, count))
+		return false;
+	// every service might have a delayed start pending
+	if (!wake_timer_reserve(count + WAKE_TIMER_RESERVE_EXTRA))
+		return false;
 	svc_pool_size_each= size_each;
 	for (i= 0; i < count; i++)
 		svc_list[i]= (service_t*) (((char*) svc_pool) + size_each * i);
@@ -130,6 +311,9 @@ service_t *svc_new(strseg_t name) {
 	if (svc_list_count >= svc_list_limit)
 		if (svc_pool || !svc_list_resize(svc_list_limit + 32))
 			return NULL;
+	// make sure the constructor can add it to the name hash
+	if (!name_hash_reserve(&svc_by_name_hash, svc_list_count + 1))
+		return NULL;
 
 	// allocate space (unless using a pool)
 	if (svc_pool)
@@ -148,28 +332,32 @@ void svc_delete(service_t *svc) {
 	int i;
 	
 	svc_dtor(svc);
-	// remove the pointer from fd_list and free the mem (or swap within list, for obj pool)
-	for (i= 0; i < svc_list_count; i++) {
-		if (svc_list[i] == svc) {
-			svc_list[i]= svc_list[--svc_list_count];
-			// free the memory (unless object pool)
-			if (svc_pool)
-				svc_list[svc_list_count]= svc;
-			else {
-				svc_list[svc_list_count]= NULL;
-				free(svc);
-			}
-			break;
-		}
+	// remove the pointer from svc_list and free the mem (or swap within list, for obj pool)
+	i= svc->list_idx;
+	assert(svc_list[i] == svc);
+	svc_list[i]= svc_list[--svc_list_count];
+	svc_list[i]->list_idx= i;
+	// free the memory (unless object pool)
+	if (svc_pool)
+		svc_list[svc_list_count]= svc;
+	else {
+		svc_list[svc_list_count]= NULL;
+		free(svc);
 	}
 }
 
-// Requires a buffer as large as sizeof(service_t) + name.len + 1 !
+// With the service pool, requires a buffer of svc_pool_size_each bytes!
 void svc_ctor(service_t *svc, strseg_t name) {
 	assert(name.len < NAME_BUF_SIZE);
 
 	memset(svc, 0, sizeof(service_t));
 	svc->state= SVC_STATE_DOWN;
+	svc->list_idx= svc_list_count - 1; // svc_new already put it at the end of svc_list
+	svc->pidfd= -1;
+	svc->ready_fd= -1;
+	svc->cgroup_user_base= svc->cgroup_sys_base= -1;
+	svc->flap_count= SERVICE_FLAP_COUNT_DEFAULT;
+	svc->flap_window= SERVICE_FLAP_WINDOW_DEFAULT;
 	
 	sigemptyset(&svc->autostart_signals); // probably redundant, but obeying API...
 	
@@ -177,8 +365,8 @@ void svc_ctor(service_t *svc, strseg_t name) {
 	svc->name= (strseg_t){ svc->name_buf, name.len };
 	
 	if (svc_pool) {
-		// When part of a pool, the vars are allocated immediately after the name
-		svc->vars.data= svc->name.data + svc->name.len + 1;
+		// When part of a pool, the vars are allocated immediately after the struct
+		svc->vars.data= (char*) (svc + 1);
 	}
 	
 	RBTreeNode_Init( &svc->name_index_node );
@@ -187,7 +375,10 @@ void svc_ctor(service_t *svc, strseg_t name) {
 	RBTreeNode_Init( &svc->pid_index_node );
 	svc->pid_index_node.Object= svc;
 	
+	wake_timer_init( &svc->start_timer, svc_start_timer_cb, svc );
+	
 	RBTree_Add( &svc_by_name_index, &svc->name_index_node, &name );
+	name_hash_add( &svc_by_name_hash, svc ); // space was reserved by svc_new
 	// unless NDEBUG:
 		svc_check(svc);
 }
@@ -195,9 +386,17 @@ void svc_ctor(service_t *svc, strseg_t name) {
 void svc_dtor(service_t *svc) {
 	svc_set_active(svc, false); // remove from 'active' linked list
 	svc_set_sigwake(svc, false); // remove from 'sigwake' linked list
+	svc_set_depwait(svc, false); // remove from 'depwait' linked list
+	svc_set_spawnq(svc, false); // remove from 'spawnq' linked list
+	svc_set_stopwait(svc, false); // remove from 'stopwait' linked list
+	wake_timer_cancel(&svc->start_timer);
+	svc_pidfd_close(svc);
+	svc_ready_close(svc);
+	svc_exec_plan_reset(svc);
 	if (svc->pid)
 		RBTreeNode_Prune( &svc->pid_index_node );
 	RBTreeNode_Prune( &svc->name_index_node );
+	name_hash_remove( &svc_by_name_hash, svc );
 	// Free the variables pool, but only if service pool feature not enabled
 	if (!svc_pool && svc->vars.data)
 		free((char*)svc->vars.data);
@@ -221,11 +420,24 @@ pid_t   svc_get_pid(service_t *svc) {
 	return svc->pid;
 }
 int     svc_get_wstat(service_t *svc) {
-	return svc->wait_status;
+	return svc->tree_alive? -1 : svc->wait_status;
+}
+const svc_usage_t * svc_get_usage(service_t *svc) {
+	return svc->reap_time? &svc->usage : NULL;
+}
+const svc_usage_t * svc_get_usage_total(service_t *svc, int *runs) {
+	*runs= svc->run_count;
+	return &svc->usage_total;
 }
 int64_t svc_get_up_ts(service_t *svc) {
 	return svc->start_time;
 }
+int64_t svc_get_ready_ts(service_t *svc) {
+	return svc->state == SVC_STATE_READY? svc->ready_time : 0;
+}
+int64_t svc_get_stop_ts(service_t *svc) {
+	return svc->state == SVC_STATE_STOPPING? svc->stop_time : 0;
+}
 int64_t svc_get_reap_ts(service_t *svc) {
 	return svc->reap_time;
 }
@@ -342,7 +554,10 @@ const char * svc_get_argv(service_t *svc) {
  * This can be slightly expensive, but args and fds are typically static.
  */
 bool svc_set_argv(service_t *svc, strseg_t new_argv) {
-	return svc_set_var(svc, STRSEG("args"), new_argv.len <= 0? NULL : &new_argv);
+	if (!svc_set_var(svc, STRSEG("args"), new_argv.len <= 0? NULL : &new_argv))
+		return false;
+	svc_exec_plan_reset(svc);
+	return true;
 }
 
 const char * svc_get_fds(service_t *svc) {
@@ -364,12 +579,14 @@ bool svc_set_fds(service_t *svc, strseg_t new_fds) {
 		svc_set_var(svc, STRSEG("fds"), NULL);
 	else if (!svc_set_var(svc, STRSEG("fds"), &new_fds))
 		return false;
+	svc_exec_plan_reset(svc);
 	
 	// fds have been changed, so re-evaluate whether they are using
 	// the special control handles.
 	svc->uses_control_event= false;
 	svc->uses_control_cmd= false;
 	svc->uses_control_socket= false;
+	svc->uses_control_ready= false;
 	while (strseg_tok_next(&new_fds, '\t', &name)) {
 		if (strseg_cmp(name, STRSEG("control.event")) == 0)
 			svc->uses_control_event= true;
@@ -377,10 +594,184 @@ bool svc_set_fds(service_t *svc, strseg_t new_fds) {
 			svc->uses_control_cmd= true;
 		if (strseg_cmp(name, STRSEG("control.socket")) == 0)
 			svc->uses_control_socket= true;
+		if (strseg_cmp(name, STRSEG("control.ready")) == 0)
+			svc->uses_control_ready= true;
 	}
 	return true;
 }
 
+const char * svc_get_limits(service_t *svc) {
+	strseg_t val;
+	return svc_get_var(svc, STRSEG("limits"), &val)? val.data : "";
+}
+
+/** Check a TSV list of service.limits settings, returning an error message
+ * for the first bad one, or NULL.
+ *
+ * Whether the service gets a cgroup only depends on --cgroup and these
+ * settings (see svc_cgroup_path), so a list that would leave cgroup settings
+ * with nowhere to go is rejected here rather than failing every start.
+ */
+const char * svc_check_limits(strseg_t limits_tsv) {
+	strseg_t setting, key, val, dir= { NULL, 0 };
+	bool cgroup_files= false;
+	const char *err;
+	if (limits_tsv.len <= 0)
+		return NULL;
+	while (strseg_tok_next(&limits_tsv, '\t', &setting)) {
+		if ((err= svc_parse_limit(setting, NULL)))
+			return err;
+		key= setting;
+		strseg_split_1(&key, '=', &val);
+		if (strseg_cmp(key, STRSEG("cgroup")) == 0)
+			dir= val;
+		else if (svc_is_cgroup_file(key))
+			cgroup_files= true;
+	}
+	if (!opt_cgroup && dir.data && dir.data[0] != '/')
+		return "relative cgroup path requires --cgroup";
+	if (!opt_cgroup && !dir.data && cgroup_files)
+		return "cgroup settings require a cgroup (see --cgroup)";
+	return NULL;
+}
+
+/** Set the TSV list of resource settings, which take effect at the next start.
+ * Use svc_check_limits first.
+ */
+bool svc_set_limits(service_t *svc, strseg_t limits_tsv) {
+	if (!svc_set_var(svc, STRSEG("limits"), limits_tsv.len <= 0? NULL : &limits_tsv))
+		return false;
+	svc_exec_plan_reset(svc);
+	return true;
+}
+
+const char * svc_get_requires(service_t *svc) {
+	strseg_t val;
+	return svc_get_var(svc, STRSEG("requires"), &val)? val.data : "";
+}
+
+const char * svc_get_after(service_t *svc) {
+	strseg_t val;
+	return svc_get_var(svc, STRSEG("after"), &val)? val.data : "";
+}
+
+/** Set the TSV list of services which this one requires or starts after.
+ * The names don't need to exist yet.  Use svc_deps_cycle first to make sure
+ * that the new list doesn't make a service wait on itself.
+ */
+static bool svc_set_deps(service_t *svc, const char *var, strseg_t deps_tsv) {
+	if (!svc_set_var(svc, STRSEG(var), deps_tsv.len <= 0? NULL : &deps_tsv))
+		return false;
+	svc->has_deps= svc_get_requires(svc)[0] || svc_get_after(svc)[0];
+	// A service that was waiting might not need to anymore
+	if (svc->depwait_prev_ptr)
+		svc_deps_changed= true;
+	return true;
+}
+
+bool svc_set_requires(service_t *svc, strseg_t deps_tsv) {
+	return svc_set_deps(svc, "requires", deps_tsv);
+}
+
+bool svc_set_after(service_t *svc, strseg_t deps_tsv) {
+	return svc_set_deps(svc, "after", deps_tsv);
+}
+
+// Depth-first search of the dependencies of svc, for target
+static bool svc_deps_reach(service_t *svc, service_t *target) {
+	strseg_t list, name;
+	service_t *dep;
+	int i;
+	if (svc == target)
+		return true;
+	if (svc->dep_visit == svc_dep_visit)
+		return false;
+	svc->dep_visit= svc_dep_visit;
+	for (i= 0; i < 2; i++) {
+		list= STRSEG(i? svc_get_after(svc) : svc_get_requires(svc));
+		while (strseg_tok_next(&list, '\t', &name))
+			if ((dep= svc_by_name(name, false)) && svc_deps_reach(dep, target))
+				return true;
+	}
+	return false;
+}
+
+/** Check whether giving svc the new list of dependencies would create a cycle.
+ * Returns the name of a service in deps_tsv which leads back to svc, or NULL.
+ */
+const char * svc_deps_cycle(service_t *svc, strseg_t deps_tsv) {
+	strseg_t name;
+	service_t *dep;
+	svc_dep_visit++;
+	while (strseg_tok_next(&deps_tsv, '\t', &name))
+		if ((dep= svc_by_name(name, false)) && svc_deps_reach(dep, svc))
+			return svc_get_name(dep);
+	return NULL;
+}
+
+#define SVC_DEPS_READY  0
+#define SVC_DEPS_WAIT   1
+#define SVC_DEPS_FAILED 2
+
+/** Check whether the dependencies of a starting service allow it to start.
+ *
+ * Required services must be up, and the first time this is checked for a
+ * start request, any that are down get started.  Services in the "after"
+ * list only need to not be in the middle of starting, which includes
+ * waiting to report ready.
+ */
+static int svc_check_deps(service_t *svc) {
+	strseg_t list, name;
+	service_t *dep;
+	int ret= SVC_DEPS_READY;
+
+	list= STRSEG(svc_get_requires(svc));
+	while (list.len > 0 && strseg_tok_next(&list, '\t', &name)) {
+		if (!(dep= svc_by_name(name, false))) {
+			log_error("service \"%s\" requires \"%.*s\", which does not exist", svc_get_name(svc), name.len, name.data);
+			return SVC_DEPS_FAILED;
+		}
+		if (dep->state == SVC_STATE_DOWN && !svc->deps_started) {
+			svc_handle_start(dep, wake->now);
+			svc_deps_changed= true; // so svc_run_active runs it right away
+		}
+		if (dep->state == SVC_STATE_DOWN) {
+			log_error("service \"%s\" requires \"%s\", which is down", svc_get_name(svc), svc_get_name(dep));
+			return SVC_DEPS_FAILED;
+		}
+		if (dep->state == SVC_STATE_UP && dep->ready_failed) {
+			log_error("service \"%s\" requires \"%s\", which did not become ready", svc_get_name(svc), svc_get_name(dep));
+			return SVC_DEPS_FAILED;
+		}
+		if (!(dep->state == SVC_STATE_READY || (dep->state == SVC_STATE_UP && !dep->ready_pending)))
+			ret= SVC_DEPS_WAIT;
+	}
+	svc->deps_started= true;
+
+	list= STRSEG(svc_get_after(svc));
+	while (strseg_tok_next(&list, '\t', &name))
+		if ((dep= svc_by_name(name, false)) && (dep->state == SVC_STATE_START
+			|| (dep->state == SVC_STATE_UP && dep->ready_pending && !dep->ready_failed)))
+			ret= SVC_DEPS_WAIT;
+	return ret;
+}
+
+static void svc_set_depwait(service_t *svc, bool depwait) {
+	if (depwait && !svc->depwait_prev_ptr) {
+		svc->depwait_next= svc_depwait_list;
+		if (svc_depwait_list)
+			svc_depwait_list->depwait_prev_ptr= &svc->depwait_next;
+		svc_depwait_list= svc;
+		svc->depwait_prev_ptr= &svc_depwait_list;
+	}
+	else if (!depwait && svc->depwait_prev_ptr) {
+		if (svc->depwait_next)
+			svc->depwait_next->depwait_prev_ptr= svc->depwait_prev_ptr;
+		*svc->depwait_prev_ptr= svc->depwait_next;
+		svc->depwait_prev_ptr= NULL;
+	}
+}
+
 int64_t svc_get_restart_interval(service_t *svc) {
 	return svc->restart_interval;
 }
@@ -392,6 +783,127 @@ bool svc_set_restart_interval(service_t *svc, int64_t interval) {
 	return true;
 }
 
+/** Get the restart backoff settings.  factor_out is 0 if backoff is disabled.
+ */
+void svc_get_backoff(service_t *svc, int *factor_out, int64_t *max_out, int *jitter_out, int64_t *reset_out) {
+	*factor_out= svc->backoff_factor;
+	*max_out= svc->backoff_max;
+	*jitter_out= svc->backoff_jitter;
+	*reset_out= svc->backoff_reset;
+}
+
+/** Set exponential backoff for automatic restarts.
+ *
+ * Each restart of a service which ran for less than 'reset' waits 'factor'
+ * times longer than the previous one, starting from the restart interval
+ * (or 1 second if that is less) and limited to 'max', and then randomly
+ * adjusted by up to 'jitter' percent so that services failing together don't
+ * restart together.  A factor of 0 disables backoff.
+ */
+bool svc_set_backoff(service_t *svc, int factor, int64_t max, int jitter, int64_t reset) {
+	if (factor < 0 || max < 0 || jitter < 0 || jitter > 100 || reset < 0)
+		return false;
+	svc->backoff_factor= factor;
+	svc->backoff_max= max;
+	svc->backoff_jitter= jitter;
+	svc->backoff_reset= reset;
+	svc->restart_backoff= 0;
+	return true;
+}
+
+/** Decide how long to wait before automatically restarting a service which
+ * was just reaped.
+ */
+static int64_t svc_restart_delay(service_t *svc) {
+	int64_t uptime= svc->reap_time - svc->start_time, delay, jitter;
+	
+	if (!svc->backoff_factor)
+		return uptime < svc->restart_interval? svc->restart_interval : 0;
+	
+	// A long enough run means whatever was wrong has been fixed
+	if (uptime >= svc->backoff_reset) {
+		svc->restart_backoff= 0;
+		return 0;
+	}
+	// Start from the restart interval, but at least 1 second, or it would
+	// never grow
+	delay= !svc->restart_backoff? (svc->restart_interval > (1LL<<32)? svc->restart_interval : (1LL<<32))
+		: svc->restart_backoff > svc->backoff_max / svc->backoff_factor? svc->backoff_max
+		: svc->restart_backoff * svc->backoff_factor;
+	if (delay > svc->backoff_max)
+		delay= svc->backoff_max;
+	svc->restart_backoff= delay;
+	
+	// +/- jitter percent, in 1/1024ths.  The intervals are limited to 2^31
+	// seconds, so this can't overflow.
+	if (svc->backoff_jitter) {
+		jitter= delay / 100 * svc->backoff_jitter;
+		delay+= (jitter >> 10) * ((random() & 2047) - 1024);
+	}
+	log_debug("service \"%s\" ran %d seconds, restarting in %d seconds", svc_get_name(svc),
+		(int)(uptime >> 32), (int)(delay >> 32));
+	return delay;
+}
+
+int svc_get_priority(service_t *svc) {
+	return svc->priority;
+}
+
+/** Set the priority for the spawn rate limit.  Takes effect the next time
+ * the service waits for it.
+ */
+bool svc_set_priority(service_t *svc, int priority) {
+	svc->priority= priority;
+	return true;
+}
+
+void svc_get_flap_limit(service_t *svc, int *count, int64_t *window) {
+	*count= svc->flap_count;
+	*window= svc->flap_window;
+}
+
+/** Set how many failures within 'window' pause auto_up for the service, or
+ * 0 for no limit.  The count can't be more than the history holds.
+ */
+bool svc_set_flap_limit(service_t *svc, int count, int64_t window) {
+	if (count < 0 || count > SERVICE_HISTORY_SIZE || (count && window <= 0))
+		return false;
+	svc->flap_count= count;
+	svc->flap_window= count? window : 0;
+	return true;
+}
+
+bool svc_is_flapping(service_t *svc) {
+	return svc->flapping;
+}
+
+/** Get one of the service's recent runs, where 0 is the oldest one that is
+ * still remembered.  Returns false past the most recent.
+ */
+bool svc_get_history(service_t *svc, int idx, int64_t *up_ts, int64_t *reap_ts, int *wstat) {
+	if (idx < 0 || idx >= svc->history_count)
+		return false;
+	idx= (svc->history_next - svc->history_count + idx + SERVICE_HISTORY_SIZE) % SERVICE_HISTORY_SIZE;
+	*up_ts= svc->history[idx].start_time;
+	*reap_ts= svc->history[idx].reap_time;
+	*wstat= svc->history[idx].wait_status;
+	return true;
+}
+
+int64_t svc_get_ready_timeout(service_t *svc) {
+	return svc->ready_timeout;
+}
+
+/** Set how long the service may take to report readiness, or 0 for no limit.
+ * Applies from the next time the service starts.
+ */
+bool svc_set_ready_timeout(service_t *svc, int64_t timeout) {
+	if (timeout < 0)
+		return false;
+	svc->ready_timeout= timeout;
+	return true;
+}
+
 const char * svc_get_triggers(service_t *svc) {
 	strseg_t val;
 	return svc_get_var(svc, STRSEG("triggers"), &val)? val.data : "";
@@ -425,7 +937,7 @@ bool svc_set_triggers(service_t *svc, strseg_t triggers_tsv) {
 	svc_set_sigwake(svc, enable_sigs);
 	
 	// finally, if a relevant signal is un-cleared, start the service.
-	if (svc->auto_restart || svc_check_sigwake(svc)) {
+	if (!svc->flapping && (svc->auto_restart || svc_check_sigwake(svc))) {
 		log_trace("Service needs started now");
 		svc_handle_start(svc, wake->now);
 	}
@@ -479,17 +991,59 @@ bool svc_handle_start(service_t *svc, int64_t when) {
 		log_debug("start service \"%s\" now", svc_get_name(svc));
 		when= wake->now;
 	}
+	if (svc->state == SVC_STATE_DOWN) {
+		svc->deps_started= false;
+		svc->spawn_permit= false;
+		svc->stop_requested= false;
+		svc_set_stopwait(svc, false);
+		if (svc->flapping) {
+			svc->flapping= false;
+			svc->flap_since= wake->now;
+			ctl_notify_svc_flapping(NULL, svc_get_name(svc), 0, 0);
+		}
+	}
 	svc->state= SVC_STATE_START;
 	svc->start_time= (when == 0? 1 : when); // 0 means undefined
 	svc_change_pid(svc, 0);
 	svc->reap_time= 0;
 	svc->wait_status= -1;
-	svc_set_active(svc, true);
+	if (when - wake->now > 0) {
+		// Not active until the timer fires
+		svc_set_active(svc, false);
+		wake_timer_set(&svc->start_timer, svc->start_time);
+	}
+	else {
+		wake_timer_cancel(&svc->start_timer);
+		svc_set_active(svc, true);
+		wake->next= wake->now;
+	}
 	svc_notify_state(svc);
-	wake->next= wake->now;
 	return true;
 }
 
+static void svc_start_timer_cb(wake_timer_t *timer) {
+	service_t *svc= (service_t*) timer->obj;
+	if (svc->state == SVC_STATE_START)
+		svc_set_active(svc, true);
+	// While up, the same timer is the readiness timeout
+	else if (svc->state == SVC_STATE_UP && svc->ready_pending) {
+		log_error("service \"%s\" not ready after %d seconds, terminating it",
+			svc_get_name(svc), (int)(svc->ready_timeout >> 32));
+		svc_ready_close(svc);
+		// Services waiting on this one fail now, rather than when it exits
+		svc->ready_failed= true;
+		if (svc_depwait_list)
+			svc_deps_changed= true;
+		svc_signal_tree(svc, SIGTERM);
+	}
+	// and while stopping, the time to give up on SIGTERM
+	else if (svc->state == SVC_STATE_STOPPING) {
+		log_warn("service \"%s\" still running %d seconds after SIGTERM, sending SIGKILL",
+			svc_get_name(svc), (int)((wake->now - svc->stop_time) >> 32));
+		svc_signal_tree(svc, SIGKILL);
+	}
+}
+
 bool svc_cancel_start(service_t *svc) {
 	if (svc->state != SVC_STATE_START) {
 		log_debug("Can't cancel start for service \"%s\": state is %d", svc_get_name(svc), svc->state);
@@ -498,34 +1052,295 @@ bool svc_cancel_start(service_t *svc) {
 	
 	svc->state= SVC_STATE_DOWN;
 	svc->start_time= 0;
+	svc->restart_reap_time= 0;
+	wake_timer_cancel(&svc->start_timer);
+	svc_set_depwait(svc, false);
+	svc_set_spawnq(svc, false);
 	svc_set_active(svc, false);
 	svc_notify_state(svc);
 	return true;
 }
 
+/** Stop a service: cancel a pending start, or send SIGTERM to a running
+ * service and SIGKILL after 'timeout' if it's still running (or never,
+ * if timeout is negative).  Either way, it won't be restarted by auto_up
+ * until something starts it again.
+ */
+bool svc_handle_stop(service_t *svc, int64_t timeout) {
+	svc->stop_requested= true;
+	svc_set_stopwait(svc, false);
+	switch (svc->state) {
+	case SVC_STATE_START:
+		return svc_cancel_start(svc);
+	case SVC_STATE_UP:
+	case SVC_STATE_READY:
+		svc_begin_stop(svc, timeout);
+		return true;
+	case SVC_STATE_STOPPING:
+		// A shorter timeout replaces the current one
+		if (timeout >= 0 && (!wake_timer_pending(&svc->start_timer)
+			|| svc->start_timer.when - (wake->now + timeout) > 0))
+			wake_timer_set(&svc->start_timer, wake->now + timeout);
+		return true;
+	default:
+		return true; // already down, or about to be
+	}
+}
+
+static void svc_begin_stop(service_t *svc, int64_t timeout) {
+	log_debug("stopping service \"%s\"", svc_get_name(svc));
+	svc_set_stopwait(svc, false);
+	svc_ready_close(svc);
+	svc->stop_time= wake->now;
+	svc->state= SVC_STATE_STOPPING;
+	if (timeout >= 0)
+		wake_timer_set(&svc->start_timer, wake->now + timeout);
+	else
+		wake_timer_cancel(&svc->start_timer);
+	svc_signal_tree(svc, SIGTERM);
+	svc_notify_state(svc);
+}
+
+/** Stop every service, as svc_handle_stop does.  Services are stopped in
+ * parallel, except that a service which other running services require
+ * or start after isn't signalled until those are down.
+ */
+void svc_stop_all(int64_t timeout) {
+	service_t *svc;
+	int i;
+	
+	for (i= 0; i < svc_list_count; i++) {
+		svc= svc_list[i];
+		svc->stop_requested= true;
+		if (svc->state == SVC_STATE_START)
+			svc_cancel_start(svc);
+		else if (svc->state == SVC_STATE_UP || svc->state == SVC_STATE_READY) {
+			svc->stop_timeout= timeout;
+			svc_set_stopwait(svc, true);
+		}
+		else if (svc->state == SVC_STATE_STOPPING)
+			svc_handle_stop(svc, timeout);
+	}
+	svc_deps_changed= true;
+	wake->next= wake->now;
+}
+
+static void svc_set_stopwait(service_t *svc, bool stopwait) {
+	if (stopwait && !svc->stopwait_prev_ptr) {
+		svc->stopwait_next= svc_stopwait_list;
+		if (svc_stopwait_list)
+			svc_stopwait_list->stopwait_prev_ptr= &svc->stopwait_next;
+		svc_stopwait_list= svc;
+		svc->stopwait_prev_ptr= &svc_stopwait_list;
+	}
+	else if (!stopwait && svc->stopwait_prev_ptr) {
+		if (svc->stopwait_next)
+			svc->stopwait_next->stopwait_prev_ptr= svc->stopwait_prev_ptr;
+		*svc->stopwait_prev_ptr= svc->stopwait_next;
+		svc->stopwait_prev_ptr= NULL;
+	}
+}
+
+/** Begin stopping each service on the stopwait list which no running
+ * service depends on.
+ */
+static void svc_stopwait_run() {
+	service_t *svc, *dep, *next;
+	strseg_t list, name;
+	unsigned visit= ++svc_dep_visit;
+	int i;
+	
+	// Mark everything that a service which is still running depends on
+	for (i= 0; i < svc_list_count; i++) {
+		svc= svc_list[i];
+		if (!svc->has_deps || svc->state == SVC_STATE_DOWN || svc->state == SVC_STATE_REAPED)
+			continue;
+		list= STRSEG(svc_get_requires(svc));
+		while (strseg_tok_next(&list, '\t', &name))
+			if ((dep= svc_by_name(name, false)))
+				dep->dep_visit= visit;
+		list= STRSEG(svc_get_after(svc));
+		while (strseg_tok_next(&list, '\t', &name))
+			if ((dep= svc_by_name(name, false)))
+				dep->dep_visit= visit;
+	}
+	for (svc= svc_stopwait_list; svc; svc= next) {
+		next= svc->stopwait_next;
+		if (svc->state != SVC_STATE_UP && svc->state != SVC_STATE_READY)
+			svc_set_stopwait(svc, false);
+		else if (svc->dep_visit != visit)
+			svc_begin_stop(svc, svc->stop_timeout);
+	}
+}
+
 /** Handle the case where a service's pid was reaped with wait().
  * This wakes up the service state machine, to possibly restart the daemon.
  * It is assumed that this is called by main() before iterating the active services.
  */
 void svc_handle_reaped(service_t *svc, int wstat) {
-	if (svc->state == SVC_STATE_UP) {
+	svc_pidfd_close(svc);
+	// The pidfd can come before control.ready in the same wakeup, so read
+	// any line the service wrote before it exited.
+	if (svc->ready_fd >= 0)
+		svc_handle_ready(svc);
+	svc_ready_close(svc);
+	if ((svc->state == SVC_STATE_UP || svc->state == SVC_STATE_READY || svc->state == SVC_STATE_STOPPING)
+		&& svc_track_groups && (svc->tree_alive || svc_tree_alive(svc))
+	) {
+		// The rest of the tree will be reaped as orphans.
+		if (!svc->tree_alive) {
+			log_debug("service \"%s\" pid %d exited, waiting for the rest of its processes",
+				svc_get_name(svc), (int)svc->pid);
+			svc->tree_alive= true;
+			svc->wait_status= wstat;
+		}
+		return;
+	}
+	svc->tree_alive= false;
+	svc_set_stopwait(svc, false);
+	if (svc->state == SVC_STATE_UP || svc->state == SVC_STATE_READY || svc->state == SVC_STATE_STOPPING) {
 		log_trace("Setting service \"%s\" state to reaped", svc_get_name(svc));
 		svc->wait_status= wstat;
 		svc->state= SVC_STATE_REAPED;
 		svc->reap_time= wake->now;
+		svc_usage_finish(svc);
+		svc_history_add(svc);
+		wake_timer_cancel(&svc->start_timer);
 		svc_set_active(svc, true);
 		wake->next= wake->now;
 	}
 	else log_trace("Service \"%s\" pid %d reaped, but service is not up", svc_get_name(svc), svc->pid);
 }
 
+/** Handle the exit of a process that a service left behind.
+ *
+ * Once the last of them is gone, the service is finally reaped, with the
+ * exit status of its main process.
+ */
+void svc_handle_orphan_reaped(service_t *svc, pid_t pid, int wstat) {
+	stats.reap_orphans++;
+	log_debug("reaped pid %d orphaned by service \"%s\"", (int)pid, svc_get_name(svc));
+	if (svc->tree_alive && !svc_tree_alive(svc)) {
+		svc->tree_alive= false;
+		svc_handle_reaped(svc, svc->wait_status);
+	}
+}
+
+/** Check whether any process of the service's run besides the main one is
+ * still alive.
+ *
+ * With a cgroup, that is any process in it, including those which started a
+ * session of their own.  Otherwise it is any process in the group led by the
+ * main process.  (The pid stays reserved by the kernel while it names a
+ * process group, so the group can't be confused with another.)
+ */
+bool svc_tree_alive(service_t *svc) {
+	int populated;
+	if (svc->in_cgroup && (populated= svc_cgroup_populated(svc)) >= 0)
+		return populated;
+	return killpg(svc->pid, 0) == 0 || errno == EPERM;
+}
+
+/** Add the resources used by a reaped process to the service's current run.
+ */
+void svc_charge_rusage(service_t *svc, struct rusage *ru) {
+	svc->usage.user_usec += ru->ru_utime.tv_sec * 1000000LL + ru->ru_utime.tv_usec;
+	svc->usage.sys_usec  += ru->ru_stime.tv_sec * 1000000LL + ru->ru_stime.tv_usec;
+	if (ru->ru_maxrss > svc->usage.maxrss_kb)
+		svc->usage.maxrss_kb= ru->ru_maxrss;
+	svc->usage.nvcsw  += ru->ru_nvcsw;
+	svc->usage.nivcsw += ru->ru_nivcsw;
+}
+
+/** Complete the usage of a run that has ended, and add it to the totals.
+ *
+ * With a cgroup, its CPU time is used instead of wait4's, since it also
+ * counts processes which left the service's process tree.
+ */
+void svc_usage_finish(service_t *svc) {
+	int64_t user, sys;
+	
+	if (svc->cgroup_user_base >= 0 && svc_cgroup_read_cpu(svc, &user, &sys)) {
+		svc->usage.user_usec= user - svc->cgroup_user_base;
+		svc->usage.sys_usec= sys - svc->cgroup_sys_base;
+	}
+	svc->cgroup_user_base= svc->cgroup_sys_base= -1;
+	svc->usage_total.user_usec += svc->usage.user_usec;
+	svc->usage_total.sys_usec  += svc->usage.sys_usec;
+	if (svc->usage.maxrss_kb > svc->usage_total.maxrss_kb)
+		svc->usage_total.maxrss_kb= svc->usage.maxrss_kb;
+	svc->usage_total.nvcsw  += svc->usage.nvcsw;
+	svc->usage_total.nivcsw += svc->usage.nivcsw;
+	svc->run_count++;
+}
+
+/** Record the run that just ended in the service's history.
+ */
+void svc_history_add(service_t *svc) {
+	int i= svc->history_next;
+	svc->history[i].start_time= svc->start_time;
+	svc->history[i].reap_time= svc->reap_time;
+	svc->history[i].wait_status= svc->wait_status;
+	svc->history[i].stopped= svc->stop_requested;
+	svc->history_next= (i + 1) % SERVICE_HISTORY_SIZE;
+	if (svc->history_count < SERVICE_HISTORY_SIZE)
+		svc->history_count++;
+}
+
+/** Pause auto_up for a service which is crash-looping: the last flap_count
+ * runs all failed (exited non-zero, or by a signal other than from
+ * service.stop) within flap_window.  It stays paused until started again.
+ */
+void svc_check_flapping(service_t *svc) {
+	int i, n, failures= 0;
+	
+	if (!svc->flap_count || svc->flapping)
+		return;
+	for (n= 0; n < svc->history_count && failures < svc->flap_count; n++) {
+		i= (svc->history_next - 1 - n + SERVICE_HISTORY_SIZE) % SERVICE_HISTORY_SIZE;
+		if (svc->history[i].stopped
+			|| (WIFEXITED(svc->history[i].wait_status) && WEXITSTATUS(svc->history[i].wait_status) == 0)
+			|| svc->reap_time - svc->history[i].reap_time > svc->flap_window
+			|| svc->history[i].reap_time - svc->flap_since <= 0)
+			break;
+		failures++;
+	}
+	if (failures >= svc->flap_count) {
+		log_warn("service \"%s\" failed %d times within %d seconds, pausing auto_up until it is started",
+			svc_get_name(svc), failures, (int)(svc->flap_window >> 32));
+		svc->flapping= true;
+		ctl_notify_svc_flapping(NULL, svc_get_name(svc), failures, svc->flap_window);
+	}
+}
+
 /** Send a signal to a service iff it is running.
+ *
+ * Once the main process is gone but others in its group remain, the group
+ * is signalled either way.
  */
 bool svc_send_signal(service_t *svc, int signum, bool group) {
 	if (!svc || svc->pid <= 0) return false;
 	
 	log_debug("Sending signal %d to service \"%s\" pid %d", signum, svc_get_name(svc), (int)svc->pid);
-	return 0 == (group? killpg(svc->pid, signum) : kill(svc->pid, signum));
+	// Once the main process is reaped, the pid can be reused unless it still
+	// names a process group, so use the cgroup if there is one.
+	if (svc->tree_alive && svc->in_cgroup)
+		return svc_cgroup_signal(svc, signum);
+	return 0 == (group || svc->tree_alive? killpg(svc->pid, signum) : kill(svc->pid, signum));
+}
+
+/** Signal a service that is being stopped, and with --subreaper, the rest of
+ * its processes: those in its cgroup if it has one, else its process group.
+ * A service which has called setsid() has no group of its own, so it gets
+ * the signal instead, unless its main process is already gone.
+ */
+static bool svc_signal_tree(service_t *svc, int signum) {
+	if (svc_track_groups && svc->in_cgroup && svc_cgroup_signal(svc, signum))
+		return true;
+	if (svc_send_signal(svc, signum, svc_track_groups))
+		return true;
+	return svc_track_groups && errno == ESRCH && !svc->tree_alive
+		&& svc_send_signal(svc, signum, false);
 }
 
 /** Activate or deactivate a service.
@@ -566,39 +1381,139 @@ void svc_run_active() {
 			svc= svc_sigwake_list;
 			while (svc) {
 				next= svc->sigwake_next;
-				if (sigismember(&svc->autostart_signals, signum))
+				if (sigismember(&svc->autostart_signals, signum) && !svc->flapping)
 					svc_handle_start(svc, wake->now);
 				svc= next;
 			}
 			svc_last_signal_ts= sig_ts;
 		}
 
-	// run state machine for any active service
-	svc= svc_active_list;
-	while (svc) {
-		next= svc->active_next;
-		svc_run(svc);
-		svc= next;
+	// run state machine for any active service.  If any of them changed
+	// state while others wait for dependencies, run the waiting ones again,
+	// so a whole chain of dependent services starts in one iteration.
+	// Likewise for services let through the spawn rate limit.
+	do {
+		if (svc_deps_changed) {
+			svc_deps_changed= false;
+			for (svc= svc_depwait_list; svc; svc= svc->depwait_next)
+				svc_set_active(svc, true);
+			if (svc_stopwait_list)
+				svc_stopwait_run();
+		}
+		svc= svc_active_list;
+		while (svc) {
+			next= svc->active_next;
+			svc_run(svc);
+			svc= next;
+		}
+	} while (svc_deps_changed || (svc_spawnq_list && svc_spawn_grant()));
+}
+
+/** Add or remove a service from the queue for the spawn rate limit.
+ *
+ * The queue is ordered by priority, and first-come-first-served within
+ * the same priority.
+ */
+static void svc_set_spawnq(service_t *svc, bool queued) {
+	service_t **pos;
+	if (queued && !svc->spawnq_prev_ptr) {
+		for (pos= &svc_spawnq_list; *pos && (*pos)->priority >= svc->priority; pos= &(*pos)->spawnq_next);
+		svc->spawnq_next= *pos;
+		if (*pos)
+			(*pos)->spawnq_prev_ptr= &svc->spawnq_next;
+		*pos= svc;
+		svc->spawnq_prev_ptr= pos;
+	}
+	else if (!queued && svc->spawnq_prev_ptr) {
+		if (svc->spawnq_next)
+			svc->spawnq_next->spawnq_prev_ptr= svc->spawnq_prev_ptr;
+		*svc->spawnq_prev_ptr= svc->spawnq_next;
+		svc->spawnq_prev_ptr= NULL;
+	}
+}
+
+/** Let services at the head of the spawn queue fork, as many as there are
+ * tokens for.
+ *
+ * Tokens refill at opt_spawn_rate per second, up to one second's worth, so
+ * that is also the most that can fork in one pass of the main loop.  If any
+ * are left waiting, a timer calls this again when the next token is due.
+ * Returns true if any services were activated.
+ */
+static bool svc_spawn_grant() {
+	service_t *svc, *next, *granted= NULL;
+	int64_t elapsed= wake->now - svc_spawn_refill_ts, full= ((int64_t) opt_spawn_rate) << 32;
+	
+	svc_spawn_refill_ts= wake->now;
+	svc_spawn_tokens= (elapsed < 0 || elapsed >= (1LL << 32))? full
+		: svc_spawn_tokens + elapsed * opt_spawn_rate;
+	if (svc_spawn_tokens > full)
+		svc_spawn_tokens= full;
+	
+	// The active list runs the most recently added first, so stack up the
+	// ones we let through (reusing spawnq_next) to add them in reverse.
+	while ((svc= svc_spawnq_list) && svc_spawn_tokens >= (1LL << 32)) {
+		svc_spawn_tokens -= (1LL << 32);
+		svc_set_spawnq(svc, false);
+		svc->spawn_permit= true;
+		svc->spawnq_next= granted;
+		granted= svc;
+	}
+	for (svc= granted; svc; svc= next) {
+		next= svc->spawnq_next;
+		svc->spawnq_next= NULL;
+		svc_set_active(svc, true);
 	}
+	if (svc_spawnq_list)
+		wake_timer_set(&svc_spawn_timer,
+			wake->now + ((1LL << 32) - svc_spawn_tokens + opt_spawn_rate - 1) / opt_spawn_rate);
+	else
+		wake_timer_cancel(&svc_spawn_timer);
+	return granted != NULL;
+}
+
+static void svc_spawn_timer_cb(wake_timer_t *timer) {
+	svc_spawn_grant();
 }
 
 /** Run the state machine for one service.
  */
 void svc_run(service_t *svc) {
+	int deps;
 	re_switch_state:
 	log_trace("service %s state = %d", svc_get_name(svc), svc->state);
 	switch (svc->state) {
 	case SVC_STATE_START:
-		// if not wake time yet,
+		// if not wake time yet, the timer will re-activate us
 		if (svc->start_time - wake->now > 0) {
-			// set main-loop wake time if we're next
-			if (svc->start_time - wake->next < 0)
-				wake->next= svc->start_time;
-			// ensure listed as active
-			svc_set_active(svc, true);
+			if (!wake_timer_pending(&svc->start_timer))
+				wake_timer_set(&svc->start_timer, svc->start_time);
+			svc_set_active(svc, false);
 			break;
 		}
 		
+		// wait for dependencies, if any.  Changes to other services'
+		// states will re-activate us.
+		if (svc->has_deps && (deps= svc_check_deps(svc)) != SVC_DEPS_READY) {
+			if (deps == SVC_DEPS_WAIT) {
+				svc_set_depwait(svc, true);
+				svc_set_active(svc, false);
+			}
+			else
+				svc_cancel_start(svc);
+			break;
+		}
+		svc_set_depwait(svc, false);
+		
+		// With a spawn rate limit, wait in line for svc_spawn_grant to
+		// activate us again.
+		if (opt_spawn_rate && !svc->spawn_permit) {
+			svc_set_spawnq(svc, true);
+			svc_set_active(svc, false);
+			break;
+		}
+		svc->spawn_permit= false;
+		
 		// else we've reached the time to retry
 		if (!svc_do_fork(svc)) {
 			log_info("will retry in %d seconds", (int)( FORK_RETRY_DELAY >> 32 ));
@@ -608,20 +1523,30 @@ void svc_run(service_t *svc) {
 		
 		// service is started
 		svc->start_time= (wake->now? wake->now : 1); // time != 0 hack
+		// wake->now doesn't advance within one pass of the main loop, so
+		// read the clock to see how long the fork took after the reap
+		if (svc->restart_reap_time) {
+			stats_hist_add(&stats.restart, gettime_mon_frac() - svc->restart_reap_time);
+			svc->restart_reap_time= 0;
+		}
 		svc->state= SVC_STATE_UP;
+		if (svc->ready_pending && svc->ready_timeout)
+			wake_timer_set(&svc->start_timer, svc->start_time + svc->ready_timeout);
 		svc_notify_state(svc);
 	case SVC_STATE_UP:
+	case SVC_STATE_READY:
+	case SVC_STATE_STOPPING:
 		svc_set_active(svc, false);
 		// waitpid in main loop will re-activate us and set state to REAPED
 		break;
 	case SVC_STATE_REAPED:
 		svc_notify_state(svc);
 		svc->state= SVC_STATE_DOWN;
-		if (svc->auto_restart || svc_check_sigwake(svc)) {
+		svc_check_flapping(svc);
+		if (!svc->stop_requested && !svc->flapping && (svc->auto_restart || svc_check_sigwake(svc))) {
+			svc->restart_reap_time= svc->reap_time;
 			// if restarting too fast, delay til future
-			svc_handle_start(svc, 
-				(svc->reap_time - svc->start_time < svc->restart_interval)?
-				wake->now + svc->restart_interval : wake->now);
+			svc_handle_start(svc, wake->now + svc_restart_delay(svc));
 			svc_notify_state(svc);
 		}
 		goto re_switch_state;
@@ -641,9 +1566,37 @@ void svc_run(service_t *svc) {
 bool svc_do_fork(service_t *svc) {
 	pid_t pid;
 	int sockets[2]= { -1, -1 };
+	int ready_pipe[2]= { -1, -1 };
+	int cgroup_fd= -1;
+	int *fd_map, i;
+	void *buffer;
+	fd_t *fd;
+	strseg_t name;
+	svc_exec_plan_t *plan;
 	controller_t *ctl= NULL;
 	bool want_ctl_read= svc->uses_control_socket || svc->uses_control_event;
 	bool want_ctl_write= svc->uses_control_socket || svc->uses_control_cmd;
+	// written by a vfork()ed child, so must not live in registers
+	const char * volatile failed_op= NULL;
+	volatile int failed_errno= 0;
+	int64_t fork_ts;
+	#ifdef HAVE_WORKING_VFORK
+	sigset_t all_sigs, old_sigs;
+	#endif
+	
+	// Split the args and fds, unless that was already done since they last
+	// changed.  With the service pool we can't malloc, so use the stack.
+	if (!(plan= svc->exec_plan)) {
+		i= svc_exec_plan_size(svc);
+		if (svc_pool)
+			plan= svc_exec_plan_build(svc, alloca(i));
+		else if ((buffer= malloc(i)))
+			plan= svc->exec_plan= svc_exec_plan_build(svc, buffer);
+		else {
+			log_error("can't allocate exec plan");
+			return false;
+		}
+	}
 	
 	// If this service uses the control.{socket,cmd,event} file handles,
 	// then we need to create a socket, and attach to a new controller
@@ -681,32 +1634,100 @@ bool svc_do_fork(service_t *svc) {
 		}
 	}
 	
-	if ((pid= fork()) < 0) {
-		log_error("fork failed: %s", strerror(errno));
-		goto fail;
+	// If the service reports readiness, it gets the write end of a pipe,
+	// and is "up" but not "ready" until it writes a line to it.
+	if (svc->uses_control_ready) {
+		if (0 != pipe(ready_pipe)
+			|| fcntl(ready_pipe[0], F_SETFD, FD_CLOEXEC) < 0
+			|| !fd_set_nonblock(ready_pipe[0])
+		) {
+			log_error("can't create readiness pipe: %s", strerror(errno));
+			goto fail;
+		}
 	}
 	
-	// Are we the client?  perform exec
-	if (pid == 0) {
-		if (sockets[0] >= 0)
-			close(sockets[0]);
-		if (sockets[1] >= 0) {
-			// Store the FD number of the client's socket in each of the FD objects
-			// which svc_do_exec might be looking at.
-			fd_set_fdnum(fd_by_name(STRSEG("control.socket")), sockets[1]);
-			fd_set_fdnum(fd_by_name(STRSEG("control.cmd")), sockets[1]);
-			fd_set_fdnum(fd_by_name(STRSEG("control.event")), sockets[1]);
+	// The child joins its cgroup by writing to cgroup.procs, which we open
+	// for it after applying the cgroup's settings.
+	if (!svc_cgroup_prepare(svc, &cgroup_fd))
+		goto fail;
+	
+	// Resolve the fd names to numbers here, so the child has nothing to look up.
+	// The control.{socket,cmd,event} handles are the client's end of the socketpair.
+	fd_map= alloca(plan->fd_count * sizeof(int));
+	for (i= 0; i < plan->fd_count; i++) {
+		name= plan->fd_names[i];
+		if (name.len == 1 && name.data[0] == '-')
+			fd_map[i]= -1; // dash means "closed"
+		else if (strseg_cmp(name, STRSEG("control.socket")) == 0
+			|| strseg_cmp(name, STRSEG("control.cmd")) == 0
+			|| strseg_cmp(name, STRSEG("control.event")) == 0)
+			fd_map[i]= sockets[1];
+		else if (strseg_cmp(name, STRSEG("control.ready")) == 0)
+			fd_map[i]= ready_pipe[1];
+		else if ((fd= fd_by_name(name)))
+			fd_map[i]= fd_get_fdnum(fd);
+		else {
+			log_error("file descriptor \"%.*s\" does not exist", name.len, name.data);
+			goto fail;
 		}
-		svc_do_exec(svc);
-		// never returns
-		assert(0);
 	}
 	
+	#ifdef HAVE_WORKING_VFORK
+	// The child borrows our memory until it calls exec, so block all signals
+	// to keep our handlers out of it.  It reports failure in failed_op/errno
+	// rather than logging.
+	sigfillset(&all_sigs);
+	sigprocmask(SIG_SETMASK, &all_sigs, &old_sigs);
+	fork_ts= gettime_mon_frac();
+	if ((pid= vfork()) == 0) {
+		failed_op= svc_exec_child(plan, fd_map, cgroup_fd);
+		failed_errno= errno;
+		_exit(EXIT_INVALID_ENVIRONMENT);
+	}
+	sigprocmask(SIG_SETMASK, &old_sigs, NULL);
+	#else
+	fork_ts= gettime_mon_frac();
+	if ((pid= fork()) == 0) {
+		svc_log_exec_failure(plan, svc_exec_child(plan, fd_map, cgroup_fd), errno);
+		_exit(EXIT_INVALID_ENVIRONMENT);
+	}
+	// The child does this too, but it might not have yet, and a signal to
+	// the group can't wait for it.  (it fails harmlessly if the child has
+	// already exec'd)
+	if (pid > 0 && svc_track_groups)
+		setpgid(pid, pid);
+	#endif
+	if (pid < 0) {
+		log_error("fork failed: %s", strerror(errno));
+		goto fail;
+	}
+	// With vfork, we resume once the child has called exec
+	stats_hist_add(&stats.spawn, gettime_mon_frac() - fork_ts);
+	// Like exec failing in a forked child, the service still "started".
+	if (failed_op)
+		svc_log_exec_failure(plan, failed_op, failed_errno);
+	
 	if (sockets[1] >= 0)
 		close(sockets[1]);
+	if (cgroup_fd >= 0)
+		close(cgroup_fd);
 
 	svc_change_pid(svc, pid);
+	svc_pidfd_open(svc);
+	memset(&svc->usage, 0, sizeof(svc->usage));
 	
+	svc->ready_pending= false;
+	svc->ready_failed= false;
+	if (ready_pipe[0] >= 0) {
+		close(ready_pipe[1]);
+		// If we can't watch the pipe, the service can't be held waiting for it
+		if (svc_watch_fd(svc, ready_pipe[0])) {
+			svc->ready_fd= ready_pipe[0];
+			svc->ready_pending= true;
+		}
+		else
+			close(ready_pipe[0]);
+	}
 	return true;
 
 	fail: // cleanup based on what was initialized
@@ -719,48 +1740,49 @@ bool svc_do_fork(service_t *svc) {
 		close(sockets[0]);
 	if (sockets[1] >= 0)
 		close(sockets[1]);
+	if (ready_pipe[0] >= 0) {
+		close(ready_pipe[0]);
+		close(ready_pipe[1]);
+	}
+	if (cgroup_fd >= 0)
+		close(cgroup_fd);
 	return false;
 }
 
-/** Perform the exec() to launch the service's daemon (or runscript)
- * This sets up FDs, and calls exec() with the argv for the service.
+/** Move fds into place and exec the service's command, in the child process.
+ *
+ * This might be running in a vfork()ed child which shares our memory, so it
+ * must not log, allocate, or modify anything other than the disposable fd_map.
+ * It only returns on failure, returning the name of the failed call with
+ * errno set.
  */
-void svc_do_exec(service_t *svc) {
-	int fd_count, arg_count, i;
-	int *fd_list= NULL;
-	fd_t *fd;
-	char **argv, *arg_spec, *p;
-	strseg_t fd_spec, tmp, fd_name;
-
+const char * svc_exec_child(svc_exec_plan_t *plan, int *fd_map, int cgroup_fd) {
+	int i, fd_count= plan->fd_count;
+	
 	// clear signal mask and handlers
-	log_trace("resetting signal mask");
 	sig_reset_for_exec();
 	
-	fd_spec.data= svc_get_fds(svc);
-	fd_spec.len= strlen(fd_spec.data);
-	fd_count= 0;
-	if (fd_spec.len) {
-		// count our file descriptors, to allocate buffer
-		tmp= fd_spec;
-		while (strseg_tok_next(&tmp, '\t', &fd_name))
-			fd_count++;
-		fd_list= alloca(fd_count);
-		// now iterate again to resolve them from name to number
-		fd_count= 0;
-		tmp= fd_spec;
-		while (strseg_tok_next(&tmp, '\t', &fd_name)) {
-			if (fd_name.len <= 0)
-				log_warn("ignoring zero-length file descriptor name");
-			else if (fd_name.len == 1 && fd_name.data[0] == '-')
-				fd_list[fd_count++]= -1; // dash means "closed"
-			else if ((fd= fd_by_name(fd_name)))
-				fd_list[fd_count++]= fd_get_fdnum(fd);
-			else {
-				log_error("file descriptor \"%.*s\" does not exist", fd_name.len, fd_name.data);
-				abort();
-			}
-		}
-	}
+	// Join the cgroup first, so that nothing we do is charged to ours.
+	// "0" means the process doing the write.
+	if (cgroup_fd >= 0 && write(cgroup_fd, "0", 1) != 1)
+		return "write(cgroup.procs)";
+	for (i= 0; i < plan->rlimit_count; i++)
+		if (setrlimit(plan->rlimits[i].resource, &plan->rlimits[i].lim) < 0)
+			return "setrlimit";
+	if (plan->set_nice && setpriority(PRIO_PROCESS, 0, plan->nice) < 0)
+		return "setpriority";
+	#ifdef SYS_ioprio_set
+	if (plan->set_ioprio && syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0, plan->ioprio) < 0)
+		return "ioprio_set";
+	#endif
+	#ifdef CPU_SETSIZE
+	if (plan->set_affinity && sched_setaffinity(0, sizeof(plan->affinity), &plan->affinity) < 0)
+		return "sched_setaffinity";
+	#endif
+	
+	// With --subreaper, the service's processes are known by their group
+	if (svc_track_groups && setpgid(0, 0) < 0)
+		return "setpgid";
 	
 	// Now move them into correct places
 	// But first, we need to make sure all the file descriptors we're about to copy
@@ -768,60 +1790,519 @@ void svc_do_exec(service_t *svc) {
 	for (i= 0; i < fd_count; i++) {
 		// If file descriptor is less than the max destination, dup it to a higher number
 		// We have no way to know which higher numbers are safe, so repeat until we get one.
-		log_trace("fd_list[%d]= %d", i, fd_list[i]);
-		while (fd_list[i] >= 0 && fd_list[i] < fd_count) {
-			fd_list[i]= dup(fd_list[i]);
-			if (fd_list[i] < 0) {
-				log_error("Failed to dup file descriptor %d", fd_list[i]);
-				abort();
-			}
-			log_trace("  dup'd to %d", fd_list[i]);
-		}
+		while (fd_map[i] >= 0 && fd_map[i] < fd_count)
+			if ((fd_map[i]= dup(fd_map[i])) < 0)
+				return "dup";
 	}
 	// Now dup2 each into its correct slot, and close the rest
 	for (i= 0; i < fd_count; i++) {
-		if (fd_list[i] >= 0) {
-			if (dup2(fd_list[i], i) < 0) {
-				log_error("Failed to dup file descriptor %d to %d", fd_list[i], i);
-				abort();
-			}
-		}
-		else close(i);
+		if (fd_map[i] < 0)
+			close(i);
+		else if (dup2(fd_map[i], i) < 0)
+			return "dup2";
 	}
-	// close all fd we aren't keeping
-	while (i < FD_SETSIZE) close(i++);
+	// close all fd we aren't keeping, in one call if the kernel can
+	#ifdef SYS_close_range
+	if (syscall(SYS_close_range, fd_count, ~0U, 0) != 0)
+	#endif
+		for (i= fd_count; i < FD_SETSIZE; i++)
+			close(i);
 	
-	// just modify the buffer in the service object, since we're execing soon
-	arg_spec= (char*) svc_get_argv(svc);
-	// convert argv into pointers
-	// count, allocate, then populate
-	for (arg_count= 1, p= arg_spec; *p; p++)
+	execvp(plan->argv[0], plan->argv);
+	return "exec";
+}
+
+void svc_log_exec_failure(svc_exec_plan_t *plan, const char *failed_op, int err) {
+	if (strcmp(failed_op, "exec") == 0)
+		log_error("exec(%s, ...) failed: %s", plan->argv[0], strerror(err));
+	else
+		log_error("%s failed while starting %s: %s", failed_op, plan->argv[0], strerror(err));
+}
+
+// Count the fields of a tab-separated string
+static int count_tsv_fields(const char *p) {
+	int n= 1;
+	for (; *p; p++)
 		if (*p == '\t')
-			arg_count++;
-	argv= alloca(arg_count+1);
-	// then populate
+			n++;
+	return n;
+}
+
+/** Compute the number of bytes needed for the service's exec plan.
+ */
+int svc_exec_plan_size(service_t *svc) {
+	const char *args= svc_get_argv(svc), *fds= svc_get_fds(svc);
+	return sizeof(svc_exec_plan_t)
+		+ count_tsv_fields(fds) * sizeof(strseg_t)
+		+ (count_tsv_fields(args) + 1) * sizeof(char*)
+		+ strlen(fds) + 1 + strlen(args) + 1;
+}
+
+/** Split the service's fds and args into an exec plan, within the given buffer.
+ *
+ * The buffer must be at least svc_exec_plan_size() bytes.  The plan holds its
+ * own copy of the strings, so the child process never parses or writes them.
+ */
+svc_exec_plan_t * svc_exec_plan_build(service_t *svc, void *buffer) {
+	svc_exec_plan_t *plan= (svc_exec_plan_t*) buffer;
+	const char *args= svc_get_argv(svc), *fds= svc_get_fds(svc);
+	strseg_t fd_spec, fd_name, limits, setting;
+	char *p;
+	int i;
+	
+	plan->fd_names= (strseg_t*) (plan + 1);
+	plan->argv= (char**) (plan->fd_names + count_tsv_fields(fds));
+	p= (char*) (plan->argv + count_tsv_fields(args) + 1);
+	
+	// copy the fd spec, and split it into names which point into the copy
+	fd_spec.data= strcpy(p, fds);
+	fd_spec.len= strlen(fds);
+	p+= fd_spec.len + 1;
+	plan->fd_count= 0;
+	if (fd_spec.len) {
+		while (strseg_tok_next(&fd_spec, '\t', &fd_name)) {
+			if (fd_name.len <= 0)
+				log_warn("ignoring zero-length file descriptor name");
+			else
+				plan->fd_names[plan->fd_count++]= fd_name;
+		}
+	}
+	
+	// copy the args, converting tabs to NULs and recording the pointers
+	strcpy(p, args);
 	i= 0;
-	for (argv[0]= p= arg_spec; *p; p++)
+	for (plan->argv[0]= p; *p; p++)
 		if (*p == '\t') {
 			*p= '\0';
-			argv[++i]= p+1;
+			plan->argv[++i]= p+1;
+		}
+	plan->argv[++i]= NULL;
+	
+	// and the resource settings, which were checked when they were set
+	plan->rlimit_count= 0;
+	plan->set_nice= plan->set_ioprio= plan->set_affinity= false;
+	limits= STRSEG(svc_get_limits(svc));
+	if (limits.len)
+		while (strseg_tok_next(&limits, '\t', &setting))
+			svc_parse_limit(setting, plan);
+	return plan;
+}
+
+static bool svc_parse_rlim(strseg_t str, rlim_t *val) {
+	int64_t n;
+	if (strseg_cmp(str, STRSEG("unlimited")) == 0) {
+		*val= RLIM_INFINITY;
+		return true;
+	}
+	if (!strseg_parse_size(&str, &n) || str.len || n < 0)
+		return false;
+	*val= (rlim_t) n;
+	return true;
+}
+
+/** Parse one KEY=VALUE setting of service.limits, returning an error message
+ * or NULL.  If plan is not NULL, the setting is stored in it for the child to
+ * apply.  Settings for the cgroup are only checked here; svc_cgroup_prepare
+ * writes them.
+ */
+const char * svc_parse_limit(strseg_t setting, svc_exec_plan_t *plan) {
+	strseg_t key= setting, val, hard;
+	struct rlimit lim;
+	int64_t n, m;
+	int i;
+	
+	if (!strseg_split_1(&key, '=', &val) || !key.len || !val.len)
+		return "expected KEY=VALUE";
+	if (strseg_cmp(key, STRSEG("cgroup")) == 0 || svc_is_cgroup_file(key))
+		return NULL;
+	
+	// rlimit.NAME=SOFT[:HARD]
+	if (key.len > 7 && memcmp(key.data, "rlimit.", 7) == 0) {
+		key.data += 7;
+		key.len -= 7;
+		for (i= 0; i < SVC_RLIMIT_COUNT; i++)
+			if (strseg_cmp(key, STRSEG(svc_rlimit_names[i].name)) == 0)
+				break;
+		if (i >= SVC_RLIMIT_COUNT)
+			return "unknown rlimit";
+		if (strseg_split_1(&val, ':', &hard)) {
+			if (!svc_parse_rlim(val, &lim.rlim_cur) || !svc_parse_rlim(hard, &lim.rlim_max))
+				return "invalid rlimit";
+		}
+		else if (!svc_parse_rlim(val, &lim.rlim_cur))
+			return "invalid rlimit";
+		else
+			lim.rlim_max= lim.rlim_cur;
+		if (lim.rlim_max != RLIM_INFINITY && (lim.rlim_cur == RLIM_INFINITY || lim.rlim_cur > lim.rlim_max))
+			return "rlimit soft limit is above hard limit";
+		if (plan) {
+			// a repeated setting replaces the earlier one
+			for (n= 0; n < plan->rlimit_count; n++)
+				if (plan->rlimits[n].resource == svc_rlimit_names[i].resource)
+					break;
+			plan->rlimits[n].resource= svc_rlimit_names[i].resource;
+			plan->rlimits[n].lim= lim;
+			if (n == plan->rlimit_count)
+				plan->rlimit_count++;
+		}
+		return NULL;
+	}
+	// nice=N
+	if (strseg_cmp(key, STRSEG("nice")) == 0) {
+		if (!strseg_atoi(&val, &n) || val.len || n < -20 || n > 19)
+			return "nice must be -20..19";
+		if (plan) {
+			plan->set_nice= true;
+			plan->nice= (int) n;
+		}
+		return NULL;
+	}
+	// ionice=CLASS[:LEVEL]
+	if (strseg_cmp(key, STRSEG("ionice")) == 0) {
+		#ifdef SYS_ioprio_set
+		m= 4; // kernel's default level
+		if (strseg_split_1(&val, ':', &hard) && (!strseg_atoi(&hard, &m) || hard.len || m < 0 || m > 7))
+			return "ionice level must be 0..7";
+		if (strseg_cmp(val, STRSEG("realtime")) == 0)         n= 1;
+		else if (strseg_cmp(val, STRSEG("best-effort")) == 0) n= 2;
+		else if (strseg_cmp(val, STRSEG("idle")) == 0)        n= 3, m= 0;
+		else
+			return "ionice class must be realtime, best-effort, or idle";
+		if (plan) {
+			plan->set_ioprio= true;
+			plan->ioprio= (int) ((n << 13) | m);
+		}
+		return NULL;
+		#else
+		return "ionice is not supported on this platform";
+		#endif
+	}
+	// cpus=LIST, like 0-3,6
+	if (strseg_cmp(key, STRSEG("cpus")) == 0) {
+		#ifdef CPU_SETSIZE
+		if (plan) {
+			plan->set_affinity= true;
+			CPU_ZERO(&plan->affinity);
+		}
+		while (strseg_tok_next(&val, ',', &hard)) {
+			if (!strseg_atoi(&hard, &n) || n < 0)
+				return "invalid cpu list";
+			m= n;
+			if (hard.len && (hard.data[0] != '-' || (hard.data++, hard.len--, !strseg_atoi(&hard, &m)) || m < n))
+				return "invalid cpu list";
+			if (hard.len || m >= CPU_SETSIZE)
+				return "invalid cpu list";
+			if (plan)
+				for (; n <= m; n++)
+					CPU_SET(n, &plan->affinity);
+		}
+		return NULL;
+		#else
+		return "cpus is not supported on this platform";
+		#endif
+	}
+	return "unknown setting";
+}
+
+bool svc_is_cgroup_file(strseg_t name) {
+	int i;
+	for (i= 0; svc_cgroup_files[i]; i++)
+		if (strseg_cmp(name, STRSEG(svc_cgroup_files[i])) == 0)
+			return true;
+	return false;
+}
+
+/** Write the path of the service's cgroup into buf, returning its length,
+ * or 0 if it doesn't have one, or -1 if it doesn't fit.
+ *
+ * With --cgroup DIR, each service has the cgroup DIR/NAME, unless a
+ * "cgroup=PATH" setting names another (relative to DIR, if not absolute).
+ * Without --cgroup, only services with an absolute cgroup=PATH have one.
+ */
+int svc_cgroup_path(service_t *svc, char *buf, int buf_size) {
+	strseg_t limits= STRSEG(svc_get_limits(svc)), setting, key, val, dir= { NULL, 0 };
+	int len;
+	
+	while (strseg_tok_next(&limits, '\t', &setting)) {
+		key= setting;
+		if (strseg_split_1(&key, '=', &val) && strseg_cmp(key, STRSEG("cgroup")) == 0)
+			dir= val;
+	}
+	if (dir.data && dir.data[0] == '/')
+		len= snprintf(buf, buf_size, "%.*s", dir.len, dir.data);
+	else if (opt_cgroup && dir.data)
+		len= snprintf(buf, buf_size, "%s/%.*s", opt_cgroup, dir.len, dir.data);
+	else if (opt_cgroup)
+		len= snprintf(buf, buf_size, "%s/%s", opt_cgroup, svc_get_name(svc));
+	else
+		return 0;
+	return len < buf_size? len : -1;
+}
+
+/** Create the service's cgroup if needed, write its cgroup settings, and open
+ * its cgroup.procs for the child to join.  procs_fd is -1 if the service
+ * doesn't have a cgroup.
+ */
+bool svc_cgroup_prepare(service_t *svc, int *procs_fd) {
+	char path[PATH_MAX];
+	strseg_t limits= STRSEG(svc_get_limits(svc)), setting, key, val;
+	int len, fd;
+	
+	*procs_fd= -1;
+	svc->in_cgroup= false;
+	svc->cgroup_user_base= svc->cgroup_sys_base= -1;
+	// leave room to append the name of an interface file
+	if ((len= svc_cgroup_path(svc, path, sizeof(path) - 32)) < 0) {
+		log_error("cgroup path for service \"%s\" is too long", svc_get_name(svc));
+		return false;
+	}
+	// svc_check_limits doesn't allow cgroup settings without a cgroup
+	if (len == 0)
+		return true;
+	if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+		log_error("mkdir(%s): %s", path, strerror(errno));
+		return false;
+	}
+	while (strseg_tok_next(&limits, '\t', &setting)) {
+		key= setting;
+		if (!strseg_split_1(&key, '=', &val) || !svc_is_cgroup_file(key))
+			continue;
+		snprintf(path + len, sizeof(path) - len, "/%.*s", key.len, key.data);
+		if ((fd= open(path, O_WRONLY | O_CLOEXEC)) < 0 || write(fd, val.data, val.len) != val.len) {
+			log_error("can't write \"%.*s\" to %s: %s", val.len, val.data, path, strerror(errno));
+			if (fd >= 0)
+				close(fd);
+			return false;
 		}
-	argv[++i]= NULL;
+		close(fd);
+	}
+	snprintf(path + len, sizeof(path) - len, "/cgroup.procs");
+	if ((*procs_fd= open(path, O_WRONLY | O_CLOEXEC)) < 0) {
+		log_error("open(%s): %s", path, strerror(errno));
+		return false;
+	}
+	svc->in_cgroup= true;
+	// The cgroup's CPU time is cumulative, so remember where this run began
+	if (!svc_cgroup_read_cpu(svc, &svc->cgroup_user_base, &svc->cgroup_sys_base))
+		svc->cgroup_user_base= svc->cgroup_sys_base= -1;
+	return true;
+}
+
+/** Read the user and system CPU time of the service's cgroup from cpu.stat.
+ */
+bool svc_cgroup_read_cpu(service_t *svc, int64_t *user_usec, int64_t *sys_usec) {
+	char path[PATH_MAX], buf[512], *user, *sys;
+	int len, fd, n;
 	
-	execvp(argv[0], argv);
-	log_error("exec(%s, ...) failed: %s", argv[0], strerror(errno));
-	_exit(EXIT_INVALID_ENVIRONMENT);
+	if ((len= svc_cgroup_path(svc, path, sizeof(path) - 16)) <= 0)
+		return false;
+	snprintf(path + len, sizeof(path) - len, "/cpu.stat");
+	if ((fd= open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return false;
+	n= read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return false;
+	buf[n]= '\0';
+	// the first line is usage_usec, so these each follow a newline
+	if (!(user= strstr(buf, "\nuser_usec ")) || !(sys= strstr(buf, "\nsystem_usec ")))
+		return false;
+	*user_usec= strtoll(user + 11, NULL, 10);
+	*sys_usec= strtoll(sys + 13, NULL, 10);
+	return true;
+}
+
+/** Read "populated" from the service's cgroup.events, which is 1 while any
+ * process is in the cgroup (or below it).  Returns -1 if it can't be read.
+ */
+int svc_cgroup_populated(service_t *svc) {
+	char path[PATH_MAX], buf[256], *p;
+	int len, fd, n;
+	
+	if ((len= svc_cgroup_path(svc, path, sizeof(path) - 16)) <= 0)
+		return -1;
+	snprintf(path + len, sizeof(path) - len, "/cgroup.events");
+	if ((fd= open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	n= read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	buf[n]= '\0';
+	if (!(p= strstr(buf, "populated ")) || (p != buf && p[-1] != '\n'))
+		return -1;
+	return p[10] == '1';
+}
+
+/** Send a signal to every process in the service's cgroup.
+ *
+ * Returns true if any process got it, else false with errno set (ESRCH if
+ * the cgroup was empty).
+ */
+bool svc_cgroup_signal(service_t *svc, int signum) {
+	char path[PATH_MAX], buf[1024];
+	int len, fd, n, ofs= 0, sent= 0, err= ESRCH;
+	char *p, *eol;
+	
+	if ((len= svc_cgroup_path(svc, path, sizeof(path) - 16)) <= 0)
+		return false;
+	snprintf(path + len, sizeof(path) - len, "/cgroup.procs");
+	if ((fd= open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return false;
+	// one pid per line; carry a partial line over to the next read
+	while ((n= read(fd, buf + ofs, sizeof(buf) - 1 - ofs)) > 0) {
+		buf[ofs + n]= '\0';
+		for (p= buf; (eol= strchr(p, '\n')); p= eol + 1) {
+			if (kill((pid_t) strtol(p, NULL, 10), signum) == 0)
+				sent++;
+			else if (errno != ESRCH)
+				err= errno;
+		}
+		ofs= buf + ofs + n - p;
+		memmove(buf, p, ofs);
+	}
+	close(fd);
+	log_debug("signal %d sent to %d processes in cgroup of \"%s\"", signum, sent, svc_get_name(svc));
+	errno= err;
+	return sent > 0;
+}
+
+/** Find the mount point of the cgroup v2 hierarchy, or NULL if there isn't one.
+ */
+static const char * svc_cgroup_mount() {
+	static char mount[PATH_MAX];
+	static int found= -1;
+	char buf[4096], *p, *eol;
+	strseg_t line, field;
+	int fd, n, ofs= 0, i;
+	
+	if (found >= 0)
+		return found? mount : NULL;
+	found= 0;
+	if ((fd= open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC)) < 0)
+		return NULL;
+	// ID PARENT MAJ:MIN ROOT MOUNT_POINT OPTIONS... - FSTYPE SOURCE OPTIONS
+	while (!found && (n= read(fd, buf + ofs, sizeof(buf) - 1 - ofs)) > 0) {
+		buf[ofs + n]= '\0';
+		for (p= buf; !found && (eol= strchr(p, '\n')); p= eol + 1) {
+			*eol= '\0';
+			if (!strstr(p, " - cgroup2 "))
+				continue;
+			line= STRSEG(p);
+			for (i= 0; i < 5 && strseg_tok_next(&line, ' ', &field); i++);
+			if (i == 5 && field.len < sizeof(mount)) {
+				memcpy(mount, field.data, field.len);
+				mount[field.len]= '\0';
+				found= 1;
+			}
+		}
+		// carry a partial line over to the next read
+		ofs= buf + ofs + n - p;
+		memmove(buf, p, ofs);
+	}
+	close(fd);
+	return found? mount : NULL;
+}
+
+/** Find the running service whose cgroup holds a process (or a zombie).
+ *
+ * /proc/PID/cgroup names the cgroup relative to the cgroup2 mount, so
+ * compare that to each service's cgroup path below the mount point.  A
+ * cgroup created beneath the service's counts as the service's.
+ */
+service_t * svc_by_cgroup_of(pid_t pid) {
+	char path[64], buf[PATH_MAX], svc_path[PATH_MAX], *rel, *eol;
+	const char *mount= svc_cgroup_mount();
+	int mount_len, len, fd, n, i;
+	service_t *svc;
+	
+	if (!mount)
+		return NULL;
+	snprintf(path, sizeof(path), "/proc/%d/cgroup", (int) pid);
+	if ((fd= open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return NULL;
+	n= read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return NULL;
+	buf[n]= '\0';
+	// the unified hierarchy's line is "0::PATH"
+	if (!strncmp(buf, "0::", 3))
+		rel= buf + 3;
+	else if ((rel= strstr(buf, "\n0::")))
+		rel += 4;
+	else
+		return NULL;
+	if ((eol= strchr(rel, '\n')))
+		*eol= '\0';
+	mount_len= strcmp(mount, "/") == 0? 0 : strlen(mount);
+	for (i= 0; i < svc_list_count; i++) {
+		svc= svc_list[i];
+		if (!svc->in_cgroup || svc->pid <= 0
+			|| (len= svc_cgroup_path(svc, svc_path, sizeof(svc_path))) <= mount_len
+			|| strncmp(svc_path, mount, mount_len) != 0)
+			continue;
+		len -= mount_len;
+		if (strncmp(rel, svc_path + mount_len, len) == 0 && (rel[len] == '\0' || rel[len] == '/'))
+			return svc;
+	}
+	return NULL;
+}
+
+/** Set up the --cgroup directory, and delegate the controllers that the
+ * services' settings need to the cgroups below it.  This fails if
+ * daemonproxy is itself in that cgroup.
+ */
+void svc_init_cgroup() {
+	static const char * const controllers[]= { "+cpu", "+io", "+memory", "+pids", NULL };
+	char path[PATH_MAX];
+	int i, fd;
+	
+	if (mkdir(opt_cgroup, 0755) < 0 && errno != EEXIST) {
+		log_error("mkdir(%s): %s", opt_cgroup, strerror(errno));
+		return;
+	}
+	snprintf(path, sizeof(path), "%s/cgroup.subtree_control", opt_cgroup);
+	if ((fd= open(path, O_WRONLY | O_CLOEXEC)) < 0) {
+		log_error("open(%s): %s", path, strerror(errno));
+		return;
+	}
+	// One at a time, so one that isn't available doesn't stop the rest.
+	// ENOENT means it isn't available to us at all, which is only a problem
+	// if a service uses its settings.
+	for (i= 0; controllers[i]; i++) {
+		if (write(fd, controllers[i], strlen(controllers[i])) >= 0)
+			continue;
+		if (errno == ENOENT)
+			log_debug("cgroup controller %s is not available in %s", controllers[i]+1, opt_cgroup);
+		else
+			log_warn("can't enable cgroup controller %s in %s: %s", controllers[i]+1, opt_cgroup, strerror(errno));
+	}
+	close(fd);
+}
+
+/** Discard the exec plan, after the args or fds change.
+ */
+void svc_exec_plan_reset(service_t *svc) {
+	// only ever malloc'd when not using the service pool
+	if (svc->exec_plan) {
+		free(svc->exec_plan);
+		svc->exec_plan= NULL;
+	}
 }
 	
 void svc_notify_state(service_t *svc) {
 	log_trace("service %s state = %d", svc_get_name(svc), svc->state);
-	ctl_notify_svc_state(NULL, svc->name.data, svc->start_time, svc->reap_time, svc->wait_status, svc->pid);
+	if (svc_depwait_list || svc_stopwait_list)
+		svc_deps_changed= true;
+	ctl_notify_svc_state(NULL, svc->name.data, svc->start_time, svc_get_ready_ts(svc), svc_get_stop_ts(svc),
+		svc->reap_time, svc->wait_status, svc->pid, svc_get_usage(svc));
 }
 
 service_t *svc_by_name(strseg_t name, bool create) {
-	RBTreeSearch s= RBTree_Find( &svc_by_name_index, &name );
-	if (s.Relation == 0)
-		return (service_t*) s.Nearest->Object;
+	service_t *svc= (service_t*) name_hash_find( &svc_by_name_hash, name );
+	if (svc)
+		return svc;
 	// if create requested, create a new service by this name
 	// (if name is valid)
 	if (create && svc_check_name(name))
@@ -843,6 +2324,190 @@ void svc_change_pid(service_t *svc, pid_t pid) {
 		svc_check(svc);
 }
 
+/** Get a pidfd for the service's new process, and have the main loop watch it.
+ *
+ * There is no race with pid re-use here, because the child can't be reaped
+ * until we call waitpid.  If a pidfd can't be had, fall back to waitpid(-1)
+ * from then on.
+ */
+void svc_pidfd_open(service_t *svc) {
+	int fd= -1;
+	
+	#ifdef SYS_pidfd_open
+	if (!svc_reap_any) {
+		// pidfd_open sets close-on-exec
+		if ((fd= syscall(SYS_pidfd_open, svc->pid, 0)) < 0)
+			log_debug("pidfd_open: %s; using waitpid(-1)", strerror(errno));
+	}
+	#endif
+	if (fd >= 0 && svc_watch_fd(svc, fd)) {
+		svc->pidfd= fd;
+		return;
+	}
+	if (fd >= 0)
+		close(fd);
+	svc_reap_any= true;
+}
+
+void svc_pidfd_close(service_t *svc) {
+	if (svc->pidfd >= 0) {
+		svc_unwatch_fd(svc->pidfd);
+		close(svc->pidfd);
+		svc->pidfd= -1;
+	}
+}
+
+/** Have the main loop watch one of the service's descriptors for reading.
+ *
+ * svc_reap_children finds the service from the fd number in the ready list.
+ */
+bool svc_watch_fd(service_t *svc, int fd) {
+	service_t **new_map;
+	int n;
+	
+	if (fd >= svc_by_fd_limit) {
+		for (n= svc_by_fd_limit? svc_by_fd_limit : 64; n <= fd; n <<= 1);
+		if (!(new_map= realloc(svc_by_fd, n * sizeof(service_t*)))) {
+			log_error("can't grow service fd table");
+			return false;
+		}
+		memset(new_map + svc_by_fd_limit, 0, (n - svc_by_fd_limit) * sizeof(service_t*));
+		svc_by_fd= new_map;
+		svc_by_fd_limit= n;
+	}
+	if (!wake_watch_fd(fd, WAKE_READ))
+		return false;
+	svc_by_fd[fd]= svc;
+	return true;
+}
+
+void svc_unwatch_fd(int fd) {
+	svc_by_fd[fd]= NULL;
+	wake_cancel_fd(fd);
+}
+
+/** Read from the service's control.ready pipe.
+ *
+ * Any complete line (s6 sends just "\n", sd_notify style would be "READY=1\n")
+ * means the service is ready.  If the service closes the pipe without that,
+ * it stays "up" and not ready until it exits or the readiness timeout ends
+ * it, so services that depend on it keep waiting.
+ */
+void svc_handle_ready(service_t *svc) {
+	char buf[64];
+	int n;
+	
+	while ((n= read(svc->ready_fd, buf, sizeof(buf))) > 0)
+		if (memchr(buf, '\n', n))
+			break;
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	if (n < 0)
+		log_error("read(control.ready) for service \"%s\": %s", svc_get_name(svc), strerror(errno));
+	svc_ready_close(svc);
+	if (n > 0 && svc->state == SVC_STATE_UP) {
+		log_debug("service \"%s\" is ready", svc_get_name(svc));
+		wake_timer_cancel(&svc->start_timer);
+		svc->ready_pending= false;
+		svc->ready_time= wake->now;
+		svc->state= SVC_STATE_READY;
+		svc_notify_state(svc);
+	}
+	else if (n == 0)
+		log_debug("service \"%s\" closed control.ready without reporting ready", svc_get_name(svc));
+}
+
+// Stop reading control.ready.  This doesn't change ready_pending.
+void svc_ready_close(service_t *svc) {
+	if (svc->ready_fd >= 0) {
+		svc_unwatch_fd(svc->ready_fd);
+		close(svc->ready_fd);
+		svc->ready_fd= -1;
+	}
+}
+
+/** Reap any service processes which have exited.
+ *
+ * Services with a pidfd are found from the main loop's ready list, so this
+ * costs nothing when no child has exited.  Children without one (no pidfd
+ * support, or orphans when we are init or a subreaper) are collected with
+ * waitpid(-1).
+ * Readiness notifications arrive through the same ready list.
+ */
+void svc_reap_children() {
+	int i, fd, wstat;
+	pid_t pid;
+	struct rusage ru;
+	service_t *svc, *owner;
+	
+	for (i= 0; i < wake->ready_count; i++) {
+		fd= wake->ready_list[i];
+		if (fd >= svc_by_fd_limit || !(svc= svc_by_fd[fd]) || !woke_on_readable(fd))
+			continue;
+		if (fd == svc->ready_fd) {
+			svc_handle_ready(svc);
+			continue;
+		}
+		pid= wait4(svc->pid, &wstat, WNOHANG, &ru);
+		if (pid == svc->pid) {
+			log_trace("pidfd %d reaped pid = %d", fd, (int)pid);
+			svc_charge_rusage(svc, &ru);
+			svc_handle_reaped(svc, wstat);
+		}
+		else if (pid < 0) {
+			// already collected somewhere else?  Don't keep waking on it.
+			log_error("waitpid(%d): %s", (int)svc->pid, strerror(errno));
+			svc_pidfd_close(svc);
+		}
+	}
+	
+	if (!svc_reap_any)
+		return;
+	while ((pid= svc_wait_any(&wstat, &owner, &ru)) > 0) {
+		log_trace("waitpid found pid = %d", (int)pid);
+		// While tree_alive the main pid is already reaped, so a match is a
+		// reused pid.
+		if ((svc= svc_by_pid(pid)) && !svc->tree_alive) {
+			svc_charge_rusage(svc, &ru);
+			svc_handle_reaped(svc, wstat);
+		}
+		else if ((svc= owner)) {
+			svc_charge_rusage(svc, &ru);
+			svc_handle_orphan_reaped(svc, pid, wstat);
+		}
+		else {
+			stats.reap_unowned++;
+			log_trace("pid does not belong to any service");
+		}
+	}
+	if (pid < 0)
+		log_trace("waitpid: %s", strerror(errno));
+}
+
+/** Reap any exited child, like wait4(-1), and when tracking groups, report
+ * the service it belonged to (else NULL).
+ *
+ * The cgroup and process group of a zombie can still be read, so peek at it
+ * with WNOWAIT first.  The cgroup comes first, since a process can leave its
+ * process group with setsid() but can't leave its cgroup.
+ */
+pid_t svc_wait_any(int *wstat, service_t **owner, struct rusage *ru) {
+	siginfo_t info;
+	pid_t pgid;
+	
+	*owner= NULL;
+	if (!svc_track_groups)
+		return wait4(-1, wstat, WNOHANG, ru);
+	info.si_pid= 0;
+	if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) < 0)
+		return -1;
+	if (!info.si_pid)
+		return 0;
+	if (!(*owner= svc_by_cgroup_of(info.si_pid)) && (pgid= getpgid(info.si_pid)) > 0)
+		*owner= svc_by_pid(pgid);
+	return wait4(info.si_pid, wstat, WNOHANG, ru);
+}
+
 service_t *svc_by_pid(pid_t pid) {
 	RBTreeSearch s= RBTree_Find( &svc_by_pid_index, &pid );
 	if (s.Relation == 0)
@@ -878,6 +2543,8 @@ void svc_check(service_t *svc) {
 	assert(svc->name.len < NAME_BUF_SIZE);
 	assert(svc->name.data == svc->name_buf);
 	assert(svc->name.data[svc->name.len] == 0);
+	assert(name_hash_find(&svc_by_name_hash, svc->name) == svc);
+	assert(svc->list_idx >= 0 && svc->list_idx < svc_list_count && svc_list[svc->list_idx] == svc);
 
 	assert(svc->vars.len >= 0);
 	if (svc->vars.len) {
@@ -885,7 +2552,7 @@ void svc_check(service_t *svc) {
 		assert(svc->vars.data[svc->vars.len-1] == 0);
 	}
 	if (svc_pool) {
-		assert(svc->name.data + svc->name.len + 1 == svc->vars.data);
+		assert((char*) (svc + 1) == svc->vars.data);
 		assert( ((char*)svc) + svc_pool_size_each >= svc->vars.data + svc->vars.len );
 	}
 
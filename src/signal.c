@@ -7,9 +7,11 @@
 #include "daemonproxy.h"
 
 // Global signal self-pipe
+// (or, in signalfd mode, sig_wake_rd is the signalfd and sig_wake_wr is -1)
 pid_t sig_main_pid= 0;
 int sig_wake_rd= -1;
 int sig_wake_wr= -1;
+bool sig_use_signalfd= false;
 sigset_t sig_mask_orig;
 
 typedef struct sig_status_s {
@@ -26,6 +28,8 @@ volatile int signal_error= 0;
 
 static void record_signal(sig_status_t *sigarray, int element_count, int sig, int64_t ts, int count);
 static void merge_new_signals();
+static bool sig_init_signalfd();
+static void sig_read_signalfd();
 
 void record_signal(sig_status_t *signals, int slots, int sig, int64_t ts, int count) {
 	int i;
@@ -64,7 +68,8 @@ void sig_handler(int sig) {
 	prev= now;
 
 	// put character in pipe to wake main loop
-	if (write(sig_wake_wr, "", 1) != 1)
+	// (no pipe yet while sig_init is setting up signalfd)
+	if (sig_wake_wr >= 0 && write(sig_wake_wr, "", 1) != 1)
 		signal_error= errno;
 }
 
@@ -76,7 +81,8 @@ void sig_handler_wake_only(int sig) {
 		kill(getpid(), sig);
 	}
 	// put character in pipe to wake main loop
-	if (write(sig_wake_wr, "", 1) != 1)
+	// (SIGALRM still arrives here in signalfd mode, only to interrupt write())
+	if (sig_wake_wr >= 0 && write(sig_wake_wr, "", 1) != 1)
 		signal_error= errno;
 }
 
@@ -125,8 +131,12 @@ void sig_init() {
 	
 	// in a last-ditch attempt to recover from fatal errors, we might re-run
 	// the initialization.  otherwise, this condition is never true.
-	if (sig_wake_rd >= 0) close(sig_wake_rd);
+	if (sig_wake_rd >= 0) {
+		wake_cancel_fd(sig_wake_rd);
+		close(sig_wake_rd);
+	}
 	if (sig_wake_wr >= 0) close(sig_wake_wr);
+	sig_wake_rd= sig_wake_wr= -1;
 
 	if (!sig_main_pid)
 		sig_main_pid= getpid();
@@ -134,6 +144,26 @@ void sig_init() {
 	// initialize with 0
 	memset((void*)signals, 0, sizeof(signals));
 
+	// capture our signal mask
+	if (!sigprocmask(SIG_SETMASK, NULL, &sig_mask_orig) == 0)
+		perror("sigprocmask(all)");
+
+	// set signal handlers
+	memset(&act, 0, sizeof(act));
+	for (ss= signal_spec; ss->signum != 0; ss++) {
+		act.sa_handler= ss->handler;
+		if (sigaction(ss->signum, &act, NULL))
+			fatal(EXIT_IMPOSSIBLE_SCENARIO, "signal handler setup: %s", strerror(errno));
+	}
+
+	// Prefer signalfd, where signals stay blocked and get read in sig_run.
+	// Any that arrived before they were blocked went to the handler, and
+	// sig_run won't merge them in this mode, so do it now.
+	if ((sig_use_signalfd= sig_init_signalfd())) {
+		merge_new_signals();
+		return;
+	}
+
 	// Create pipe and set non-blocking
 	if (pipe(pipe_fd) < 0
 		|| fcntl(pipe_fd[0], F_SETFD, FD_CLOEXEC) < 0
@@ -146,18 +176,77 @@ void sig_init() {
 	log_trace("pipe => (%d, %d)", pipe_fd[0], pipe_fd[1]);
 	sig_wake_rd= pipe_fd[0];
 	sig_wake_wr= pipe_fd[1];
+}
+
+/** Block the non-fatal signals and deliver them through a signalfd.
+ *
+ * SIGALRM is left to its handler, because the log module relies on it to
+ * interrupt a hung write().  Returns false if signalfd is not available,
+ * in which case the signal mask is left as it was.
+ */
+static bool sig_init_signalfd() {
+#ifdef HAVE_SYS_SIGNALFD_H
+	sigset_t mask;
+	struct signal_spec_s *ss;
 	
-	// set signal handlers
-	memset(&act, 0, sizeof(act));
-	for (ss= signal_spec; ss->signum != 0; ss++) {
-		act.sa_handler= ss->handler;
-		if (sigaction(ss->signum, &act, NULL))
-			fatal(EXIT_IMPOSSIBLE_SCENARIO, "signal handler setup: %s", strerror(errno));
+	sigemptyset(&mask);
+	for (ss= signal_spec; ss->signum != 0; ss++)
+		if (ss->handler != fatal_sig_handler && ss->signum != SIGALRM)
+			sigaddset(&mask, ss->signum);
+	
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) {
+		log_error("sigprocmask: %s", strerror(errno));
+		return false;
+	}
+	if ((sig_wake_rd= signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC)) < 0) {
+		log_debug("signalfd: %s; using signal pipe", strerror(errno));
+		sigprocmask(SIG_UNBLOCK, &mask, NULL);
+		return false;
 	}
+	log_trace("signalfd => %d", sig_wake_rd);
+	return true;
+#else
+	return false;
+#endif
+}
+
+#ifdef HAVE_SYS_SIGNALFD_H
+static bool sig_is_wake_only(int signum) {
+	struct signal_spec_s *ss;
+	for (ss= signal_spec; ss->signum != 0; ss++)
+		if (ss->signum == signum)
+			return ss->handler == sig_handler_wake_only;
+	return false;
+}
+#endif
+
+/** Read all pending signals from the signalfd and record them
+ *
+ * Signals are stamped with the time they are read, which is at most one
+ * main loop iteration later than a handler would have seen.
+ */
+static void sig_read_signalfd() {
+#ifdef HAVE_SYS_SIGNALFD_H
+	static int64_t prev= 0;
+	struct signalfd_siginfo info[SIGNALFD_READ_BATCH];
+	int64_t now= gettime_mon_frac();
+	int i, n;
 	
-	// capture our signal mask
-	if (!sigprocmask(SIG_SETMASK, NULL, &sig_mask_orig) == 0)
-		perror("sigprocmask(all)");
+	while ((n= read(sig_wake_rd, info, sizeof(info))) > 0) {
+		for (i= 0; i < n / sizeof(*info); i++) {
+			if (sig_is_wake_only(info[i].ssi_signo))
+				continue;
+			// We have a requirement that no two signals share a timestamp,
+			// and '0' is used as a NULL value
+			if (now - prev <= 0) now= prev + 1;
+			if (!now) now++;
+			record_signal(signals, sizeof(signals)/sizeof(*signals), info[i].ssi_signo, now, 1);
+			prev= now;
+		}
+	}
+	if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		log_error("read(signalfd): %s", strerror(errno));
+#endif
 }
 
 /** Prepare a forked child for exec()
@@ -192,6 +281,14 @@ void sig_run() {
 		signal_error= 0;
 	}
 	
+	if (sig_use_signalfd) {
+		// Collect signals straight from the kernel; no need to touch the mask
+		if (woke_on_readable(sig_wake_rd))
+			sig_read_signalfd();
+		wake_on_readable(sig_wake_rd);
+		return;
+	}
+	
 	// Empty the signal pipe
 	if (woke_on_readable(sig_wake_rd))
 		while (read(sig_wake_rd, tmp, sizeof(tmp)) > 0);
@@ -0,0 +1,119 @@
+
+const struct sig_list_item sig_list[]= {
+#ifdef SIGABRT
+	{ SIGABRT, { "ABRT\0\0\0\0" } },
+#endif
+#ifdef SIGALRM
+	{ SIGALRM, { "ALRM\0\0\0\0" } },
+#endif
+#ifdef SIGBUS
+	{ SIGBUS, { "BUS\0\0\0\0\0" } },
+#endif
+#ifdef SIGCHLD
+	{ SIGCHLD, { "CHLD\0\0\0\0" } },
+#endif
+#ifdef SIGCLD
+	{ SIGCLD, { "CLD\0\0\0\0\0" } },
+#endif
+#ifdef SIGCONT
+	{ SIGCONT, { "CONT\0\0\0\0" } },
+#endif
+#ifdef SIGEMT
+	{ SIGEMT, { "EMT\0\0\0\0\0" } },
+#endif
+#ifdef SIGFPE
+	{ SIGFPE, { "FPE\0\0\0\0\0" } },
+#endif
+#ifdef SIGHUP
+	{ SIGHUP, { "HUP\0\0\0\0\0" } },
+#endif
+#ifdef SIGILL
+	{ SIGILL, { "ILL\0\0\0\0\0" } },
+#endif
+#ifdef SIGINFO
+	{ SIGINFO, { "INFO\0\0\0\0" } },
+#endif
+#ifdef SIGINT
+	{ SIGINT, { "INT\0\0\0\0\0" } },
+#endif
+#ifdef SIGIO
+	{ SIGIO, { "IO\0\0\0\0\0\0" } },
+#endif
+#ifdef SIGIOT
+	{ SIGIOT, { "IOT\0\0\0\0\0" } },
+#endif
+#ifdef SIGKILL
+	{ SIGKILL, { "KILL\0\0\0\0" } },
+#endif
+#ifdef SIGLOST
+	{ SIGLOST, { "LOST\0\0\0\0" } },
+#endif
+#ifdef SIGPIPE
+	{ SIGPIPE, { "PIPE\0\0\0\0" } },
+#endif
+#ifdef SIGPOLL
+	{ SIGPOLL, { "POLL\0\0\0\0" } },
+#endif
+#ifdef SIGPROF
+	{ SIGPROF, { "PROF\0\0\0\0" } },
+#endif
+#ifdef SIGPWR
+	{ SIGPWR, { "PWR\0\0\0\0\0" } },
+#endif
+#ifdef SIGQUIT
+	{ SIGQUIT, { "QUIT\0\0\0\0" } },
+#endif
+#ifdef SIGSEGV
+	{ SIGSEGV, { "SEGV\0\0\0\0" } },
+#endif
+#ifdef SIGSTKFLT
+	{ SIGSTKFLT, { "STKFLT\0\0" } },
+#endif
+#ifdef SIGSTOP
+	{ SIGSTOP, { "STOP\0\0\0\0" } },
+#endif
+#ifdef SIGSYS
+	{ SIGSYS, { "SYS\0\0\0\0\0" } },
+#endif
+#ifdef SIGTERM
+	{ SIGTERM, { "TERM\0\0\0\0" } },
+#endif
+#ifdef SIGTRAP
+	{ SIGTRAP, { "TRAP\0\0\0\0" } },
+#endif
+#ifdef SIGTSTP
+	{ SIGTSTP, { "TSTP\0\0\0\0" } },
+#endif
+#ifdef SIGTTIN
+	{ SIGTTIN, { "TTIN\0\0\0\0" } },
+#endif
+#ifdef SIGTTOU
+	{ SIGTTOU, { "TTOU\0\0\0\0" } },
+#endif
+#ifdef SIGUNUSED
+	{ SIGUNUSED, { "UNUSED\0\0" } },
+#endif
+#ifdef SIGURG
+	{ SIGURG, { "URG\0\0\0\0\0" } },
+#endif
+#ifdef SIGUSR1
+	{ SIGUSR1, { "USR1\0\0\0\0" } },
+#endif
+#ifdef SIGUSR2
+	{ SIGUSR2, { "USR2\0\0\0\0" } },
+#endif
+#ifdef SIGVTALRM
+	{ SIGVTALRM, { "VTALRM\0\0" } },
+#endif
+#ifdef SIGWINCH
+	{ SIGWINCH, { "WINCH\0\0\0" } },
+#endif
+#ifdef SIGXCPU
+	{ SIGXCPU, { "XCPU\0\0\0\0" } },
+#endif
+#ifdef SIGXFSZ
+	{ SIGXFSZ, { "XFSZ\0\0\0\0" } },
+#endif
+	{ 0, { "\0\0\0\0\0\0\0\0" } }
+};
+
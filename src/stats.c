@@ -0,0 +1,63 @@
+/* stats.c - counters and latency histograms
+ * Copyright (C) 2014  Michael Conrad
+ * Distributed under GPLv2, see LICENSE
+ */
+
+#include "config.h"
+#include "daemonproxy.h"
+
+// The counters are incremented in place by each module, so recording a
+// sample costs a few instructions.  This file only names them, for the
+// "stats" command.
+
+stats_t stats;
+
+#define COUNTER(name, field) { name, &stats.field, NULL }
+#define HIST(name, field)    { name, NULL, &stats.field }
+static const struct stats_entry_s {
+	const char *name;
+	int64_t *value;
+	stats_hist_t *hist;
+} stats_table[]= {
+	COUNTER("loop.iterations",  loop_iterations),
+	HIST(   "loop.busy",        loop_busy),
+	COUNTER("wake.fd",          wake_fd),
+	COUNTER("wake.timer",       wake_timer),
+	COUNTER("wake.deadline",    wake_deadline),
+	COUNTER("wake.interrupt",   wake_interrupt),
+	HIST(   "service.spawn",    spawn),
+	HIST(   "service.restart",  restart),
+	COUNTER("reap.orphans",     reap_orphans),
+	COUNTER("reap.unowned",     reap_unowned),
+	COUNTER("conn.commands",    ctl_commands),
+	COUNTER("conn.bytes_in",    ctl_bytes_in),
+	COUNTER("conn.bytes_out",   ctl_bytes_out),
+	COUNTER("conn.events",      ctl_events),
+	COUNTER("conn.overflows",   ctl_overflows),
+	COUNTER("log.lost",         log_lost),
+};
+#undef COUNTER
+#undef HIST
+
+const int stats_count= sizeof(stats_table)/sizeof(*stats_table);
+
+bool stats_get(int idx, const char **name_out, int64_t *value_out, stats_hist_t **hist_out) {
+	if (idx < 0 || idx >= stats_count)
+		return false;
+	*name_out= stats_table[idx].name;
+	*value_out= stats_table[idx].value? *stats_table[idx].value : 0;
+	*hist_out= stats_table[idx].hist;
+	return true;
+}
+
+void stats_hist_format(stats_hist_t *h, char *buf, int buf_size) {
+	int i, n, end= STATS_HIST_BUCKETS;
+	while (end > 0 && !h->bucket[end-1])
+		end--;
+	if (!end) {
+		snprintf(buf, buf_size, "-");
+		return;
+	}
+	for (i= 0, n= 0; i < end && n < buf_size; i++)
+		n += snprintf(buf + n, buf_size - n, i? ",%lld" : "%lld", (long long) h->bucket[i]);
+}
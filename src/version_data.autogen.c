@@ -0,0 +1,12 @@
+#include "config.h"
+
+/*
+canonical=1.1.0-vm
+*/
+const int     version_major=     1;
+const int     version_minor=     1;
+const int     version_release=   0;
+const char *  version_suffix=    "-vm";
+const time_t  version_build_ts=  CURRENT_UNIX_TIMESTAMP;
+const char *  version_git_head=  "5fa424f5b724707c5fe604245853ec79bc506358";
+const bool    version_git_dirty= true;
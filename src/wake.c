@@ -0,0 +1,508 @@
+/* wake.c - routines for waiting on file descriptors and timeouts
+ * Copyright (C) 2014  Michael Conrad
+ * Distributed under GPLv2, see LICENSE
+ */
+
+#include "config.h"
+#include "daemonproxy.h"
+
+wake_t   main_wake; // global used for tracking things that should wake the main loop
+wake_t  *wake= &main_wake; // this is exported to other modules
+
+// Per-fd WAKE_* bits that stay wanted until wake_cancel_fd (see wake_watch_fd)
+static uint8_t *fd_watch= NULL;
+
+// fds which have been watched, so backends don't scan all of fd_watch.
+// WAKE_LISTED in fd_watch marks membership; cancelled fds are removed lazily.
+static int *watch_list= NULL, watch_count= 0;
+
+// Per-fd state owned by the backend, grown alongside fd_want / fd_ready
+static uint8_t *fd_reg= NULL;
+
+typedef struct wake_backend_s {
+	const char *name;
+	bool (*init)();
+	void (*wait)(int64_t timeout);
+	void (*cancel)(int fd);
+	bool (*watch)(int fd);
+} wake_backend_t;
+
+static const wake_backend_t *backend= NULL;
+
+// Binary min-heap of pending timers, ordered by 'when'
+static wake_timer_t **timer_heap= NULL;
+static int timer_count= 0, timer_limit= 0, timer_reserved= 0;
+
+static inline void wake_set_ready(int fd, int bits) {
+	if (!wake->fd_ready[fd])
+		wake->ready_list[wake->ready_count++]= fd;
+	wake->fd_ready[fd] |= bits;
+}
+
+void wake_fd_grow(int fd) {
+	int i, n= wake->fd_limit? wake->fd_limit : WAKE_FD_LIMIT_INITIAL;
+	while (n <= fd) n <<= 1;
+
+	log_trace("growing wake arrays from %d to %d", wake->fd_limit, n);
+	if (!(wake->fd_want=    realloc(wake->fd_want,    n))
+		|| !(wake->fd_ready=   realloc(wake->fd_ready,   n))
+		|| !(fd_watch=         realloc(fd_watch,         n))
+		|| !(fd_reg=           realloc(fd_reg,           n))
+		|| !(wake->want_list=  realloc(wake->want_list,  n * sizeof(int)))
+		|| !(wake->ready_list= realloc(wake->ready_list, n * sizeof(int)))
+		|| !(watch_list=       realloc(watch_list,       n * sizeof(int)))
+	)
+		fatal(EXIT_BROKEN_PROGRAM_STATE, "Can't allocate memory for %d file descriptors", n);
+
+	for (i= wake->fd_limit; i < n; i++)
+		wake->fd_want[i]= wake->fd_ready[i]= fd_watch[i]= fd_reg[i]= 0;
+	wake->fd_limit= n;
+}
+
+void wake_cancel_fd(int fd) {
+	if (fd < 0 || fd >= wake->fd_limit)
+		return;
+	// leave the LISTED flag, so the fd doesn't get added to want_list twice
+	wake->fd_want[fd] &= WAKE_LISTED;
+	wake->fd_ready[fd]= 0;
+	fd_watch[fd] &= WAKE_LISTED;
+	if (backend && backend->cancel)
+		backend->cancel(fd);
+}
+
+bool wake_watch_fd(int fd, int bits) {
+	if (fd >= wake->fd_limit)
+		wake_fd_grow(fd);
+	if (!(fd_watch[fd] & WAKE_LISTED))
+		watch_list[watch_count++]= fd;
+	fd_watch[fd]= (bits & WAKE_ANY) | WAKE_LISTED;
+	if (backend && backend->watch && !backend->watch(fd)) {
+		fd_watch[fd]= WAKE_LISTED;
+		return false;
+	}
+	return true;
+}
+
+void wake_wait() {
+	int i;
+	int64_t timeout, busy_start;
+
+	// Ready flags are valid for the one iteration following the wait
+	for (i= 0; i < wake->ready_count; i++)
+		wake->fd_ready[wake->ready_list[i]]= 0;
+	wake->ready_count= 0;
+
+	// Sleep no later than the earliest timer
+	if (timer_count && timer_heap[0]->when - wake->next < 0)
+		wake->next= timer_heap[0]->when;
+
+	// wake->now is still the time we woke up last
+	busy_start= wake->now;
+	wake->now= gettime_mon_frac();
+	stats.loop_iterations++;
+	stats_hist_add(&stats.loop_busy, wake->now - busy_start);
+	timeout= wake->next - wake->now;
+	if (timeout < 0)
+		timeout= 0;
+	log_trace("wait up to %d.%06d sec", (int)(timeout >> 32), (int)(((timeout & 0xFFFFFFFFLL) * 1000000) >> 32));
+
+	backend->wait(timeout);
+
+	// State machines must request a wake each iteration, so clear the want flags.
+	for (i= 0; i < wake->want_count; i++)
+		wake->fd_want[wake->want_list[i]]= 0;
+	wake->want_count= 0;
+
+	wake->now= gettime_mon_frac();
+
+	if (wake->ready_count)
+		stats.wake_fd++;
+	else if (timer_count && timer_heap[0]->when - wake->now <= 0)
+		stats.wake_timer++;
+	else if (wake->next - wake->now <= 0)
+		stats.wake_deadline++;
+	else
+		stats.wake_interrupt++;
+}
+
+//----------------------------------------------------------------------------
+// Timers
+//
+// Each timer is embedded in the object that owns it (like RBTreeNode) and
+// knows its own position in the heap, so set and cancel are O(log n) and the
+// main loop finds the next deadline in O(1).
+
+void wake_timer_init(wake_timer_t *t, wake_timer_fn_t *callback, void *obj) {
+	t->when= 0;
+	t->heap_idx= -1;
+	t->callback= callback;
+	t->obj= obj;
+}
+
+static bool wake_timer_heap_resize(int count) {
+	wake_timer_t **new_heap;
+	if (count <= timer_limit)
+		return true;
+	if (!(new_heap= realloc(timer_heap, count * sizeof(wake_timer_t*))))
+		return false;
+	timer_heap= new_heap;
+	timer_limit= count;
+	return true;
+}
+
+bool wake_timer_reserve(int count) {
+	if (!wake_timer_heap_resize(timer_reserved + count))
+		return false;
+	timer_reserved+= count;
+	return true;
+}
+
+static inline void wake_timer_place(wake_timer_t *t, int i) {
+	timer_heap[i]= t;
+	t->heap_idx= i;
+}
+
+static void wake_timer_sift_up(wake_timer_t *t, int i) {
+	int parent;
+	while (i > 0) {
+		parent= (i - 1) >> 1;
+		if (timer_heap[parent]->when - t->when <= 0)
+			break;
+		wake_timer_place(timer_heap[parent], i);
+		i= parent;
+	}
+	wake_timer_place(t, i);
+}
+
+static void wake_timer_sift_down(wake_timer_t *t, int i) {
+	int child;
+	while ((child= i * 2 + 1) < timer_count) {
+		if (child + 1 < timer_count && timer_heap[child+1]->when - timer_heap[child]->when < 0)
+			child++;
+		if (t->when - timer_heap[child]->when <= 0)
+			break;
+		wake_timer_place(timer_heap[child], i);
+		i= child;
+	}
+	wake_timer_place(t, i);
+}
+
+void wake_timer_set(wake_timer_t *t, int64_t when) {
+	int64_t prev= t->when;
+	t->when= when;
+	if (t->heap_idx < 0) {
+		if (timer_count >= timer_limit && !wake_timer_heap_resize(timer_limit? timer_limit * 2 : 16))
+			fatal(EXIT_BROKEN_PROGRAM_STATE, "Can't allocate memory for timers");
+		wake_timer_sift_up(t, timer_count++);
+	}
+	else if (when - prev < 0)
+		wake_timer_sift_up(t, t->heap_idx);
+	else
+		wake_timer_sift_down(t, t->heap_idx);
+}
+
+void wake_timer_cancel(wake_timer_t *t) {
+	int i= t->heap_idx;
+	wake_timer_t *last;
+	if (i < 0)
+		return;
+	t->heap_idx= -1;
+	last= timer_heap[--timer_count];
+	if (last != t) {
+		// move the last element into the hole, in whichever direction it belongs
+		if (i > 0 && timer_heap[(i - 1) >> 1]->when - last->when > 0)
+			wake_timer_sift_up(last, i);
+		else
+			wake_timer_sift_down(last, i);
+	}
+}
+
+void wake_run_timers() {
+	wake_timer_t *t;
+	while (timer_count && (t= timer_heap[0])->when - wake->now <= 0) {
+		wake_timer_cancel(t);
+		if (t->callback)
+			t->callback(t);
+	}
+}
+
+// If the wait fails, at least log it and prevent looping too fast
+static void wake_wait_failed(const char *fn) {
+	if (errno != EINTR) {
+		log_error("%s: %s", fn, strerror(errno));
+		usleep(500000);
+	}
+}
+
+//----------------------------------------------------------------------------
+// select() backend
+//
+// Only handles fds below FD_SETSIZE, but is available everywhere.
+
+static bool wake_select_init() {
+	return true;
+}
+
+static void wake_select_check(int fd, fd_set *rd, fd_set *wr, fd_set *er) {
+	int bits;
+	if (fd >= FD_SETSIZE)
+		return;
+	bits= (FD_ISSET(fd, rd)? WAKE_READ : 0)
+		| (FD_ISSET(fd, wr)? WAKE_WRITE : 0)
+		| (FD_ISSET(fd, er)? WAKE_ERR : 0);
+	if (bits)
+		wake_set_ready(fd, bits);
+}
+
+static void wake_select_wait(int64_t timeout) {
+	fd_set rd, wr, er;
+	struct timeval tv;
+	int i, n, fd, bits, max_fd= -1;
+
+	FD_ZERO(&rd);
+	FD_ZERO(&wr);
+	FD_ZERO(&er);
+	for (i= 0; i < wake->want_count; i++) {
+		fd= wake->want_list[i];
+		bits= wake->fd_want[fd] & WAKE_ANY;
+		if (!bits)
+			continue;
+		if (fd >= FD_SETSIZE) {
+			log_error("fd %d exceeds FD_SETSIZE; use an epoll event backend", fd);
+			continue;
+		}
+		if (bits & WAKE_READ)  FD_SET(fd, &rd);
+		if (bits & WAKE_WRITE) FD_SET(fd, &wr);
+		if (bits & WAKE_ERR)   FD_SET(fd, &er);
+		if (fd > max_fd)
+			max_fd= fd;
+	}
+	// select has to be told about watched fds every time.  Drop the ones
+	// which were cancelled since the last pass.
+	for (i= n= 0; i < watch_count; i++) {
+		fd= watch_list[i];
+		if (!(bits= fd_watch[fd] & WAKE_ANY)) {
+			fd_watch[fd]= 0;
+			continue;
+		}
+		watch_list[n++]= fd;
+		if (fd >= FD_SETSIZE) {
+			log_error("fd %d exceeds FD_SETSIZE; use an epoll event backend", fd);
+			continue;
+		}
+		if (bits & WAKE_READ)  FD_SET(fd, &rd);
+		if (bits & WAKE_WRITE) FD_SET(fd, &wr);
+		if (bits & WAKE_ERR)   FD_SET(fd, &er);
+		if (fd > max_fd)
+			max_fd= fd;
+	}
+	watch_count= n;
+
+	tv.tv_sec= (long)(timeout >> 32);
+	tv.tv_usec= (long)(((timeout & 0xFFFFFFFFLL) * 1000000) >> 32);
+	if (select(max_fd+1, &rd, &wr, &er, &tv) < 0) {
+		wake_wait_failed("select");
+		return;
+	}
+
+	for (i= 0; i < wake->want_count; i++)
+		wake_select_check(wake->want_list[i], &rd, &wr, &er);
+	for (i= 0; i < watch_count; i++)
+		wake_select_check(watch_list[i], &rd, &wr, &er);
+}
+
+static const wake_backend_t wake_backend_select= {
+	"select", wake_select_init, wake_select_wait, NULL, NULL
+};
+
+//----------------------------------------------------------------------------
+// epoll() backend
+//
+// The kernel keeps the interest list, so we only make a syscall when the set
+// of events wanted for an fd changes.  fds which are no longer wanted are left
+// registered until they generate an event, since most fds are wanted again on
+// the next iteration.  fd_reg[fd] records what the kernel has for each fd.
+
+#ifdef HAVE_SYS_EPOLL_H
+
+#define WAKE_REG_ACTIVE     0x40 // registered, with WAKE_READ / WAKE_WRITE bits
+#define WAKE_REG_UNPOLLABLE 0x80 // epoll refused it (regular file); always ready
+
+static int epoll_fd= -1;
+static bool epoll_rebuild= false;
+static struct epoll_event epoll_events[WAKE_EPOLL_MAX_EVENTS];
+
+static bool wake_epoll_update(int fd, int bits);
+
+static bool wake_epoll_init() {
+	int i, fd;
+	if (epoll_fd >= 0)
+		close(epoll_fd);
+	if ((epoll_fd= epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		log_debug("epoll_create1: %s", strerror(errno));
+		return false;
+	}
+	epoll_rebuild= false;
+	if (fd_reg)
+		memset(fd_reg, 0, wake->fd_limit);
+	// re-register anything that was being watched
+	for (i= 0; i < watch_count; i++)
+		if (fd_watch[fd= watch_list[i]] & WAKE_ANY)
+			wake_epoll_update(fd, fd_watch[fd]);
+	return true;
+}
+
+// Update the kernel's interest for fd.  Returns false if the fd can't be
+// polled.
+static bool wake_epoll_update(int fd, int bits) {
+	struct epoll_event ev;
+	int op= (fd_reg[fd] & WAKE_REG_ACTIVE)? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events= ((bits & WAKE_READ)? EPOLLIN : 0) | ((bits & WAKE_WRITE)? EPOLLOUT : 0);
+	ev.data.fd= fd;
+	if (epoll_ctl(epoll_fd, op, fd, &ev) < 0) {
+		// fd number may have been closed and re-opened without a cancel
+		if (errno == ENOENT && op == EPOLL_CTL_MOD)
+			op= EPOLL_CTL_ADD;
+		else if (errno == EEXIST && op == EPOLL_CTL_ADD)
+			op= EPOLL_CTL_MOD;
+		else
+			op= -1;
+		if (op < 0 || epoll_ctl(epoll_fd, op, fd, &ev) < 0) {
+			if (errno == EPERM)
+				fd_reg[fd]= WAKE_REG_UNPOLLABLE;
+			else {
+				log_debug("epoll_ctl(%d): %s", fd, strerror(errno));
+				fd_reg[fd]= 0;
+			}
+			return false;
+		}
+	}
+	fd_reg[fd]= WAKE_REG_ACTIVE | (bits & (WAKE_READ|WAKE_WRITE));
+	return true;
+}
+
+static void wake_epoll_cancel(int fd) {
+	if (fd_reg[fd] & WAKE_REG_ACTIVE) {
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+			// The fd was closed (or replaced) before we got here, so the kernel
+			// might still be holding the old file.  Start over with a new set.
+			log_debug("epoll_ctl(DEL, %d): %s", fd, strerror(errno));
+			epoll_rebuild= true;
+		}
+	}
+	fd_reg[fd]= 0;
+}
+
+static bool wake_epoll_watch(int fd) {
+	if (wake_epoll_update(fd, fd_watch[fd]))
+		return true;
+	fd_reg[fd]= 0;
+	return false;
+}
+
+static void wake_epoll_wait(int64_t timeout) {
+	int i, n, fd, bits, ev, ms;
+
+	for (i= 0; i < wake->want_count; i++) {
+		fd= wake->want_list[i];
+		bits= (wake->fd_want[fd] | fd_watch[fd]) & WAKE_ANY;
+		if (!bits)
+			continue;
+		if (fd_reg[fd] & WAKE_REG_UNPOLLABLE) {
+			wake_set_ready(fd, bits);
+			timeout= 0;
+		}
+		else if (!(fd_reg[fd] & WAKE_REG_ACTIVE)
+			|| (fd_reg[fd] & (WAKE_READ|WAKE_WRITE)) != (bits & (WAKE_READ|WAKE_WRITE))
+		) {
+			// If it can't be polled, report it ready so that the caller's read
+			// or write discovers the problem (same as select would)
+			if (!wake_epoll_update(fd, bits)) {
+				wake_set_ready(fd, bits);
+				timeout= 0;
+			}
+		}
+	}
+
+	// round up to whole milliseconds, so we don't wake just before the deadline
+	ms= timeout <= 0? 0
+		: (timeout >> 32) >= INT_MAX / 1000 - 1? INT_MAX
+		: (int)((timeout * 1000 + 0xFFFFFFFFLL) >> 32);
+	n= epoll_wait(epoll_fd, epoll_events, WAKE_EPOLL_MAX_EVENTS, ms);
+	if (n < 0) {
+		wake_wait_failed("epoll_wait");
+		n= 0;
+	}
+
+	for (i= 0; i < n; i++) {
+		fd= epoll_events[i].data.fd;
+		ev= epoll_events[i].events;
+		if (fd < 0 || fd >= wake->fd_limit)
+			continue;
+		bits= (wake->fd_want[fd] | fd_watch[fd]) & WAKE_ANY;
+		if (!bits) {
+			// no longer interested; unregister it now that it is generating events
+			wake_epoll_cancel(fd);
+			continue;
+		}
+		// select reports errors and hangups as readable/writeable, so do the same
+		if (ev & (EPOLLERR|EPOLLHUP))
+			wake_set_ready(fd, bits);
+		else {
+			ev= ((ev & EPOLLIN)? WAKE_READ : 0) | ((ev & EPOLLOUT)? WAKE_WRITE : 0);
+			if (ev & bits)
+				wake_set_ready(fd, ev & bits);
+		}
+	}
+
+	if (epoll_rebuild) {
+		log_debug("rebuilding epoll set");
+		if (!wake_epoll_init())
+			fatal(EXIT_INVALID_ENVIRONMENT, "Can't re-create epoll set");
+	}
+}
+
+static const wake_backend_t wake_backend_epoll= {
+	"epoll", wake_epoll_init, wake_epoll_wait, wake_epoll_cancel, wake_epoll_watch
+};
+
+#endif
+
+//----------------------------------------------------------------------------
+
+// Backends in order of preference
+static const wake_backend_t *wake_backends[]= {
+	#ifdef HAVE_SYS_EPOLL_H
+	&wake_backend_epoll,
+	#endif
+	&wake_backend_select,
+	NULL
+};
+
+bool wake_init(const char *backend_name) {
+	const wake_backend_t **b;
+
+	if (!wake->fd_limit)
+		wake_fd_grow(WAKE_FD_LIMIT_INITIAL-1);
+
+	for (b= wake_backends; *b; b++) {
+		if (backend_name && 0 != strcmp(backend_name, (*b)->name))
+			continue;
+		if ((*b)->init()) {
+			backend= *b;
+			log_debug("using %s event backend", backend->name);
+			return true;
+		}
+		if (backend_name)
+			break;
+	}
+	if (backend_name)
+		log_error("event backend \"%s\" is not available", backend_name);
+	return false;
+}
+
+const char * wake_backend_name() {
+	return backend? backend->name : NULL;
+}
@@ -0,0 +1,33 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+for my $backend (qw: epoll select :) {
+	my $dp= Test::DaemonProxy->new;
+	$dp->run('-i', '--event-backend', $backend);
+	$dp->send('echo', "using $backend");
+	$dp->recv_ok( qr/^using $backend$/m, "command over stdio ($backend)" );
+
+	# file descriptors must keep working after being closed and re-opened
+	for (1..3) {
+		$dp->send('service.args', 'foo', 'perl', '-e', 'print "hello\n"');
+		$dp->send('service.fds', 'foo', 'null', 'stderr', 'stderr');
+		$dp->send('service.start', 'foo');
+		$dp->recv_ok( qr/^hello$/m, "service output ($backend)" );
+		$dp->recv_ok( qr/^service.state\tfoo\tdown/m, "service reaped ($backend)" );
+	}
+
+	$dp->send('terminate', 0);
+	$dp->exit_is( 0 );
+}
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i', '--event-backend', 'nonexistent');
+$dp->exit_is( 2, 'unknown backend' );
+
+done_testing;
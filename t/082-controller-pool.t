@@ -0,0 +1,69 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Socket;
+use IO::Select;
+
+sub connect_ctl {
+	my $path= shift;
+	socket(my $s, PF_UNIX, SOCK_STREAM, 0) || die "socket: $!";
+	connect($s, sockaddr_un($path)) || die "connect: $!";
+	$s->autoflush(1);
+	return $s;
+}
+
+sub read_line_within {
+	my ($s, $timeout)= @_;
+	return undef unless IO::Select->new($s)->can_read($timeout);
+	return scalar <$s>;
+}
+
+my $dp= Test::DaemonProxy->new;
+my $sockpath= $dp->temp_path . '/082-tempfile.sock';
+unlink $sockpath;
+
+# Without a pool, many controllers can be connected at once
+$dp->run('-i', '-S', $sockpath);
+$dp->send('echo', 'ready');
+$dp->recv_ok( qr/^ready$/m, 'started' );
+
+my @conn= map { connect_ctl($sockpath) } 1..12;
+$conn[$_]->print("echo\tconn$_\n") for 0..$#conn;
+for (0..$#conn) {
+	my $line= read_line_within($conn[$_], 2);
+	is( $line, "conn$_\n", "controller $_ answered" );
+}
+# closing them frees the controllers for re-use
+close $_ for @conn;
+$dp->send('echo', 'closed');
+$dp->recv_ok( qr/^closed$/m, 'closed connections' );
+@conn= map { connect_ctl($sockpath) } 1..3;
+$conn[$_]->print("echo\tagain$_\n") for 0..$#conn;
+is( read_line_within($conn[$_], 2), "again$_\n", "re-used controller $_ answered" ) for 0..$#conn;
+close $_ for @conn;
+$dp->terminate_ok;
+unlink $sockpath;
+
+# With a pool of 2, the interactive controller and one socket fit, but no more
+$dp= Test::DaemonProxy->new;
+$dp->run('-i', '-S', $sockpath, '--controller-pool', '2');
+$dp->send('echo', 'ready');
+$dp->recv_ok( qr/^ready$/m, 'started with pool' );
+
+my $first= connect_ctl($sockpath);
+$first->print("echo\tfirst\n");
+is( read_line_within($first, 2), "first\n", 'first socket controller answered' );
+my $second= connect_ctl($sockpath);
+$second->print("echo\tsecond\n");
+is( read_line_within($second, .5), undef, 'second socket controller waits' );
+$dp->recv_ok( qr/No free controllers/m, 'warning logged' );
+
+$dp->terminate_ok;
+unlink $sockpath;
+
+done_testing;
@@ -0,0 +1,50 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->timeout(0.5);
+$dp->run('-i');
+
+$dp->send('conn.event_timeout', 2, 8);
+$dp->send('conn.resume');
+$dp->send('service.args', 'foo', '/bin/true');
+$dp->sync;
+
+# Everything is still in the journal, so resuming from the start replays it
+$dp->send('conn.resume', 0);
+$dp->recv_stdout_ok( qr/^conn.resume\treplay\t(\d+)\nservice.args\tfoo\t\/bin\/true$/m, 'replay from start' );
+my $last= $dp->last_captures->[0];
+
+# Resuming from a later event replays only what came after it
+my $next= $last + 1;
+$dp->send('service.args', 'foo', '/bin/false');
+$dp->send('conn.resume', $last);
+$dp->recv_stdout_ok( qr/^conn.resume\treplay\t$next\nservice.args\tfoo\t\/bin\/false$/m, 'replay only new events' );
+$dp->sync;
+
+$dp->send('conn.resume', $last+1000);
+$dp->recv_stdout_ok( qr/^error.*invalid sequence/m, 'future sequence number' );
+
+# Cause an overflow (see 102-recv-overflow.t) with more events than the journal can hold
+for (my $i= 0; $i < 1000; $i++) {
+	$dp->send('service.args', 'foo', "/nonexistent/path/$i".(' yada' x 60));
+	$dp->discard_stderr; # don't let stderr overflow
+}
+sleep 2;
+$dp->recv_stdout_ok( qr/^overflow\t(\d+)$/m, 'overflow with sequence number' );
+my $seq= $dp->last_captures->[0];
+
+# The missed events were evicted, so it falls back to a statedump
+$dp->send('conn.resume', $seq);
+$dp->recv_stdout_ok( qr/^conn.resume\tstatedump\t\d+$/m, 'resume falls back to statedump' );
+$dp->recv_stdout_ok( qr/^service.args\tfoo\t\/nonexistent\/path\/999 /m, 'statedump has current state' );
+
+$dp->terminate_ok;
+
+done_testing;
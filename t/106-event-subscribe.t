@@ -0,0 +1,56 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->timeout(0.5);
+$dp->run('-i');
+
+# Return all stdout up to an echo marker
+my $marker= 0;
+sub events_until_marker {
+	my $m= 'marker'.++$marker;
+	$dp->send('echo', $m);
+	$dp->recv_stdout(qr/\A((?s:.*?))^$m$/m) or die "didn't get $m";
+	return $dp->last_captures->[0];
+}
+
+$dp->send('service.args', $_, 'true') for qw( web1 web2 db1 );
+$dp->send('service.tags', 'db1', 'color=red');
+events_until_marker;
+
+$dp->send('conn.subscribe', 'event:service.state', 'service:web*');
+$dp->send('service.args', 'web1', 'sh', '-c', 'exit 0');
+$dp->send('service.start', $_) for qw( web1 db1 );
+$dp->recv_stdout_ok( qr/^service.state\tweb1\tdown.*exit/m, 'web1 state delivered' );
+my $out= events_until_marker;
+unlike( $out, qr/db1|service.args/, 'no events for other services or types' );
+
+$dp->send('conn.subscribe', 'tag:color=*');
+$dp->send('service.args', $_, 'false') for qw( web1 db1 );
+$out= events_until_marker;
+like( $out, qr/^service.args\tdb1\tfalse$/m, 'tagged service delivered' );
+unlike( $out, qr/web1/, 'untagged service filtered' );
+
+$dp->send('conn.subscribe', 'service:web2');
+$dp->send('statedump');
+$out= events_until_marker;
+like( $out, qr/^service.args\tweb2\ttrue$/m, 'statedump includes subscribed service' );
+unlike( $out, qr/web1|db1/, 'statedump excludes others' );
+like( $out, qr/^fd.state\tnull/m, 'service filter does not apply to fd events' );
+
+$dp->send('conn.subscribe', 'color=red');
+$dp->recv_stdout_ok( qr/^error.*filter must begin/m, 'invalid filter' );
+
+$dp->send('conn.subscribe');
+$dp->send('service.args', 'db1', 'true');
+$dp->recv_stdout_ok( qr/^service.args\tdb1\ttrue$/m, 'no filters delivers everything' );
+
+$dp->terminate_ok;
+
+done_testing;
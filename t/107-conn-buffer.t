@@ -0,0 +1,52 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+
+# Commands longer than the initial buffer are fine, up to the default limit
+my $long= 'x' x 3000;
+$dp->send('echo', $long);
+$dp->recv_ok( qr/^\Q$long\E$/m, 'recv buffer grows for long command' );
+
+$dp->send('echo', 'y' x 5000);
+$dp->recv_ok( qr/error\t.*long/, 'command over limit causes error' );
+
+# Raise the limit for this connection
+$dp->discard_response;
+$long= 'z' x 5000;
+$dp->send('conn.buffer', '8K', '32K');
+$dp->send('echo', $long);
+$dp->recv_ok( qr/^\Q$long\E$/m, 'conn.buffer raises limit' );
+
+$dp->send('conn.buffer', '100', '32K');
+$dp->recv_ok( qr/error\t.*buffer size must be/, 'size below minimum rejected' );
+$dp->send('conn.buffer', 'foo', '32K');
+$dp->recv_ok( qr/error\t.*Expected size/, 'invalid size rejected' );
+
+$dp->terminate_ok;
+
+# Limit can be set with commandline option
+$dp= Test::DaemonProxy->new;
+$dp->run('-i', '--controller-recv-max', '2K');
+$dp->send('echo', 'x' x 3000);
+$dp->recv_ok( qr/error\t.*long/, 'command over --controller-recv-max causes error' );
+$dp->terminate_ok;
+
+# Pool buffers are allocated at the limit, and conn.buffer can't exceed it
+$dp= Test::DaemonProxy->new;
+$dp->run('-i', '--controller-pool', '2', '--controller-recv-max', '8K');
+$long= 'x' x 6000;
+$dp->send('echo', $long);
+$dp->recv_ok( qr/^\Q$long\E$/m, 'pool controller holds long command' );
+$dp->send('conn.buffer', '16K', '16K');
+$dp->recv_ok( qr/error\t.*buffer size must be/, 'can\'t exceed pool buffer size' );
+$dp->terminate_ok;
+
+done_testing;
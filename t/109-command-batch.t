@@ -0,0 +1,34 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i', '--controller-iterations', '3');
+
+# A batch with no errors replies with one "ok"
+$dp->send('batch.begin', 'b1');
+$dp->send('service.args', "svc$_", '/bin/true') for 1..200;
+$dp->send('batch.end');
+$dp->recv_ok( qr/^batch.end\tb1\tok$/m, 'batch succeeded' );
+
+# Errors are counted, and only the first is reported
+$dp->discard_response;
+$dp->send('batch.begin', 'b2');
+$dp->send('service.args', 'svc1', '/bin/true');
+$dp->send('bogus1');
+$dp->send('service.start', 'nonexistent');
+$dp->send('batch.end');
+$dp->recv_stdout_ok( qr/\A(.*?)^batch.end\tb2\terror\t2\tUnknown command: bogus1$/ms, 'batch reports errors' );
+unlike( $dp->last_captures->[0], qr/^error\t/m, 'no separate error events' );
+
+# Outside of a batch, errors are reported as usual
+$dp->send('batch.end');
+$dp->recv_ok( qr/^error\tnot in a batch/m, 'batch.end without batch.begin' );
+
+$dp->terminate_ok;
+done_testing;
@@ -0,0 +1,81 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use IO::Select;
+
+sub record {
+	my ($opcode, @fields)= @_;
+	my $body= pack('nn', $opcode, scalar @fields) . join('', map { pack('n/a*', $_) } @fields);
+	return pack('N', 4 + length $body) . $body;
+}
+
+my $dp= Test::DaemonProxy->new;
+my $buf= '';
+sub send_record {
+	local $SIG{PIPE}= sub {};
+	$dp->dp_stdin->print(record(@_));
+}
+sub recv_record {
+	while (1) {
+		if (length $buf >= 4) {
+			my $len= unpack('N', $buf);
+			if (length $buf >= $len) {
+				my ($opcode, $count)= unpack('x4 nn', $buf);
+				my @fields= unpack("x8 (n/a*)$count", $buf);
+				substr($buf, 0, $len)= '';
+				return [ $opcode, @fields ];
+			}
+		}
+		IO::Select->new($dp->dp_stdout)->can_read($dp->timeout) or return undef;
+		sysread($dp->dp_stdout, $buf, 65536, length $buf) or return undef;
+	}
+}
+
+$dp->run('-i');
+$dp->sync; # consume the interactive-mode banner
+$dp->send('conn.protocol', 'binary');
+is_deeply( recv_record(), [ 11, 'binary' ], 'reply to conn.protocol is a record' );
+
+send_record(13, 'hello', 'world');
+is_deeply( recv_record(), [ 0, 'hello', 'world' ], 'echo by opcode' );
+
+send_record(0, 'echo', 'by name');
+is_deeply( recv_record(), [ 0, 'by name' ], 'echo by name' );
+
+send_record(6, 'foo', '/bin/true', 'x');
+is_deeply( recv_record(), [ 6, 'foo', '/bin/true', 'x' ], 'service.args event' );
+
+send_record(0, 'nonexistent');
+my $r= recv_record();
+is( $r->[0], 1, 'error event' );
+like( $r->[1], qr/Unknown command/, 'error message' );
+
+send_record(13, "a\tb");
+$r= recv_record();
+is( $r->[0], 1, 'field with TAB is rejected' );
+
+send_record(13, 'x' x 5000);
+$r= recv_record();
+like( $r->[1], qr/long/, 'record over limit rejected' );
+send_record(13, 'after');
+is_deeply( recv_record(), [ 0, 'after' ], 'next record still works' );
+
+# The last opcode in the documented list, and one past it
+send_record(49, 'foo');
+$r= recv_record();
+is( $r->[0], 1, 'service.flapping by opcode' );
+like( $r->[1], qr/Unknown command/, 'service.flapping is an event, not a command' );
+send_record(50, 'foo');
+$r= recv_record();
+like( $r->[1], qr/unknown opcode/, 'opcode past the end of the list' );
+
+send_record(11, 'text');
+$dp->recv_ok( qr/^conn.protocol\ttext$/m, 'back to text protocol' );
+$dp->terminate_ok;
+
+done_testing;
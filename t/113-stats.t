@@ -0,0 +1,46 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(2.5);
+
+$dp->send('service.args',    'foo', 'true');
+$dp->send('service.fds',     'foo', 'null', 'stderr', 'stderr');
+$dp->send('service.auto_up', 'foo', '1', 'always');
+$dp->recv_ok( qr/^service.state	foo	up/m, 'started' );
+$dp->recv_ok( qr/^service.state	foo	down.*exit	0/m, 'exited' );
+$dp->recv_ok( qr/^service.state	foo	up/m, 'restarted' );
+$dp->send('service.auto_up', 'foo', '1');
+$dp->sync;
+
+$dp->send('stats');
+$dp->send('echo', 'end');
+$dp->recv_stdout_ok( qr/\A(.*?)^end$/ms, 'stats reply' );
+my %stats= map { /^stats\t(\S+)\t(.*)$/? ($1 => $2) : () } split /\n/, $dp->last_captures->[0];
+
+for (qw( loop.iterations wake.fd conn.commands conn.bytes_in conn.bytes_out conn.events )) {
+	like( $stats{$_}, qr/^[1-9]\d*$/, "counter $_" );
+}
+is( $stats{'log.lost'}, 0, 'no lost log messages' );
+
+like( $stats{'loop.busy'}, qr/^[1-9]\d*\t\d+\t\d+\t[\d,]+$/, 'loop.busy histogram' );
+my ($count, $sum, $max, $buckets)= split /\t/, $stats{'service.spawn'};
+cmp_ok( $count, '>=', 2, 'service.spawn count' );
+my $n= 0; $n += $_ for split /,/, $buckets;
+is( $n, $count, 'spawn buckets add up to count' );
+cmp_ok( $max, '<=', $sum, 'max <= sum' );
+($count, $sum)= split /\t/, $stats{'service.restart'};
+cmp_ok( $count, '>=', 1, 'service.restart count' );
+cmp_ok( $sum, '>=', 500000, 'restart includes restart interval' );
+
+like( $stats{conn}, qr/^\d+\t[1-9]\d*\t[1-9]\d*\t[1-9]\d*\t[1-9]\d*\t0$/, 'per-connection totals' );
+
+$dp->terminate_ok;
+done_testing;
@@ -0,0 +1,45 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(2);
+
+$dp->send('service.flap_limit', 'foo', 9, 60);
+$dp->recv_ok( qr/^error\t.*invalid flap limit/m, 'count over history size rejected' );
+$dp->send('service.flap_limit', 'foo', 3, 0);
+$dp->recv_ok( qr/^error\t.*invalid flap limit/m, 'zero window rejected' );
+$dp->send('service.flap_limit', 'foo', 3, 60);
+$dp->recv_ok( qr/^service.flap_limit\tfoo\t3\t60$/m, 'flap_limit event' );
+
+# A service which keeps failing is no longer restarted by auto_up
+$dp->send('service.args', 'foo', 'false');
+$dp->send('service.fds', 'foo', 'null', 'stderr', 'stderr');
+$dp->send('service.auto_up', 'foo', 1, 'always');
+$dp->timeout(8);
+$dp->recv_ok( qr/^service.flapping\tfoo\t3\t60$/m, 'flapping detected' );
+$dp->timeout(3);
+ok( !$dp->recv( qr/^service.state\tfoo\tstart/m ), 'not restarted' );
+$dp->timeout(2);
+
+$dp->send('statedump');
+$dp->recv_ok( qr/^service.flapping\tfoo\t3\t60$/m, 'statedump has flapping' );
+$dp->send('service.history', 'foo');
+$dp->recv_ok( qr/((?:^service.history\tfoo\t\d+\t\d+\texit\t1\n){3})/m, 'history of failed runs' );
+
+# Starting it lets auto_up take over again
+$dp->send('service.start', 'foo');
+$dp->recv_ok( qr/^service.flapping\tfoo\t-$/m, 'flapping cleared' );
+$dp->recv_ok( qr/^service.state\tfoo\tstart/m, 'foo started' );
+
+$dp->send('service.auto_up', 'foo', 1);
+$dp->send('service.flap_limit', 'foo', '-');
+$dp->recv_ok( qr/^service.flap_limit\tfoo\t-$/m, 'flap_limit disabled' );
+$dp->terminate_ok;
+done_testing;
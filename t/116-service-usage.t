@@ -0,0 +1,37 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i', '--subreaper');
+$dp->timeout(3);
+
+# The down event reports what the run used
+$dp->send('service.args', 'busy', 'perl', '-e', '1 while (times)[0] < 0.2');
+$dp->send('service.fds', 'busy', 'null', 'stderr', 'stderr');
+$dp->send('service.start', 'busy');
+$dp->recv_ok( qr/^service.state\tbusy\tdown\t\d+\t\d+\texit\t0\t\d+\t\d+\t(\d+)\t(\d+)\t(\d+)\t(\d+)\t(\d+)$/m, 'down event with usage' );
+my ($user_ms, $sys_ms, $maxrss, $vcsw, $ivcsw)= @{ $dp->last_captures };
+cmp_ok( $user_ms, '>=', 150, 'user CPU time' );
+cmp_ok( $maxrss, '>', 0, 'max RSS' );
+
+$dp->send('service.start', 'busy');
+$dp->recv_ok( qr/^service.state\tbusy\tdown\t\d+\t\d+\texit\t0\t/m, 'second run' );
+$dp->send('statedump');
+$dp->recv_ok( qr/^service.usage\tbusy\t2\t(\d+)\t\d+\t\d+\t\d+\t\d+$/m, 'statedump reports totals' );
+cmp_ok( $dp->last_captures->[0], '>=', 300, 'total user CPU time' );
+
+# Processes left behind are charged to the service
+$dp->send('service.args', 'leaky', 'sh', '-c', 'perl -e "1 while (times)[0] < 0.2" & exit 0');
+$dp->send('service.fds', 'leaky', 'null', 'stderr', 'stderr');
+$dp->send('service.start', 'leaky');
+$dp->recv_ok( qr/^service.state\tleaky\tdown\t\d+\t\d+\texit\t0\t\d+\t\d+\t(\d+)\t/m, 'leaky down' );
+cmp_ok( $dp->last_captures->[0], '>=', 150, 'orphan CPU time charged' );
+
+$dp->terminate_ok;
+done_testing;
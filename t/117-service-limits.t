@@ -0,0 +1,57 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(3);
+
+# Settings are applied by the child before exec
+$dp->send('service.args', 'lim', 'sh', '-c', 'echo "nofile=$(ulimit -n) nice=$(nice)"; grep Cpus_allowed_list /proc/self/status');
+$dp->send('service.fds', 'lim', 'null', 'stderr', 'stderr');
+$dp->send('service.limits', 'lim', 'rlimit.nofile=100:200', 'nice=5', 'cpus=0');
+$dp->recv_ok( qr/^service.limits\tlim\trlimit.nofile=100:200\tnice=5\tcpus=0$/m, 'limits event' );
+$dp->send('service.start', 'lim');
+$dp->recv_stderr_ok( qr/^nofile=100 nice=5$/m, 'rlimit and nice applied' );
+$dp->recv_stderr_ok( qr/^Cpus_allowed_list:\s+0$/m, 'affinity applied' );
+$dp->recv_ok( qr/^service.state\tlim\tdown\t\d+\t\d+\texit\t0\t/m, 'lim exited' );
+
+$dp->send('statedump');
+$dp->recv_ok( qr/^service.limits\tlim\trlimit.nofile=100:200\tnice=5\tcpus=0$/m, 'statedump shows limits' );
+
+# Bad settings are rejected
+for ([ 'rlimit.bogus=1', qr/unknown rlimit/ ],
+	[ 'rlimit.nofile=300:200', qr/soft limit/ ],
+	[ 'nice=20', qr/nice/ ],
+	[ 'ionice=fast', qr/ionice/ ],
+	[ 'cpus=3-1', qr/cpu list/ ],
+	[ 'frobnicate=1', qr/unknown setting/ ],
+	[ 'nice', qr/KEY=VALUE/ ],
+) {
+	my ($setting, $err)= @$_;
+	$dp->send('service.limits', 'lim', $setting);
+	$dp->recv_ok( qr/^error\t.*$err/m, "reject $setting" );
+}
+
+# cgroup settings need a cgroup to write them into
+for ([ 'memory.max=64M', qr/require a cgroup/ ],
+	[ 'cgroup=sub', qr/relative cgroup path requires --cgroup/ ],
+	[ "cgroup=sub\tpids.max=10", qr/relative cgroup path requires --cgroup/ ],
+) {
+	my ($settings, $err)= @$_;
+	$dp->send('service.limits', 'lim', split /\t/, $settings);
+	$dp->recv_ok( qr/^error\t.*$err/m, "reject ".join(" ", split /\t/, $settings)." without --cgroup" );
+}
+$dp->send('service.limits', 'lim', 'cgroup=/sys/fs/cgroup/nosuch', 'pids.max=10');
+$dp->recv_ok( qr/^service.limits\tlim\tcgroup=\/sys\/fs\/cgroup\/nosuch\tpids.max=10$/m, 'absolute cgroup path accepted' );
+
+$dp->send('service.limits', 'lim');
+$dp->recv_ok( qr/^service.limits\tlim\t$/m, 'limits cleared' );
+
+$dp->terminate_ok;
+done_testing;
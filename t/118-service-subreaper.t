@@ -0,0 +1,70 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'sleep';
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i', '--subreaper');
+$dp->timeout(3);
+
+# The main process exits right away, but the service stays up until the
+# process it left behind exits too.
+$dp->send('service.args', 'leaky', 'sh', '-c', 'sleep 2 & exit 3');
+$dp->send('service.fds', 'leaky', 'null', 'stderr', 'stderr');
+$dp->send('service.start', 'leaky');
+$dp->recv_ok( qr/^service.state\tleaky\tup/m, 'leaky up' );
+sleep 1;
+$dp->send('statedump');
+$dp->recv_ok( qr/^service.state\tleaky\tup/m, 'still up while its orphan runs' );
+$dp->recv_ok( qr/^service.state\tleaky\tdown\t\d+\t\d+\texit\t3\t/m, 'down with status of main process' );
+
+$dp->send('stats');
+$dp->recv_ok( qr/^stats\treap.orphans\t1$/m, 'orphan charged to the service' );
+
+# Stopping the service signals the whole group
+$dp->send('service.args', 'tree', 'sh', '-c', 'sleep 10 & sleep 10 & wait');
+$dp->send('service.fds', 'tree', 'null', 'stderr', 'stderr');
+$dp->send('service.start', 'tree');
+$dp->recv_ok( qr/^service.state\ttree\tup/m, 'tree up' );
+sleep .3;
+$dp->send('service.stop', 'tree');
+$dp->recv_ok( qr/^service.state\ttree\tdown\t\d+\t\d+\tsignal\tSIGTERM/m, 'whole tree stopped' );
+
+# With a cgroup, processes which leave the process group are still the
+# service's, and stopping the service reaches them too
+my ($cgroup_mount)= map { (split / /)[4] } grep { / - cgroup2 / } do {
+	open(my $f, '<', '/proc/self/mountinfo') or die "mountinfo: $!"; <$f>
+};
+SKIP: {
+	skip 'no writable cgroup2 hierarchy', 7 unless $cgroup_mount && -w $cgroup_mount;
+	my $cgroup= "$cgroup_mount/daemonproxy-t118-$$";
+	$dp->send('service.args', 'escapee', 'sh', '-c', 'setsid sleep 2 & exit 3');
+	$dp->send('service.fds', 'escapee', 'null', 'stderr', 'stderr');
+	$dp->send('service.limits', 'escapee', "cgroup=$cgroup");
+	$dp->send('service.start', 'escapee');
+	$dp->recv_ok( qr/^service.state\tescapee\tup/m, 'escapee up' );
+	sleep 1;
+	$dp->send('statedump');
+	$dp->recv_ok( qr/^service.state\tescapee\tup/m, 'still up while its new session runs' );
+	$dp->recv_ok( qr/^service.state\tescapee\tdown\t\d+\t\d+\texit\t3\t/m, 'down with status of main process' );
+	$dp->send('stats');
+	# (one from leaky, two from tree, and this one)
+	$dp->recv_ok( qr/^stats\treap.orphans\t4$/m, 'process in its own session charged to the service' );
+	$dp->recv_ok( qr/^stats\treap.unowned\t0$/m, 'nothing unowned' );
+
+	$dp->send('service.args', 'escapee', 'sh', '-c', 'setsid sleep 10 & sleep 10');
+	$dp->send('service.start', 'escapee');
+	$dp->recv_ok( qr/^service.state\tescapee\tup/m, 'escapee up again' );
+	sleep .3;
+	$dp->send('service.stop', 'escapee');
+	$dp->recv_ok( qr/^service.state\tescapee\tdown\t\d+\t\d+\tsignal\tSIGTERM/m, 'new session stopped too' );
+	rmdir $cgroup;
+}
+
+$dp->terminate_ok;
+done_testing;
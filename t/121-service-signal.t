@@ -40,6 +40,17 @@ $dp->response_like( qr!^service.state\tfoo\tup!m, 'service started' );
 $dp->send('service.signal', 'foo', 'SIGQUIT', 'group');
 $dp->response_like( qr!^service.state\tfoo\tdown\t.*\tsignal\tSIGQUIT\t!m, 'process group signalled SIGHUP' );
 
+# A service that doesn't lead a process group can't be signalled as a group
+$dp->send('service.args', 'bar', 'perl', '-e', '$|=1;print "ready\n";sleep 1000;');
+$dp->send('service.fds',  'bar', 'null', 'stderr', 'stderr');
+$dp->send('service.start', 'bar');
+ok( $dp->recv_stderr(qr!^ready$!m), 'service ready' );
+$dp->response_like( qr!^service.state\tbar\tup!m, 'service started' );
+$dp->send('service.signal', 'bar', 'SIGQUIT', 'group');
+$dp->response_like( qr!^error:.*can't kill bar \(pgid \d+\)!m, 'no process group' );
+$dp->send('service.signal', 'bar', 'SIGQUIT');
+$dp->response_like( qr!^service.state\tbar\tdown\t.*\tsignal\tSIGQUIT\t!m, 'still running until signalled directly' );
+
 $dp->send('terminate', 0);
 $dp->exit_is( 0 );
 
@@ -0,0 +1,54 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'sleep';
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(3);
+
+# A service which ignores SIGTERM gets SIGKILL after the timeout
+$dp->send('service.args', 'stubborn', 'perl', '-e', '$SIG{TERM}="IGNORE"; sleep 10');
+$dp->send('service.fds', 'stubborn', 'null', 'stderr', 'stderr');
+$dp->send('service.start', 'stubborn');
+$dp->recv_ok( qr/^service.state\tstubborn\tup/m, 'stubborn up' );
+sleep .3; # let perl install its handler
+$dp->send('service.stop', 'stubborn', 1);
+$dp->recv_ok( qr/^service.state\tstubborn\tstopping\t\d+\t\d+/m, 'stubborn stopping' );
+$dp->recv_ok( qr/^service.state\tstubborn\tdown\t\d+\t\d+\tsignal\tSIGKILL/m, 'stubborn killed' );
+
+# A stopped service is not restarted by auto_up
+$dp->send('service.args', 'polite', 'sleep', 10);
+$dp->send('service.fds', 'polite', 'null', 'stderr', 'stderr');
+$dp->send('service.auto_up', 'polite', 1, 'always');
+$dp->recv_ok( qr/^service.state\tpolite\tup/m, 'polite up' );
+$dp->send('service.stop', 'polite');
+$dp->recv_ok( qr/^service.state\tpolite\tdown\t\d+\t\d+\tsignal\tSIGTERM/m, 'polite stopped' );
+sleep 1.5;
+$dp->send('statedump');
+$dp->recv_ok( qr/^service.state\tpolite\tdown/m, 'polite not restarted' );
+$dp->send('service.stop', 'nonexistent');
+$dp->recv_ok( qr/^error\t.*service/m, 'stop of unknown service is an error' );
+
+# stop_all stops dependents before the services they require
+$dp->send('service.args', 'db', 'sleep', 10);
+$dp->send('service.fds', 'db', 'null', 'stderr', 'stderr');
+$dp->send('service.args', 'app', 'perl', '-e', '$SIG{TERM}=sub{ select undef,undef,undef,0.5; exit 0 }; sleep 10');
+$dp->send('service.fds', 'app', 'null', 'stderr', 'stderr');
+$dp->send('service.requires', 'app', 'db');
+$dp->send('service.start', 'app');
+$dp->recv_ok( qr/^service.state\tapp\tup/m, 'app up' );
+sleep .3;
+$dp->discard_response;
+$dp->send('service.stop_all', 5);
+$dp->recv_stdout_ok( qr/\A(.*?^service.state\tdb\tdown.*?)$/ms, 'all stopped' );
+my @events= $dp->last_captures->[0] =~ /^service.state\t(app\t\w+|db\t\w+)/mg;
+is_deeply( \@events, [ "app\tstopping", "app\tdown", "db\tstopping", "db\tdown" ], 'app stopped before db' );
+
+$dp->terminate_ok;
+done_testing;
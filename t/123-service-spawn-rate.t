@@ -0,0 +1,43 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'time';
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i', '--spawn-rate', 2);
+$dp->timeout(3);
+
+for (qw( a b c d e )) {
+	$dp->send('service.args', $_, 'sleep', 10);
+	$dp->send('service.fds', $_, 'null', 'stderr', 'stderr');
+	$dp->send('service.auto_up', $_, 1, 'SIGHUP');
+}
+$dp->send('service.priority', 'c', 10);
+$dp->recv_ok( qr/^service.priority\tc\t10$/m, 'priority event' );
+$dp->send('service.priority', 'e', 5);
+$dp->send('service.priority', 'a', 'high');
+$dp->recv_ok( qr/^error\t.*Expected integer/m, 'priority must be integer' );
+$dp->discard_response;
+
+# The signal starts all five in the same pass of the main loop.  Two can fork
+# right away, and the rest get one token every half second.
+my $t0= time;
+kill HUP => $dp->pid;
+$dp->recv_stdout_ok( qr/\A(.*?^service.state\t\w\tup.*?^service.state\t\w\tup.*?^service.state\t\w\tup.*?^service.state\t\w\tup.*?^service.state\t\w\tup.*?)$/ms, 'all started' );
+my $elapsed= time - $t0;
+my @up= $dp->last_captures->[0] =~ /^service.state\t(\w)\tup/mg;
+is_deeply( [ @up[0,1] ], [ 'c', 'e' ], 'highest priority first' );
+is_deeply( [ sort @up[2..4] ], [ 'a', 'b', 'd' ], 'then the rest' );
+cmp_ok( $elapsed, '>=', 1.2, 'starts were spread out' );
+
+$dp->send('statedump');
+$dp->recv_ok( qr/^service.priority\te\t5$/m, 'statedump has priority' );
+
+$dp->send('service.signal', $_, 'SIGTERM') for qw( a b c d e );
+$dp->terminate_ok;
+done_testing;
@@ -0,0 +1,83 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(2);
+
+$dp->send('service.backoff', 'foo', 4, 0);
+$dp->recv_ok( qr/^error\t.*invalid backoff/m, 'zero max interval rejected' );
+$dp->send('service.backoff', 'foo', 4, 4, 101);
+$dp->recv_ok( qr/^error\t.*invalid backoff/m, 'jitter over 100% rejected' );
+
+$dp->send('service.backoff', 'foo', 4, 4, 0, 60);
+$dp->recv_ok( qr/^service.backoff\tfoo\t4\t4\t0\t60$/m, 'backoff event' );
+
+# Each quick exit waits 4x longer than the last, up to the max of 4 seconds
+$dp->send('service.args', 'foo', 'false');
+$dp->send('service.fds', 'foo', 'null', 'stderr', 'stderr');
+$dp->send('service.auto_up', 'foo', 1, 'always');
+for my $expect (1, 4, 4) {
+	$dp->timeout($expect + 2);
+	$dp->recv_ok( qr/^service.state\tfoo\tdown\t(\d+)/m, 'foo exited' );
+	my $down_ts= $dp->last_captures->[0];
+	$dp->recv_ok( qr/^service.state\tfoo\tstart\t(\d+)/m, 'foo restarting' );
+	my $delay= $dp->last_captures->[0] - $down_ts;
+	ok( $delay >= $expect - 1 && $delay <= $expect + 1, "waited about $expect seconds" )
+		or diag "waited $delay";
+}
+
+$dp->send('statedump');
+$dp->recv_ok( qr/^service.backoff\tfoo\t4\t4\t0\t60$/m, 'statedump has backoff' );
+$dp->send('service.backoff', 'foo', '-');
+$dp->recv_ok( qr/^service.backoff\tfoo\t-$/m, 'backoff disabled' );
+
+$dp->send('service.auto_up', 'foo', 1);
+
+# Without a MIN_INTERVAL, backoff starts from 1 second instead of
+# restarting in a tight loop
+$dp->send('service.args', 'bar', 'false');
+$dp->send('service.fds', 'bar', 'null', 'stderr', 'stderr');
+$dp->send('service.backoff', 'bar', 2, 4, 0, 60);
+$dp->send('service.auto_up', 'bar', '-', 'always');
+for my $expect (1, 2, 4) {
+	$dp->timeout($expect + 2);
+	$dp->recv_ok( qr/^service.state\tbar\tdown\t(\d+)/m, 'bar exited' );
+	my $down_ts= $dp->last_captures->[0];
+	$dp->recv_ok( qr/^service.state\tbar\tstart\t(\d+)/m, 'bar restarting' );
+	my $delay= $dp->last_captures->[0] - $down_ts;
+	ok( $delay >= $expect - 1 && $delay <= $expect + 1, "waited about $expect seconds" )
+		or diag "waited $delay";
+}
+$dp->send('service.auto_up', 'bar', '-');
+
+# Jitter spreads out the restarts of services which fail together
+$dp->send('log.filter', '-'); # show debug messages
+my @names= map "j$_", 1..8;
+for (@names) {
+	$dp->send('service.args', $_, 'false');
+	$dp->send('service.fds', $_, 'null', 'stderr', 'stderr');
+	$dp->send('service.backoff', $_, 1, 2, 100, 60);
+}
+$dp->send('service.auto_up', $_, 2, 'always') for @names;
+my %delay;
+$dp->timeout(3);
+while (keys %delay < @names
+	&& $dp->recv_stderr( qr/service "(j\d)" ran \d+ seconds, restarting in (\d+) seconds/ )
+) {
+	$delay{$dp->last_captures->[0]}= $dp->last_captures->[1];
+}
+is( scalar keys %delay, scalar @names, 'all restarts delayed' );
+ok( !grep($_ > 4, values %delay), 'delays within 100% of 2 seconds' );
+ok( scalar(keys %{{ reverse %delay }}) > 1, 'delays differ' )
+	or diag explain \%delay;
+$dp->send('service.auto_up', $_, '-') for @names;
+
+$dp->terminate_ok;
+done_testing;
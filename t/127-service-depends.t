@@ -0,0 +1,55 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(2);
+
+for (qw( db app web cron )) {
+	$dp->send('service.args', $_, 'sleep', 10);
+	$dp->send('service.fds', $_, 'null', 'stderr', 'stderr');
+}
+$dp->send('service.requires', 'app', 'db');
+$dp->recv_ok( qr/^service.requires\tapp\tdb$/m, 'requires event' );
+$dp->send('service.requires', 'web', 'app');
+$dp->send('service.after', 'web', 'cron');
+$dp->recv_ok( qr/^service.after\tweb\tcron$/m, 'after event' );
+
+# A cycle is rejected
+$dp->send('service.requires', 'db', 'web');
+$dp->recv_ok( qr/^error\t.*dependency cycle through "web"/m, 'cycle rejected' );
+$dp->send('service.after', 'db', 'db');
+$dp->recv_ok( qr/^error\t.*dependency cycle/m, 'self-dependency rejected' );
+
+# Starting web pulls in app and db, in order, but not cron
+$dp->discard_response;
+$dp->send('service.start', 'web');
+$dp->recv_stdout_ok( qr/\A(.*?^service.state\tweb\tup.*?)$/ms, 'web up' );
+my @up= $dp->last_captures->[0] =~ /^service.state\t(\w+)\tup/mg;
+is_deeply( \@up, [ 'db', 'app', 'web' ], 'started in dependency order' );
+
+$dp->send('statedump');
+$dp->send('echo', 'end');
+$dp->recv_stdout_ok( qr/\A(.*?)^end$/ms, 'statedump' );
+my $dump= $dp->last_captures->[0];
+like( $dump, qr/^service.requires\tapp\tdb$/m, 'statedump has requires' );
+like( $dump, qr/^service.after\tweb\tcron$/m, 'statedump has after' );
+like( $dump, qr/^service.state\tcron\tdown/m, 'cron not started' );
+unlike( $dump, qr/^service.requires\tdb\t/m, 'no requires for db' );
+
+# A missing requirement cancels the start
+$dp->send('service.args', 'orphan', 'sleep', 10);
+$dp->send('service.requires', 'orphan', 'nonexistent');
+$dp->send('service.start', 'orphan');
+$dp->recv_ok( qr/^service.state\torphan\tstart/m, 'orphan starting' );
+$dp->recv_ok( qr/^service.state\torphan\tdown/m, 'orphan start cancelled' );
+
+$dp->send('service.signal', $_, 'SIGTERM') for qw( db app web );
+$dp->terminate_ok;
+done_testing;
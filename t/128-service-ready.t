@@ -0,0 +1,92 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(3);
+
+# The service gets control.ready as fd 3, and reports ready after a moment
+$dp->send('service.args', 'db', 'sh', '-c', 'sleep 1; echo >&3; exec sleep 10');
+$dp->send('service.fds', 'db', 'null', 'stderr', 'stderr', 'control.ready');
+$dp->send('service.args', 'app', 'sleep', 10);
+$dp->send('service.fds', 'app', 'null', 'stderr', 'stderr');
+$dp->send('service.requires', 'app', 'db');
+$dp->discard_response;
+
+$dp->send('service.start', 'app');
+$dp->recv_stdout_ok( qr/\A(.*?^service.state\tapp\tup.*?)$/ms, 'app up' );
+my @states= $dp->last_captures->[0] =~ /^service.state\t(db\t\w+|app\tup)/mg;
+is_deeply( \@states, [ "db\tstart", "db\tup", "db\tready", "app\tup" ], 'app waited for db to be ready' );
+
+$dp->send('statedump');
+$dp->recv_ok( qr/^service.state\tdb\tready\t\d+\t\d+\t-\t-\t\d+\t-$/m, 'statedump shows ready' );
+
+# A service which never reports ready is terminated after the timeout
+$dp->send('service.args', 'slow', 'sleep', 10);
+$dp->send('service.fds', 'slow', 'null', 'stderr', 'stderr', 'control.ready');
+$dp->send('service.ready_timeout', 'slow', 1);
+$dp->recv_ok( qr/^service.ready_timeout\tslow\t1$/m, 'ready_timeout event' );
+$dp->send('service.start', 'slow');
+$dp->recv_ok( qr/^service.state\tslow\tup/m, 'slow up' );
+$dp->recv_ok( qr/^service.state\tslow\tdown\t\d+\t\d+\tsignal\tSIGTERM/m, 'slow terminated' );
+$dp->send('service.ready_timeout', 'slow', '-');
+$dp->recv_ok( qr/^service.ready_timeout\tslow\t-$/m, 'ready_timeout cleared' );
+
+# "after" also waits for the service to be ready, not just up
+$dp->send('service.args', 'cache', 'sh', '-c', 'sleep 1; echo >&3; exec sleep 10');
+$dp->send('service.fds', 'cache', 'null', 'stderr', 'stderr', 'control.ready');
+$dp->send('service.args', 'web', 'sleep', 10);
+$dp->send('service.fds', 'web', 'null', 'stderr', 'stderr');
+$dp->send('service.after', 'web', 'cache');
+$dp->discard_response;
+$dp->send('service.start', 'cache');
+$dp->send('service.start', 'web');
+$dp->recv_stdout_ok( qr/\A(.*?^service.state\tweb\tup.*?)$/ms, 'web up' );
+@states= $dp->last_captures->[0] =~ /^service.state\t(cache\t\w+|web\tup)/mg;
+is_deeply( \@states, [ "cache\tstart", "cache\tup", "cache\tready", "web\tup" ], 'web waited for cache to be ready' );
+
+# Closing control.ready without a line leaves the service not ready, and
+# services that require it fail when the timeout ends it
+$dp->send('service.args', 'mute', 'sh', '-c', 'exec 3>&-; exec sleep 10');
+$dp->send('service.fds', 'mute', 'null', 'stderr', 'stderr', 'control.ready');
+$dp->send('service.ready_timeout', 'mute', 2);
+$dp->send('service.args', 'user', 'sleep', 10);
+$dp->send('service.fds', 'user', 'null', 'stderr', 'stderr');
+$dp->send('service.requires', 'user', 'mute');
+$dp->discard_response;
+$dp->send('service.start', 'user');
+$dp->recv_ok( qr/^service.state\tmute\tup/m, 'mute up' );
+sleep 1;
+$dp->send('statedump');
+$dp->recv_ok( qr/^service.state\tmute\t(\w+)/m, 'mute state' );
+is( $dp->last_captures->[0], 'up', 'mute is still up and not ready' );
+$dp->recv_stdout_ok( qr/\A(.*?^service.state\tuser\tdown.*?)$/ms, 'user start failed' );
+unlike( $dp->last_captures->[0], qr/^service.state\tuser\tup\t\d+\t[1-9]/m, 'user never started' );
+$dp->recv_ok( qr/^service.state\tmute\tdown\t\d+\t\d+\tsignal\tSIGTERM/m, 'mute terminated' );
+
+# A service that reports ready and exits at once is still seen to be ready,
+# even when its exit is noticed first
+for my $i (1..5) {
+	$dp->send('service.args', "quick$i", 'sh', '-c', 'echo >&3');
+	$dp->send('service.fds', "quick$i", 'null', 'stderr', 'stderr', 'control.ready');
+}
+$dp->discard_response;
+$dp->send('service.start', "quick$_") for 1..5;
+my $events= '';
+for (1..5) {
+	$dp->recv_ok( qr/^service.state\tquick\d\tdown\t/m, 'quick exited' );
+	$events .= $dp->{last_input_removed};
+}
+for my $i (1..5) {
+	like( $events, qr/^service.state\tquick$i\tready\t.*^service.state\tquick$i\tdown\t/ms, "quick$i was ready first" );
+}
+
+$dp->send('service.signal', $_, 'SIGTERM') for qw( db app cache web );
+$dp->terminate_ok;
+done_testing;
@@ -0,0 +1,50 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+sub pidfd_count {
+	my $pid= shift;
+	return scalar grep { (readlink($_)||'') =~ /pidfd/ } glob("/proc/$pid/fd/*");
+}
+
+for my $backend (qw: epoll select :) {
+	my $dp= Test::DaemonProxy->new;
+	$dp->run('-i', '--event-backend', $backend);
+	$dp->timeout(2);
+
+	my %pid;
+	for my $name (qw( a b c )) {
+		$dp->send('service.args', $name, 'sleep', 10);
+		$dp->send('service.fds', $name, 'null', 'stderr', 'stderr');
+		$dp->send('service.start', $name);
+		$dp->recv_ok( qr/^service.state\t$name\tup\t\d+\t(\d+)/m, "$name up ($backend)" );
+		$pid{$name}= $dp->last_captures->[0];
+	}
+	if (!pidfd_count($dp->pid)) {
+		$dp->send('terminate', 0);
+		$dp->exit_is( 0 );
+		SKIP: { skip "daemonproxy is not using pidfds", 6 }
+		next;
+	}
+	is( pidfd_count($dp->pid), 3, "one pidfd per service ($backend)" );
+
+	# The exit of one process is noticed on its own pidfd, and only it is reaped
+	kill KILL => $pid{b};
+	$dp->recv_ok( qr/^service.state\tb\tdown\t\d+\t\d+\tsignal\tSIGKILL/m, "b reaped ($backend)" );
+	is( pidfd_count($dp->pid), 2, "pidfd of b closed ($backend)" );
+
+	kill KILL => @pid{'a','c'};
+	$dp->recv_ok( qr/^service.state\t[ac]\tdown/m, "first of a,c reaped ($backend)" );
+	$dp->recv_ok( qr/^service.state\t[ac]\tdown/m, "second of a,c reaped ($backend)" );
+	is( pidfd_count($dp->pid), 0, "all pidfds closed ($backend)" );
+
+	$dp->send('terminate', 0);
+	$dp->exit_is( 0 );
+}
+
+done_testing;
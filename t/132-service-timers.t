@@ -0,0 +1,47 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Time::HiRes 'clock_gettime', 'CLOCK_MONOTONIC';
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(2);
+
+# Many delayed starts share the timer heap.  Schedule them out of order, then
+# move some earlier or later and cancel one, and they must start in order.
+my %delay= ( a => 3, b => 1, c => 2, d => 3, e => 1, f => 2 );
+for (sort keys %delay) {
+	$dp->send('service.args', $_, 'true');
+	$dp->send('service.fds', $_, 'null', 'stderr', 'stderr');
+}
+my $now= int(clock_gettime(CLOCK_MONOTONIC));
+$dp->send('service.start', $_, $now + $delay{$_}) for sort keys %delay;
+$dp->send('service.start', 'a', $now + ($delay{a}= 1));
+$dp->send('service.start', 'c', $now + ($delay{c}= 3));
+$dp->send('service.start', 'd', '-');
+delete $delay{d};
+$dp->send('echo', 'scheduled');
+$dp->recv_ok( qr/^scheduled$/m, 'starts scheduled' );
+
+$dp->timeout(6);
+my @started;
+for (1 .. scalar keys %delay) {
+	$dp->recv_ok( qr/^service.state\t(\w)\tup\t(\d+)/m, 'service up' )
+		or last;
+	push @started, $dp->last_captures->[0];
+	cmp_ok( $dp->last_captures->[1], '>=', $now + $delay{$started[-1]}, "$started[-1] not started early" );
+}
+is_deeply( [ map $delay{$_}, @started ], [ sort map $delay{$_}, @started ], 'started in order of time' )
+	or diag "started: @started";
+is_deeply( [ sort @started ], [ sort keys %delay ], 'each service started once' );
+
+$dp->timeout(1);
+ok( !$dp->recv( qr/^service.state\td\tup/m ), 'cancelled start did not happen' );
+
+$dp->terminate_ok;
+done_testing;
@@ -0,0 +1,53 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+# Print the arguments and which of fds 0..40 are open
+my $report= 'use POSIX; print STDERR "args=".join("|",@ARGV)." fds=".join(",", grep { $!=0; POSIX::lseek($_,0,0); !$!{EBADF} } 0..40)."\n"';
+
+# With --service-pool, the exec plan is built on the stack at each start
+# instead of being kept with the service.
+for my $opts ([], ['--service-pool', '4x1K']) {
+	my $mode= @$opts? 'pool' : 'malloc';
+	my $dp= Test::DaemonProxy->new;
+	$dp->run('-i', @$opts);
+	$dp->timeout(2);
+
+	$dp->send('service.args', 'foo', 'perl', '-e', $report, 'one', 'two words', 3);
+	$dp->send('service.fds', 'foo', 'null', 'stderr', 'stderr', '-', 'stderr');
+	$dp->send('service.start', 'foo');
+	$dp->recv_ok( qr/^args=one\|two words\|3 fds=0,1,2,4$/m, "argv and fds in place, others closed ($mode)" );
+	$dp->recv_ok( qr/^service.state\tfoo\tdown\t\d+\t\d+\texit\t0/m, "foo exited ($mode)" );
+
+	# Changing the args replaces the plan
+	$dp->send('service.args', 'foo', 'perl', '-e', $report, 'again');
+	$dp->send('service.start', 'foo');
+	$dp->recv_ok( qr/^args=again fds=0,1,2,4$/m, "new args used ($mode)" );
+	$dp->recv_ok( qr/^service.state\tfoo\tdown/m, "foo exited ($mode)" );
+
+	# The vfork()ed child can't log, so the parent reports a failed exec
+	$dp->send('service.args', 'bad', 'no-such-program-for-daemonproxy');
+	$dp->send('service.fds', 'bad', 'null', 'stderr', 'stderr');
+	$dp->send('service.start', 'bad');
+	$dp->recv_ok( qr/exec\(no-such-program-for-daemonproxy, ...\) failed/m, "exec failure logged ($mode)" );
+	$dp->recv_ok( qr/^service.state\tbad\tdown\t\d+\t\d+\texit\t[1-9]/m, "bad exited ($mode)" );
+
+	# An fd name which doesn't exist fails the start in the parent, which
+	# retries until the fd is created.
+	$dp->send('service.fds', 'foo', 'null', 'stderr', 'stderr', 'later');
+	$dp->send('service.start', 'foo');
+	$dp->recv_ok( qr/file descriptor "later" does not exist/m, "undefined fd reported ($mode)" );
+	$dp->recv_ok( qr/will retry in \d+ seconds/m, "start will be retried ($mode)" );
+	$dp->send('fd.pipe', 'later.r', 'later');
+	$dp->timeout(5);
+	$dp->recv_ok( qr/^args=again fds=0,1,2,3$/m, "started once the fd exists ($mode)" );
+
+	$dp->terminate_ok;
+}
+
+done_testing;
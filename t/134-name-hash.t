@@ -0,0 +1,59 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+# Names are found through a hash table with linear probing, where removing a
+# name shifts the entries after it.  Add enough names to make long probe runs,
+# then remove them in a scrambled order.  Every lookup must still succeed.
+srand(42);
+sub scrambled { my @x= @_; for (my $i= @x; --$i;) { my $j= int rand($i+1); @x[$i,$j]= @x[$j,$i]; } @x }
+
+my @services= map { "svc$_" } 1..300;
+my @fds= map { ("pipe$_.r", "pipe$_.w") } 1..100;
+
+# With --service-pool and --fd-pool the tables have a fixed size
+for my $opts ([], ['--service-pool', '300x256', '--fd-pool', '210x64']) {
+	my $mode= @$opts? 'pool' : 'malloc';
+	my $dp= Test::DaemonProxy->new;
+	$dp->run('-i', @$opts);
+	$dp->timeout(5);
+
+	$dp->send('service.tags', $_, $_) for @services;
+	$dp->send('fd.pipe', "pipe$_.r", "pipe$_.w") for 1..100;
+	$dp->send('echo', 'created');
+	$dp->recv_ok( qr/((?:.*\n)*?)^created$/m, "created names ($mode)" );
+	unlike( $dp->last_captures->[0], qr/^error/m, "no errors creating ($mode)" );
+
+	my @order= scrambled(@services);
+	my @gone= splice(@order, 0, 150);
+	$dp->send('service.delete', $_) for @gone;
+	# each remaining service can still be found after the shifting
+	$dp->send('service.tags', $_) for @order;
+	# and each deleted one is gone
+	$dp->send('service.delete', $_) for @gone[0..9];
+	$dp->send('echo', 'done');
+	$dp->recv_ok( qr/((?:.*\n)*?)^done$/m, "deleted half of the services ($mode)" );
+	my $out= $dp->last_captures->[0];
+	is( scalar(() = $out =~ /^service.state\tsvc\d+\tdeleted/mg), 150, "150 deleted ($mode)" );
+	is( scalar(() = $out =~ /^service.tags\tsvc(\d+)\t$/mg), 150, "150 remain ($mode)" );
+	is( scalar(() = $out =~ /^error\tNo such service/mg), 10, "deleted ones not found ($mode)" );
+
+	$dp->send('service.delete', $_) for @order;
+	$dp->send('fd.delete', $_) for scrambled(@fds);
+	$dp->send('statedump');
+	$dp->send('echo', 'done');
+	$dp->recv_ok( qr/((?:.*\n)*?)^done$/m, "deleted the rest ($mode)" );
+	$out= $dp->last_captures->[0];
+	unlike( $out, qr/^error/m, "every name was found ($mode)" );
+	is( scalar(() = $out =~ /^fd.state\tpipe\d+\.[rw]\tdeleted/mg), 200, "200 fds deleted ($mode)" );
+	unlike( $out, qr/^(service|fd)\.state\t(svc|pipe)[\d.rw]+\t(?!deleted)/m, "statedump is empty ($mode)" );
+
+	$dp->terminate_ok;
+}
+
+done_testing;
@@ -0,0 +1,58 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+
+# Handles are indexed by descriptor number, and statedump sanity-checks that
+# index for each handle (in debug builds).  Churn the handles, so that numbers
+# get re-used by other names, and make sure the index keeps up.
+#
+# With --fd-pool the index has a fixed size, so also push descriptor numbers
+# beyond it by holding a pidfd open for each of many running services.
+for my $opts ([], ['--fd-pool', '20x64']) {
+	my $mode= @$opts? 'pool' : 'malloc';
+	my $dp= Test::DaemonProxy->new;
+	$dp->run('-i', @$opts);
+	$dp->timeout(2);
+
+	if (@$opts) {
+		for (1..40) {
+			$dp->send('service.args', "sleep$_", 'sleep', 10);
+			$dp->send('service.fds', "sleep$_", 'null', 'null', 'null');
+			$dp->send('service.start', "sleep$_");
+		}
+	}
+	for my $round (1..5) {
+		# replace the pipes by name, sometimes with the ends swapped
+		for (1..3) {
+			my @names= ("p$_.r", "p$_.w");
+			@names= reverse @names if ($round + $_) % 2;
+			$dp->send('fd.pipe', @names);
+		}
+		$dp->send('fd.delete', 'p2.r') if $round % 2;
+		$dp->send('fd.open', 'f', 'read', '/dev/null');
+		$dp->send('statedump');
+		$dp->send('echo', "round $round");
+		$dp->recv_ok( qr/((?:.*\n)*?)^round $round$/m, "round $round ($mode)" );
+		unlike( $dp->last_captures->[0], qr/^error/m, "no errors in round $round ($mode)" );
+	}
+
+	# The final pipe connects two services
+	$dp->send('fd.pipe', 'p1.r', 'p1.w');
+	$dp->send('service.args', 'writer', 'sh', '-c', 'echo through the pipe');
+	$dp->send('service.fds', 'writer', 'null', 'p1.w', 'stderr');
+	$dp->send('service.args', 'reader', 'sh', '-c', 'read x; echo "got: $x" >&2');
+	$dp->send('service.fds', 'reader', 'p1.r', 'null', 'stderr');
+	$dp->send('service.start', 'reader');
+	$dp->send('service.start', 'writer');
+	$dp->recv_ok( qr/^got: through the pipe$/m, "services use the right descriptors ($mode)" );
+
+	$dp->send('service.signal', "sleep$_", 'SIGTERM') for 1..40;
+	$dp->terminate_ok;
+}
+
+done_testing;
@@ -30,6 +30,22 @@ ok( ! -e $sock_path, 'old socket deleted' );
 ok( -S "$sock_path2", 'new socket created' );
 
 use Socket;
+
+# 'exit' on a socket still flushes the replies before closing it
+socket(my $c, PF_UNIX, SOCK_STREAM, 0) || die "socket: $!";
+connect($c, sockaddr_un($sock_path2)) || die "connect: $!";
+$c->autoflush(1);
+$c->print("echo\tbye\nexit\n");
+my $reply= do {
+	local $SIG{ALRM}= sub { die "timeout\n" };
+	alarm 2;
+	my $x= eval { local $/; <$c> };
+	alarm 0;
+	$x;
+};
+like( $reply, qr/^bye\n\z/m, 'reply flushed before exit closed the socket' );
+close $c;
+
 socket(my $s, PF_UNIX, SOCK_STREAM, 0) || die "socket: $!";
 connect($s, sockaddr_un($sock_path2)) || die "connect: $!";
 $s->autoflush(1);
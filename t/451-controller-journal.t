@@ -0,0 +1,112 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use Socket;
+
+$SIG{PIPE}= 'IGNORE'; # daemonproxy closes the socket in the last test
+
+# Every event is 340 bytes, so that the buffer sizes below work out exactly
+sub event_cmd {
+	my $i= shift;
+	return ('service.args', 'foo', sprintf("/x/%05d", $i).('y' x 314));
+}
+my $event_re= qr/service\.args\tfoo\t\/x\/\d{5}y{314}\n/;
+
+# A second controller that generates events without receiving any of them
+sub connect_flooder {
+	my $path= shift;
+	socket(my $s, PF_UNIX, SOCK_STREAM, 0) || die "socket: $!";
+	connect($s, sockaddr_un($path)) || die "connect: $!";
+	$s->autoflush(1);
+	$s->print("conn.subscribe\tservice:nosuch\n");
+	return $s;
+}
+my $next_sync= 0;
+sub flood {
+	my ($s, $from, $count)= @_;
+	my $id= 'flood_'.++$next_sync;
+	$s->print(join("\t", event_cmd($_))."\n") for $from .. $from+$count-1;
+	$s->print("echo\t$id\n");
+	local $SIG{ALRM}= sub { die "timeout\n" };
+	alarm 5;
+	while (defined(my $line= <$s>)) {
+		last if $line eq "$id\n";
+	}
+	alarm 0;
+}
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+
+# Events queued from the journal are written along with the replies that
+# follow them, in order
+$dp->send('echo', 'start');
+$dp->send(event_cmd($_)) for 1..100;
+$dp->send('echo', 'end');
+$dp->recv_stdout_ok( qr/^start\n(?:$event_re){100}end$/m, 'journal events and replies written in order' );
+
+$dp->terminate_ok;
+
+# Stall stdout with a partially written event in the journal, then queue a
+# reply behind it, and evict the event with events from another controller.
+my $sock_path= $dp->temp_path . '/451-socket';
+sub stall_and_evict {
+	my ($flood_count, @run_args)= @_;
+	pipe(my ($r, $w)) or die "pipe: $!";
+	$dp= Test::DaemonProxy->new;
+	$dp->run('-i', @run_args, { fd_1 => [ $w, $r ] });
+	unlink $sock_path;
+	$dp->send('socket.create', '-', $sock_path);
+	$dp->send('conn.resume');
+	$dp->sync;
+	# Fill the stdout pipe with whole pages, so that events queue up
+	$w->blocking(0);
+	1 while syswrite($w, ('x' x 4095)."\n");
+	close $w;
+	my $s= connect_flooder($sock_path);
+	flood($s, 0, 40);
+	# Free one page, so that the next write stops partway into an event
+	sysread($r, $dp->{dp_fds}[1]{buffer}, 4096);
+	sleep 1;
+	$dp->send('echo', 'marker');
+	sleep 1;
+	eval { flood($s, 40, $flood_count) }; # daemonproxy might close the connection first
+	close $s;
+}
+
+# The events go in front of the reply
+stall_and_evict(400);
+$dp->recv_stdout_ok( qr/^marker$/m, 'reply survived eviction' );
+$dp->recv_stdout_ok( qr/^overflow\t\d+$/m, 'then overflow' );
+like( $dp->{last_input_removed}, qr/\A(?:$event_re)*overflow\t\d+\n\z/, 'only whole events before overflow' );
+$dp->terminate_ok;
+
+# Events queued behind the reply are newer than the ones evicted from in front
+# of it, so resuming after the overflow must not repeat any of them.  The
+# journal holds about 190 of these events, and send_buf overflows first.
+stall_and_evict(180, '--controller-send-max', '8K');
+$dp->recv_stdout_ok( qr/^overflow\t(\d+)$/m, 'overflow' );
+my $seq= $dp->last_captures->[0];
+my $before= $dp->{dp_fds}[1]{buffer} . $dp->{last_input_removed};
+like( $before, qr/\/x\/00039y+\nmarker\nservice.args\tfoo\t\/x\/00040y/, 'reply in order' );
+$dp->send('conn.resume', $seq);
+$dp->send('echo', 'done');
+$dp->recv_stdout_ok( qr/^conn.resume\treplay\t\d+\n(?:$event_re)*done$/m, 'replay' );
+my @ids= ($before . $dp->{last_input_removed}) =~ m|/x/(\d{5})|g;
+is_deeply( [ map { $_+0 } @ids ], [ 0..219 ], 'each event once, in order' );
+$dp->terminate_ok;
+
+# Pool buffers can't grow to hold the events, so the connection closes
+# instead.  (the reply plus six events fill the 2K send buffer)
+stall_and_evict(400, '--controller-pool', 4, '--controller-send-max', '2K');
+$dp->recv_stderr_ok( qr/can't buffer events evicted from the journal, closing connection/, 'connection closed' );
+$dp->recv_stdout( qr/\0/ ); # read to EOF
+unlike( $dp->{dp_fds}[1]{buffer}, qr/^(?:marker|overflow)/m, 'nothing written after the partial event' );
+$dp->exit_is( 0 );
+
+done_testing;
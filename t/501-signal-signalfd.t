@@ -0,0 +1,38 @@
+#! /usr/bin/env perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Test::DaemonProxy;
+use POSIX ();
+
+my $dp= Test::DaemonProxy->new;
+$dp->run('-i');
+$dp->timeout(2);
+$dp->send('echo', 'started');
+$dp->recv_ok( qr/^started$/m, 'test comm' );
+
+my $pid= $dp->pid;
+my @signalfd= grep { (readlink($_)||'') =~ /signalfd/ } glob("/proc/$pid/fd/*");
+plan skip_all => 'daemonproxy is not using signalfd' unless @signalfd;
+
+# Signals are blocked and read from the signalfd, not caught by a handler
+my ($blocked)= map { /^SigBlk:\s*([0-9a-f]+)/? hex($1) : () } do { open my $f, '<', "/proc/$pid/status" or die; <$f> };
+ok( $blocked & (1 << (POSIX::SIGHUP() - 1)), 'SIGHUP is blocked' );
+
+kill HUP => $pid;
+$dp->recv_ok( qr/^signal\tSIGHUP\t\d+\t1$/m, 'sighup reported' );
+kill HUP => $pid;
+$dp->recv_ok( qr/^signal\tSIGHUP\t\d+\t2$/m, 'second sighup counted' );
+
+# Services must not inherit the blocked mask
+$dp->send('service.args', 'mask', 'sh', '-c', 'grep SigBlk /proc/self/status >&2');
+$dp->send('service.fds', 'mask', 'null', 'stderr', 'stderr');
+$dp->send('service.start', 'mask');
+$dp->recv_ok( qr/^SigBlk:\s*0+$/m, 'service has no blocked signals' );
+$dp->recv_ok( qr/^service.state\tmask\tdown/m, 'service reaped' );
+
+$dp->terminate_ok;
+done_testing;